@@ -0,0 +1,106 @@
+// Measures the luma kernels against plain scalar loops on planes of the sizes the
+// motion gate and the sharpness score see: a 1080p plane downscaled by 8, by 2 and
+// the full plane.
+//
+// usage: luma_bench [iterations]
+
+#include "../src/luma.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+typedef std::chrono::steady_clock clock_type;
+
+// The scalar versions of the kernels, kept out of line so they are not vectorized
+// into the kernels they are compared with.
+__attribute__((noinline, optimize("no-tree-vectorize"))) static uint64_t scalar_sad(const uint8_t * a, const uint8_t * b,
+                                                                                 size_t size)
+{
+    uint64_t sum = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        sum += std::abs((int)a[i] - (int)b[i]);
+    }
+    return sum;
+}
+
+__attribute__((noinline, optimize("no-tree-vectorize"))) static double scalar_laplacian_variance(const uint8_t * data,
+                                                                                              uint32_t width,
+                                                                                              uint32_t height,
+                                                                                              size_t   pitch)
+{
+    int64_t sum    = 0;
+    int64_t sum_sq = 0;
+    for (uint32_t y = 1; y + 1 < height; y++)
+    {
+        const uint8_t * row = data + y * pitch;
+        for (uint32_t x = 1; x + 1 < width; x++)
+        {
+            int64_t lap = (int64_t)row[x - pitch] + row[x + pitch] + row[x - 1] + row[x + 1] - 4 * (int64_t)row[x];
+            sum += lap;
+            sum_sq += lap * lap;
+        }
+    }
+    double count = (double)(width - 2) * (double)(height - 2);
+    double mean  = (double)sum / count;
+    return (double)sum_sq / count - mean * mean;
+}
+
+static std::vector<uint8_t> random_plane(size_t size, uint32_t seed)
+{
+    std::vector<uint8_t> res(size);
+    for (auto & value : res)
+    {
+        seed  = seed * 1664525 + 1013904223;
+        value = seed >> 24;
+    }
+    return res;
+}
+
+// Runs `kernel` `iterations` times, returns the microseconds per call.
+template <typename F>
+static double time_us(unsigned int iterations, F kernel)
+{
+    volatile double sink = 0;
+    auto            start = clock_type::now();
+    for (unsigned int i = 0; i < iterations; i++)
+    {
+        sink = sink + kernel();
+    }
+    return std::chrono::duration<double, std::micro>(clock_type::now() - start).count() / iterations;
+}
+
+int main(int argc, char ** argv)
+{
+    unsigned int iterations = argc > 1 ? std::atoi(argv[1]) : 200;
+
+    struct Size
+    {
+        uint32_t width, height;
+    };
+    const Size sizes[] = {{240, 135}, {960, 540}, {1920, 1080}};
+
+    std::printf("iterations: %u\n", iterations);
+    std::printf("%-10s %-10s %12s %12s %9s\n", "kernel", "plane", "scalar us", "kernel us", "speedup");
+    for (auto & size : sizes)
+    {
+        size_t pixels = (size_t)size.width * size.height;
+        auto   a      = random_plane(pixels, 1);
+        auto   b      = random_plane(pixels, 2);
+        char   name[32];
+        std::snprintf(name, sizeof(name), "%ux%u", size.width, size.height);
+
+        double scalar = time_us(iterations, [&] { return (double)scalar_sad(a.data(), b.data(), pixels); });
+        double vector = time_us(iterations, [&] { return (double)luma_sad(a.data(), b.data(), pixels); });
+        std::printf("%-10s %-10s %12.2f %12.2f %8.1fx\n", "sad", name, scalar, vector, scalar / vector);
+
+        scalar = time_us(iterations,
+                         [&] { return scalar_laplacian_variance(a.data(), size.width, size.height, size.width); });
+        vector = time_us(iterations,
+                         [&] { return luma_laplacian_variance(a.data(), size.width, size.height, size.width); });
+        std::printf("%-10s %-10s %12.2f %12.2f %8.1fx\n", "laplacian", name, scalar, vector, scalar / vector);
+    }
+    return 0;
+}
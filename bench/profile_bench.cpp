@@ -0,0 +1,177 @@
+// Measures the cost of recording an interval with RapidProfile while several
+// threads record intervals at the same time.
+//
+// Every thread is pinned to a core and records in rounds of half its buffer.
+// The intervals of a round are collected before the next round starts, so no
+// interval is overwritten and the cost of a lossy buffer is not measured.
+//
+// usage: profile_bench [threads] [intervals per thread]
+
+#define RAPID_PROFILE_THREAD_BUFFER_SIZE (1 << 16)
+#define RAPID_PROFILE_COLLECT_PERIOD 1
+#include "../src/profile.hpp"
+
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+typedef RapidProfile::api<RAPID_PROFILE_STR_SIZE> profile;
+
+static const size_t round_size = RAPID_PROFILE_THREAD_BUFFER_SIZE / 2;
+
+// The baseline, a loop the compiler keeps but which does nothing.
+static void empty(size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        asm volatile("" ::: "memory");
+    }
+}
+
+static void record(size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        INTERVAL(bench);
+        INTERVAL_END(bench);
+    }
+}
+
+static double thread_time()
+{
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+static void pin(unsigned int thread)
+{
+    unsigned int cores = std::thread::hardware_concurrency();
+    cpu_set_t    set;
+    CPU_ZERO(&set);
+    CPU_SET(thread % (cores ? cores : 1), &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// Lets the threads start a round once the previous round is collected.
+class rounds
+{
+  public:
+    explicit rounds(unsigned int threads) : threads_(threads), finished_(0), started_(0)
+    {
+    }
+
+    // Called by a thread before recording round `round`.
+    void start(size_t round)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [&]() { return started_ > round; });
+    }
+
+    // Called by a thread after recording a round.
+    void finish()
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        finished_++;
+        cond_.notify_all();
+    }
+
+    // Waits until every thread finished round `round`, collects and starts the next.
+    void advance(size_t round)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [&]() { return finished_ == threads_ * round; });
+        }
+        profile::collect();
+        std::lock_guard<std::mutex> guard(mutex_);
+        started_++;
+        cond_.notify_all();
+    }
+
+  private:
+    std::mutex              mutex_;
+    std::condition_variable cond_;
+    size_t                  threads_;
+    size_t                  finished_;
+    size_t                  started_;
+};
+
+// Returns the mean cpu time per iteration of `body` of one thread in nanoseconds,
+// which stays meaningful when there are fewer cores than threads.
+static double run(unsigned int threads, size_t count, void (*body)(size_t))
+{
+    size_t                   round_count = (count + round_size - 1) / round_size;
+    rounds                   sync(threads);
+    std::vector<std::thread> workers;
+    std::vector<double>      times(threads);
+    for (unsigned int t = 0; t < threads; t++)
+    {
+        workers.emplace_back([t, round_count, body, &sync, &times]() {
+            pin(t);
+            // Register the thread buffer before timing.
+            body(1);
+            double time = 0;
+            for (size_t r = 0; r < round_count; r++)
+            {
+                sync.start(r);
+                double start = thread_time();
+                body(round_size);
+                time += thread_time() - start;
+                sync.finish();
+            }
+            times[t] = time / (round_count * round_size);
+        });
+    }
+    for (size_t r = 0; r <= round_count; r++) sync.advance(r);
+    double sum = 0;
+    for (unsigned int t = 0; t < threads; t++)
+    {
+        workers[t].join();
+        sum += times[t];
+    }
+    return sum / threads;
+}
+
+int main(int argc, char ** argv)
+{
+    unsigned int threads = argc > 1 ? std::atoi(argv[1]) : 8;
+    size_t       count   = argc > 2 ? std::atol(argv[2]) : 10000000;
+
+    double baseline = run(threads, count, empty);
+
+    profile::enable(false);
+    double disabled = run(threads, count, record);
+
+    profile::enable(true);
+    double   enabled = run(threads, count, record);
+    uint64_t lost    = profile::lost_intervals();
+
+    // The timestamp is read twice per interval, report it separately from the bookkeeping.
+    pin(0);
+    RapidProfile::type::ticks      sum   = 0;
+    RapidProfile::type::time_point start = RAPID_PROFILE_NOW();
+    for (size_t i = 0; i < count; i++) sum += RAPID_PROFILE_TICKS();
+    double stamp = std::chrono::duration<double, std::nano>(RAPID_PROFILE_NOW() - start).count() / count;
+    asm volatile("" : : "r"(sum));
+
+    double interval = enabled - baseline;
+    std::printf("threads:              %u on %u cores\n", threads, std::thread::hardware_concurrency());
+    std::printf("intervals per thread: %zu\n", count);
+    std::printf("empty loop:           %6.1f ns per iteration\n", baseline);
+    std::printf("timestamp:            %6.1f ns (%s)\n", stamp, RAPID_PROFILE_COUNTER ? "cpu counter" : "steady clock");
+    std::printf("disabled:             %6.1f ns per interval\n", disabled - baseline);
+    std::printf("enabled:              %6.1f ns per interval\n", interval);
+    std::printf("without timestamps:   %6.1f ns per interval\n", interval - 2 * stamp);
+    std::printf("lost to overwrites:   %lu\n", (unsigned long)lost);
+    std::printf("under 50 ns:          %s\n", interval < 50 ? "yes" : "no");
+    if (lost != 0) std::printf("intervals were lost, the timings include overwritten intervals\n");
+    return 0;
+}
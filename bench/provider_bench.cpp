@@ -0,0 +1,136 @@
+// Measures the setup time of a sequence of streams with a simulated camera provider.
+//
+// The simulated provider only replaces the argus queries behind SensorModeSource,
+// the setup goes through the code the streams use: the provider is acquired from a
+// SharedInstance, the sensor mode tables come from its SensorModeCache and the mode
+// is selected with plan_sensor_mode.
+//
+// The streams are set up three times:
+//  - per stream: the provider is released after every stream and no cache file is set.
+//  - shared:     the provider is kept between the streams, the tables are stored in
+//                the cache file.
+//  - cache file: a new shared instance, as in a new process, which reads the tables
+//                stored by the shared run.
+//
+// usage: provider_bench [streams] [cameras] [create ms] [query ms]
+
+#include "../src/mode_cache.hpp"
+#include "../src/shared.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+static unsigned int cameras   = 2;
+static unsigned int create_ms = 1000;
+static unsigned int query_ms  = 200;
+
+static const char * cache_file = "provider_bench.cache";
+
+// Stands in for the argus camera provider, which connects to the camera daemon when
+// created and queries the sensor of a device for every mode.
+class SimulatedProvider : public SensorModeSource
+{
+  public:
+    SimulatedProvider() : modes(*this, cameras)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(create_ms));
+    }
+
+    std::string identity(size_t device) override
+    {
+        return "00000000-0000-0000-0000-0000000000" + std::to_string(10 + device);
+    }
+
+    size_t sensor_mode_count(size_t) override
+    {
+        return 3;
+    }
+
+    std::vector<SensorModeInfo> query_sensor_modes(size_t) override
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(query_ms));
+        return {
+            {3840, 2160, 33333333, 500000000, 13000, 683709000, 1.0, 22.25, 10},
+            {1920, 1080, 16666666, 500000000, 13000, 683709000, 1.0, 22.25, 10},
+            {1280, 720, 8333333, 500000000, 13000, 683709000, 1.0, 22.25, 10},
+        };
+    }
+
+    SensorModeCache modes;
+};
+
+typedef std::chrono::steady_clock clock_type;
+
+static double ms_since(clock_type::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(clock_type::now() - start).count();
+}
+
+// Sets up the provider side of a stream as ArgusStream does, returns the milliseconds taken.
+static double setup_stream(SharedInstance<SimulatedProvider> & shared)
+{
+    auto start    = clock_type::now();
+    auto provider = shared.acquire();
+
+    std::vector<std::vector<SensorModeInfo> > sensor_modes;
+    for (unsigned int device = 0; device < cameras; device++)
+    {
+        sensor_modes.push_back(provider->modes.sensor_mode_info(device));
+    }
+    plan_sensor_mode(sensor_modes, {1920, 1080}, 30.0);
+    return ms_since(start);
+}
+
+static std::shared_ptr<SimulatedProvider> create()
+{
+    return std::make_shared<SimulatedProvider>();
+}
+
+int main(int argc, char ** argv)
+{
+    unsigned int streams = argc > 1 ? std::atoi(argv[1]) : 5;
+    cameras              = argc > 2 ? std::atoi(argv[2]) : cameras;
+    create_ms            = argc > 3 ? std::atoi(argv[3]) : create_ms;
+    query_ms             = argc > 4 ? std::atoi(argv[4]) : query_ms;
+
+    std::printf("streams:              %u\n", streams);
+    std::printf("cameras:              %u\n", cameras);
+    std::printf("provider create:      %u ms\n", create_ms);
+    std::printf("sensor mode query:    %u ms per camera\n", query_ms);
+
+    std::vector<double> per_stream, shared, cached;
+
+    set_sensor_mode_cache("");
+    SharedInstance<SimulatedProvider> released(create);
+    for (unsigned int i = 0; i < streams; i++)
+    {
+        per_stream.push_back(setup_stream(released));
+        released.release();
+    }
+
+    std::remove(cache_file);
+    set_sensor_mode_cache(cache_file);
+    SharedInstance<SimulatedProvider> kept(create);
+    for (unsigned int i = 0; i < streams; i++) shared.push_back(setup_stream(kept));
+
+    SharedInstance<SimulatedProvider> next_process(create);
+    for (unsigned int i = 0; i < streams; i++) cached.push_back(setup_stream(next_process));
+    std::remove(cache_file);
+
+    std::printf("%-8s %14s %14s %14s\n", "stream", "per stream ms", "shared ms", "cache file ms");
+    double totals[3] = {0, 0, 0};
+    for (unsigned int i = 0; i < streams; i++)
+    {
+        std::printf("%-8u %14.1f %14.3f %14.3f\n", i, per_stream[i], shared[i], cached[i]);
+        totals[0] += per_stream[i];
+        totals[1] += shared[i];
+        totals[2] += cached[i];
+    }
+    std::printf("total:   %14.1f %14.3f %14.3f\n", totals[0], totals[1], totals[2]);
+    return 0;
+}
@@ -1,4 +1,5 @@
-from glob import glob
+import os
+import subprocess
 from setuptools import setup
 
 # Available at setup time due to pyproject.toml
@@ -31,24 +32,28 @@ libraries = [ "nvargus_socketclient"
     , "nvbuf_utils" ]
 
 
-nvidia_source = [ "/usr/src/jetson_multimedia_api/samples/common/classes/NvJpegEncoder.cpp",
-        "/usr/src/jetson_multimedia_api/samples/common/classes/NvElement.cpp",
-        "/usr/src/jetson_multimedia_api/samples/common/classes/NvElementProfiler.cpp",
-        "/usr/src/jetson_multimedia_api/samples/common/classes/NvLogging.cpp",
-        ]
+# The capture pipeline is built once by the makefile as a static library, with the
+# same flags as the C interface and the recorder. The module only adds the bindings.
+root = os.path.dirname(os.path.abspath(__file__))
+core_library = os.path.join(root, "build", "lib", "libjepture.a")
+
+
+class build_ext_with_core(build_ext):
+    def run(self):
+        subprocess.check_call(["make", "-C", root, "release"])
+        super().run()
 
-sources = list(glob("src/*.cpp"))
-sources.extend(nvidia_source)
 
 ext_modules = [
     Pybind11Extension("jepture",
-        sources,
-        #["src/main.cpp"],
+        ["src/main.cpp"],
         # Example: passing in the version to the compiled code
         define_macros = [('VERSION_INFO', __version__)],
         include_dirs = include_dirs,
         libraries = libraries,
-        library_dirs = library_dirs
+        library_dirs = library_dirs,
+        extra_objects = [core_library],
+        cxx_std = 17,
         ),
 ]
 
@@ -64,6 +69,6 @@ setup(
     extras_require={"test": "pytest"},
     # Currently, build_ext only provides an optional "highest supported C++
     # level" feature, but in the future it may provide more features.
-    cmdclass={"build_ext": build_ext},
+    cmdclass={"build_ext": build_ext_with_core},
     zip_safe=False,
 )
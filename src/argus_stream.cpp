@@ -1,36 +1,17 @@
 #include "jepture.hpp"
 #include "profile.hpp"
+#include "config.hpp"
 
+#include <algorithm>
+#include <cmath>
 #include <cstdio>
+#include <cstring>
 #include <sstream>
 #include <limits>
 #include <iostream>
 
-uint32_t select_sensor_mode(std::vector<SensorMode*> & sensor_modes, float fps){
-    if (sensor_modes.size() == 0){
-        throw std::runtime_error("Could not get sensor_modes for camera");
-    }
-    uint64_t fps_nano =  1e9 / static_cast<double>(fps) + 0.9;
-    for (uint32_t i = 0; i < sensor_modes.size(); i++) {
-        std::cout << "sensor mode[" << i << "] ";
-        auto i_sensor_mode = interface_cast<ISensorMode>(sensor_modes[i]);
-        auto duration = i_sensor_mode->getFrameDurationRange();
-        std::cout << "fps: " << (double)1e9 / (double)duration.min();
-        auto res = i_sensor_mode->getResolution();
-        std::cout << " resolution: " << res.width() << "x" << res.height() << std::endl;
-
-
-        if (duration.min() <= fps_nano && duration.max() >= fps_nano){
-            std::cout << "selected mode: " << i << std::endl;
-            return i;
-        }
-
-    }
-    throw std::runtime_error("Could not find a sensor mode which supports requested fps");
-}
-
-void ArgusStream::print_settings(){
-    auto i_request = interface_cast<IRequest>(this->request.get());
+void ArgusStream::print_settings(CaptureGroup & group){
+    auto i_request = interface_cast<IRequest>(group.request.get());
     auto i_settings = interface_cast<IAutoControlSettings>(i_request->getAutoControlSettings());
 
     auto isp_gain_range = i_settings->getIspDigitalGainRange();
@@ -49,7 +30,7 @@ void ArgusStream::print_settings(){
     auto optical_black = i_source_settings->getOpticalBlack();
     std::cout << "Optical Black r:" << optical_black.r() << " b:" << optical_black.b() << " g_even:" << optical_black.gEven() << "g_odd:" << optical_black.gOdd() << std::endl;
 
-    auto i_denoise = interface_cast<IDenoiseSettings>(this->request.get());
+    auto i_denoise = interface_cast<IDenoiseSettings>(group.request.get());
     std::cout << "Denoise mode:";
     auto denoise_mode = i_denoise->getDenoiseMode();
     if (denoise_mode == DENOISE_MODE_OFF){
@@ -65,87 +46,79 @@ void ArgusStream::print_settings(){
     std::cout << "Denoise strength: " << i_denoise->getDenoiseStrength() << std::endl;
 }
 
-void ArgusStream::apply_settings(std::unordered_map<std::string,double> settings){
-    auto i_request = interface_cast<IRequest>(this->request.get());
-    auto i_settings = interface_cast<IAutoControlSettings>(i_request->getAutoControlSettings());
-
-    {
-        auto isp_gain_range = i_settings->getIspDigitalGainRange();
-        auto min_isp = settings.find("min_auto_isp_gain");
-        if(min_isp != settings.end()){
-            if (min_isp->second < isp_gain_range.min() || min_isp->second > isp_gain_range.max()){
-                auto stream = std::stringstream();
-                stream << "Invalid settings value `min_auto_isp_gain` value was: `" << min_isp->second 
-                    << "` valid range was allowed is `"<< isp_gain_range.min() << ".." << isp_gain_range.max() << "`.";
-                throw std::runtime_error(stream.str());
-            }
-            isp_gain_range.min() = min_isp->second;
+// Sets the bounds of `range` from the `min_name` and `max_name` settings, which must lie within `limits`.
+template<class T>
+static void update_range(const std::unordered_map<std::string,double> & settings,
+        const char * min_name, const char * max_name, const Range<T> & limits, Range<T> & range){
+    for(auto name: {min_name,max_name}){
+        auto value = settings.find(name);
+        if(value == settings.end()){
+            continue;
         }
-        auto max_isp = settings.find("max_auto_isp_gain");
-        if(max_isp != settings.end()){
-            if (max_isp->second < isp_gain_range.min() || max_isp->second > isp_gain_range.max()){
-                auto stream = std::stringstream();
-                stream << "Invalid settings value `max_auto_isp_gain` value was: `" << max_isp->second 
-                    << "` valid range was allowed is `"<< isp_gain_range.min() << ".." << isp_gain_range.max() << "`.";
-                throw std::runtime_error(stream.str());
-            }
-            isp_gain_range.max() = max_isp->second;
+        if (value->second < limits.min() || value->second > limits.max()){
+            auto stream = std::stringstream();
+            stream << "Invalid settings value `" << name << "` value was: `" << value->second
+                << "` valid range was allowed is `"<< limits.min() << ".." << limits.max() << "`.";
+            throw std::runtime_error(stream.str());
+        }
+        if(name == min_name){
+            range.min() = value->second;
+        }else{
+            range.max() = value->second;
         }
-        i_settings->setIspDigitalGainRange(isp_gain_range);
     }
+    if(range.min() > range.max()){
+        auto stream = std::stringstream();
+        stream << "Invalid settings `" << min_name << "` is larger than `" << max_name << "`: `"
+            << range.min() << "` > `" << range.max() << "`.";
+        throw std::runtime_error(stream.str());
+    }
+}
 
+GroupSettings ArgusStream::validate_settings(CaptureGroup & group, const std::unordered_map<std::string,double> & settings){
+    auto i_request = interface_cast<IRequest>(group.request.get());
+    auto i_settings = interface_cast<IAutoControlSettings>(i_request->getAutoControlSettings());
     auto i_source_settings = interface_cast<ISourceSettings>(i_request->getSourceSettings());
-    {
-        auto gain_range = i_source_settings->getGainRange();
-        auto min_isp = settings.find("min_gain");
-        if(min_isp != settings.end()){
-            if (min_isp->second < gain_range.min() || min_isp->second > gain_range.max()){
-                auto stream = std::stringstream();
-                stream << "Invalid settings value `min_gain` value was: `" << min_isp->second 
-                    << "` valid range was allowed is `"<< gain_range.min() << ".." << gain_range.max() << "`.";
-                throw std::runtime_error(stream.str());
-            }
-            gain_range.min() = min_isp->second;
-        }
-        auto max_isp = settings.find("max_gain");
-        if(max_isp != settings.end()){
-            if (max_isp->second < gain_range.min() || max_isp->second > gain_range.max()){
-                auto stream = std::stringstream();
-                stream << "Invalid settings value `max_gain` value was: `" << max_isp->second 
-                    << "` valid range was allowed is `"<< gain_range.min() << ".." << gain_range.max() << "`.";
-                throw std::runtime_error(stream.str());
-            }
-            gain_range.max() = max_isp->second;
-        }
-        i_source_settings->setGainRange(gain_range);
+
+    // The gain and exposure limits of the sensor mode, shared by the cameras of the group.
+    Range<float> gain_limits(0.0,std::numeric_limits<float>::max());
+    Range<uint64_t> exposure_limits(0,std::numeric_limits<uint64_t>::max());
+    for(auto index: group.cameras){
+        auto & info = this->provider->sensor_mode_info(this->cameras[index]->device).at(group.sensor_mode);
+        gain_limits.min() = std::max(gain_limits.min(),info.min_analog_gain);
+        gain_limits.max() = std::min(gain_limits.max(),info.max_analog_gain);
+        exposure_limits.min() = std::max(exposure_limits.min(),info.min_exposure_time);
+        exposure_limits.max() = std::min(exposure_limits.max(),info.max_exposure_time);
     }
 
-    {
-        auto exposure_range = i_source_settings->getExposureTimeRange();
-        auto min_exposure_time = settings.find("min_exposure_time");
-        if(min_exposure_time != settings.end()){
-            if (min_exposure_time->second < exposure_range.min() || min_exposure_time->second > exposure_range.max()){
-                auto stream = std::stringstream();
-                stream << "Invalid settings value `min_exposure_time` value was: `" << min_exposure_time->second 
-                    << "` valid range was allowed is `"<< exposure_range.min() << ".." << exposure_range.max() << "`.";
-                throw std::runtime_error(stream.str());
-            }
-            exposure_range.min() = min_exposure_time->second;
-        }
-        auto max_exposure_time = settings.find("max_exposure_time");
-        if(max_exposure_time != settings.end()){
-            if (max_exposure_time->second < exposure_range.min() || max_exposure_time->second > exposure_range.max()){
-                auto stream = std::stringstream();
-                stream << "Invalid settings value `max_exposure_time` value was: `" << max_exposure_time->second 
-                    << "` valid range was allowed is `"<< exposure_range.min() << ".." << exposure_range.max() << "`.";
-                throw std::runtime_error(stream.str());
-            }
-            exposure_range.max() = max_exposure_time->second;
-        }
-        i_source_settings->setExposureTimeRange(exposure_range);
+    GroupSettings validated{
+        i_settings->getIspDigitalGainRange(),
+        i_source_settings->getGainRange(),
+        i_source_settings->getExposureTimeRange(),
+    };
+    update_range(settings,"min_auto_isp_gain","max_auto_isp_gain",this->isp_gain_limits,validated.isp_gain_range);
+    update_range(settings,"min_gain","max_gain",gain_limits,validated.gain_range);
+    update_range(settings,"min_exposure_time","max_exposure_time",exposure_limits,validated.exposure_range);
+
+    auto denoise = settings.find("denoise");
+    if(denoise != settings.end() && denoise->second != 0 && denoise->second != 1 && denoise->second != 2){
+        auto stream = std::stringstream();
+        stream << "Invalid settings value `denoise` value was: `" << denoise->second << "` valid values are 0, 1 and 2.";
+        throw std::runtime_error(stream.str());
     }
+    return validated;
+}
 
+void ArgusStream::apply_settings(CaptureGroup & group, const std::unordered_map<std::string,double> & settings,
+        const GroupSettings & validated){
+    auto i_request = interface_cast<IRequest>(group.request.get());
+    auto i_settings = interface_cast<IAutoControlSettings>(i_request->getAutoControlSettings());
+    auto i_source_settings = interface_cast<ISourceSettings>(i_request->getSourceSettings());
+    auto i_denoise = interface_cast<IDenoiseSettings>(group.request.get());
 
+    i_settings->setIspDigitalGainRange(validated.isp_gain_range);
+    i_source_settings->setGainRange(validated.gain_range);
+    i_source_settings->setExposureTimeRange(validated.exposure_range);
 
     {
         auto optical_black = i_source_settings->getOpticalBlack();
@@ -178,17 +151,14 @@ void ArgusStream::apply_settings(std::unordered_map<std::string,double> settings
     }
 
     {
-        auto i_denoise = interface_cast<IDenoiseSettings>(this->request.get());
         auto denoise = settings.find("denoise");
         if(denoise != settings.end()){
             if (denoise->second == 0){
                 i_denoise->setDenoiseMode(DENOISE_MODE_OFF);
             }else if (denoise->second == 1){
                 i_denoise->setDenoiseMode(DENOISE_MODE_FAST);
-            }else if (denoise->second == 2){
-                i_denoise->setDenoiseMode(DENOISE_MODE_HIGH_QUALITY);
             }else{
-                std::cout << "Invalid denoise mode: " << denoise->second << std::endl;
+                i_denoise->setDenoiseMode(DENOISE_MODE_HIGH_QUALITY);
             }
         }
         auto denoise_strength = settings.find("denoise_strength");
@@ -199,30 +169,101 @@ void ArgusStream::apply_settings(std::unordered_map<std::string,double> settings
 
 }
 
+// The configuration of a camera, cameras with the same configuration share a capture session.
+struct CameraConfig{
+    Size2D<uint32_t> resolution;
+    float fps;
+    std::optional<uint32_t> mode;
+    std::unordered_map<std::string,double> settings;
+    // Whether the values are the ones of the stream, see `CaptureGroup`.
+    bool default_resolution;
+    bool default_fps;
+    bool default_mode;
+
+    bool operator==(const CameraConfig & other) const {
+        return this->resolution.width() == other.resolution.width()
+            && this->resolution.height() == other.resolution.height()
+            && this->fps == other.fps
+            && this->mode == other.mode
+            && this->settings == other.settings
+            && this->default_resolution == other.default_resolution
+            && this->default_fps == other.default_fps
+            && this->default_mode == other.default_mode;
+    }
+};
+
+// Overrides the configuration of the stream with the `camera_config` entry of a camera.
+static CameraConfig camera_config_entry(CameraConfig config, const std::unordered_map<std::string,double> & entry){
+    config.resolution = Size2D<uint32_t>(
+            config_value(entry,"camera_config","width",config.resolution.width(),1.0,65536.0),
+            config_value(entry,"camera_config","height",config.resolution.height(),1.0,65536.0));
+    config.fps = config_value(entry,"camera_config","fps",config.fps,0.001,10000.0);
+    if(entry.count("mode")){
+        config.mode = config_value(entry,"camera_config","mode",0.0,0.0,1024.0);
+    }
+    config.default_resolution = !entry.count("width") && !entry.count("height");
+    config.default_fps = !entry.count("fps");
+    config.default_mode = !entry.count("mode");
+    // Every other key except the region of interest is a capture setting.
+    for(auto & value: entry){
+        if(value.first != "width" && value.first != "height" && value.first != "fps" && value.first != "mode"
+                && value.first.rfind("roi_",0) != 0){
+            config.settings[value.first] = value.second;
+        }
+    }
+    return config;
+}
+
+// The region of interest of the `camera_config` entry of a camera, given in pixels of `frame`
+// and returned in fractions of the frame.
+static std::optional<Rectangle<float>> camera_roi(const Size2D<uint32_t> & frame, const std::unordered_map<std::string,double> & entry){
+    if(!entry.count("roi_x") && !entry.count("roi_y") && !entry.count("roi_width") && !entry.count("roi_height")){
+        return std::nullopt;
+    }
+    double width = frame.width();
+    double height = frame.height();
+    double x = config_value(entry,"camera_config","roi_x",0.0,0.0,width - 2.0);
+    double y = config_value(entry,"camera_config","roi_y",0.0,0.0,height - 2.0);
+    double roi_width = config_value(entry,"camera_config","roi_width",width - x,2.0,width - x);
+    double roi_height = config_value(entry,"camera_config","roi_height",height - y,2.0,height - y);
+    return Rectangle<float>(x / width,y / height,(x + roi_width) / width,(y + roi_height) / height);
+}
+
+// The pixels of `frame` covered by the region `roi`, aligned to even coordinates for YUV420 buffers.
+static NvBufferRect roi_rect(const Size2D<uint32_t> & frame, const Rectangle<float> & roi){
+    NvBufferRect rect;
+    rect.left = std::min((uint32_t)std::lround(frame.width() * roi.left()) & ~1u,frame.width() - 2);
+    rect.top = std::min((uint32_t)std::lround(frame.height() * roi.top()) & ~1u,frame.height() - 2);
+    uint32_t right = std::min((uint32_t)std::lround(frame.width() * roi.right()),frame.width());
+    uint32_t bottom = std::min((uint32_t)std::lround(frame.height() * roi.bottom()),frame.height());
+    rect.width = std::max((right - std::min(right,rect.left)) & ~1u,2u);
+    rect.height = std::max((bottom - std::min(bottom,rect.top)) & ~1u,2u);
+    return rect;
+}
+
 ArgusStream::ArgusStream(
         std::vector<std::tuple<uint32_t,std::string> > cameras, 
         std::pair<uint32_t,uint32_t> resolution, 
         float fps,
         std::optional<uint32_t> mode,
-        std::optional<std::unordered_map<std::string,double>> settings){
-    this->resolution = Size2D<uint32_t>(resolution.first,resolution.second);
-    this->fps = fps;
-    this->provider.reset(CameraProvider::create());
-    ICameraProvider * i_camera_provider = interface_cast<ICameraProvider>(this->provider);
-    if(!i_camera_provider)
-        throw std::runtime_error("failed to create camera provider");
-
-    std::printf("Argus Version: %s\n", i_camera_provider->getVersion().c_str());
-    std::vector<CameraDevice *> camera_devices;
-    i_camera_provider->getCameraDevices(&camera_devices);
+        std::optional<std::unordered_map<std::string,double>> settings,
+        std::optional<std::unordered_map<std::string,std::unordered_map<std::string,double>>> camera_config){
+    std::vector<std::string> camera_names;
+    for(auto & camera: cameras){
+        camera_names.push_back(std::get<1>(camera));
+    }
+    this->counters.set_cameras(camera_names);
+    // The provider and its devices are shared with the other streams of the process.
+    this->provider = shared_camera_provider();
+    ICameraProvider * i_camera_provider = this->provider->get();
+    std::vector<CameraDevice *> camera_devices = this->provider->camera_devices();
 
     if (camera_devices.size() == 0){
         throw std::runtime_error("Could not find any cameras");
     }
 
-    std::vector<CameraDevice *> cameras_in_use;
     for(auto & data: cameras){
-        if(std::get<0>(data) > camera_devices.size()){
+        if(std::get<0>(data) >= camera_devices.size()){
             auto stream = std::stringstream();
             stream << "Could not find camera with id: \"" << std::get<0>(data) << "\".";
             throw std::runtime_error(stream.str());
@@ -232,162 +273,753 @@ ArgusStream::ArgusStream(
             stream << "Camera with id: \"" << std::get<0>(data) << "\" used twice.";
             throw std::runtime_error(stream.str());
         }
-        cameras_in_use.push_back(camera_devices[std::get<0>(data)]);
         camera_devices[std::get<0>(data)] = NULL;
     }
+    if(camera_config){
+        for(auto & entry: *camera_config){
+            if(std::find(camera_names.begin(),camera_names.end(),entry.first) == camera_names.end()){
+                auto stream = std::stringstream();
+                stream << "camera_config has an entry for unknown camera \"" << entry.first << "\".";
+                throw std::runtime_error(stream.str());
+            }
+        }
+    }
 
-    this->session.reset(i_camera_provider->createCaptureSession(cameras_in_use));
+    CameraConfig stream_config{Size2D<uint32_t>(resolution.first,resolution.second),fps,mode,{},true,true,true};
+    if(settings){
+        stream_config.settings = *settings;
+    }
+    std::vector<CameraConfig> group_configs;
+    for(uint32_t i = 0;i < cameras.size();i++){
+        auto config = stream_config;
+        if(camera_config && camera_config->count(camera_names[i])){
+            config = camera_config_entry(config,camera_config->at(camera_names[i]));
+        }
+        auto group = std::find(group_configs.begin(),group_configs.end(),config);
+        if(group == group_configs.end()){
+            group_configs.push_back(config);
+            this->groups.push_back(std::make_unique<CaptureGroup>());
+            group = group_configs.end() - 1;
+        }
+        uint32_t group_index = group - group_configs.begin();
+        this->groups[group_index]->cameras.push_back(i);
 
+        this->cameras.push_back(std::make_unique<CameraStream>());
+        this->clocks.push_back(std::make_unique<SensorClock>());
+        this->cameras[i]->name = camera_names[i];
+        this->cameras[i]->device = std::get<0>(cameras[i]);
+        this->cameras[i]->group = group_index;
+        this->cameras[i]->number_offset = 0;
+        this->cameras[i]->renumber = false;
+        this->cameras[i]->dma_buffer = 0;
+        this->cameras[i]->preview_dma_buffer = 0;
+        this->cameras[i]->crop_roi = false;
+        this->cameras[i]->roi_dma_buffer = 0;
+        if(camera_config && camera_config->count(camera_names[i])){
+            this->cameras[i]->roi = camera_roi(config.resolution,camera_config->at(camera_names[i]));
+        }
+    }
+
+    this->settings_id = 0;
+    this->last_settings_id = 0;
+    for(uint32_t g = 0;g < this->groups.size();g++){
+        auto & group = *this->groups[g];
+        auto & config = group_configs[g];
+        group.resolution = config.resolution;
+        group.fps = config.fps;
+        group.default_resolution = config.default_resolution;
+        group.default_fps = config.default_fps;
+        group.default_mode = config.default_mode;
 
+        std::vector<CameraDevice *> devices;
+        for(auto index: group.cameras){
+            devices.push_back(this->provider->camera_devices().at(this->cameras[index]->device));
+        }
+        group.session.reset(i_camera_provider->createCaptureSession(devices));
+        group.i_capture_session = interface_cast<ICaptureSession>(group.session);
+        auto i_event_provider = interface_cast<IEventProvider>(group.session);
+
+        if(!i_event_provider || !group.i_capture_session){
+            throw std::runtime_error("Failed to create capture session.");
+        }
 
-    this->i_capture_session = interface_cast<ICaptureSession>(session);
-    auto i_event_provider = interface_cast<IEventProvider>(session);
+        group.request.reset(group.i_capture_session->createRequest());
+        auto i_request = interface_cast<IRequest>(group.request);
+        if(!i_request){
+            throw std::runtime_error("failed to create request");
+        }
 
-    if(!i_event_provider || !i_capture_session){
-        throw std::runtime_error("Failed to create capture session.");
+        for(auto index: group.cameras){
+            this->create_output(group,*this->cameras[index]);
+        }
+
+        group.mode_plan = this->select_mode(group,config.mode,group.resolution,group.fps);
+        group.sensor_mode = group.mode_plan.mode;
+        this->set_sensor_mode(group);
+
+        if(g == 0){
+            // A fresh request reports the full range of the isp gain.
+            auto i_auto_settings = interface_cast<IAutoControlSettings>(i_request->getAutoControlSettings());
+            if(!i_auto_settings){
+                throw std::runtime_error("failed to get auto control settings of the request");
+            }
+            this->isp_gain_limits = i_auto_settings->getIspDigitalGainRange();
+        }
+        i_request->setClientData(this->settings_id);
+
+        if(!config.settings.empty()){
+            this->apply_settings(group,config.settings,this->validate_settings(group,config.settings));
+        }
+        if(verbose()){
+            this->print_settings(group);
+        }
     }
+    this->update_limits();
 
-    UniqueObj<OutputStreamSettings> stream_settings(i_capture_session->createOutputStreamSettings(STREAM_TYPE_EGL));
+    this->sharpness_scale = 1;
+    this->metadata_enabled = false;
+    this->preview_resolution = std::nullopt;
+    this->started = false;
+    this->closed = false;
+    this->warming_up = false;
+}
+
+void ArgusStream::update_limits(){
+    this->resolution = Size2D<uint32_t>(0,0);
+    this->fps = 0.0;
+    for(auto & group: this->groups){
+        this->resolution = Size2D<uint32_t>(
+                std::max(this->resolution.width(),group->resolution.width()),
+                std::max(this->resolution.height(),group->resolution.height()));
+        this->fps = std::max(this->fps,group->fps);
+    }
+}
+
+Size2D<uint32_t> ArgusStream::camera_resolution(uint32_t camera){
+    auto & stream = *this->cameras[camera];
+    auto resolution = this->groups[stream.group]->resolution;
+    if(stream.roi){
+        auto rect = roi_rect(resolution,*stream.roi);
+        return Size2D<uint32_t>(rect.width,rect.height);
+    }
+    return resolution;
+}
+
+void ArgusStream::create_output(CaptureGroup & group, CameraStream & camera){
+    UniqueObj<OutputStreamSettings> stream_settings(group.i_capture_session->createOutputStreamSettings(STREAM_TYPE_EGL));
     auto i_stream_settings = interface_cast<IOutputStreamSettings>(stream_settings.get());
     auto i_egl_stream_settings = interface_cast<IEGLOutputStreamSettings>(stream_settings.get());
     if(!i_egl_stream_settings || !i_stream_settings){
         throw std::runtime_error("Failed to create stream settings");
     }
 
+    // With a clipped region of interest the ISP only outputs the region.
+    Size2D<uint32_t> resolution = group.resolution;
+    if(camera.roi && !camera.crop_roi){
+        auto rect = roi_rect(group.resolution,*camera.roi);
+        resolution = Size2D<uint32_t>(rect.width,rect.height);
+    }
+
     i_egl_stream_settings->setPixelFormat(PIXEL_FMT_YCbCr_420_888);
-    i_egl_stream_settings->setResolution(this->resolution);
+    i_egl_stream_settings->setResolution(resolution);
     i_egl_stream_settings->setEGLDisplay(eglGetDisplay(EGL_DEFAULT_DISPLAY));
+    // The capture metadata carries the id of the settings of every frame.
+    i_egl_stream_settings->setMetadataEnable(true);
+    i_stream_settings->setCameraDevice(this->provider->camera_devices().at(camera.device));
 
+    camera.stream.reset(group.i_capture_session->createOutputStream(stream_settings.get()));
+    auto i_stream = interface_cast<IEGLOutputStream>(camera.stream.get());
+    if(!i_stream){
+        throw std::runtime_error("failed to create stream for one of the cameras");
+    }
+    camera.i_stream = i_stream;
 
-    this->request.reset(i_capture_session->createRequest());
-    auto i_request = interface_cast<IRequest>(request);
-    if(!i_request){
-        throw std::runtime_error("failed to create request");
+    camera.consumer.reset(FrameConsumer::create(camera.stream.get()));
+    auto i_consumer = interface_cast<IFrameConsumer>(camera.consumer.get());
+    if(!i_consumer){
+        throw std::runtime_error("failed to create frame consumer for one of the cameras");
     }
+    camera.i_consumer = i_consumer;
+    camera.dma_buffer = 0;
+    auto i_request = interface_cast<IRequest>(group.request);
+    i_request->enableOutputStream(camera.stream.get());
 
-    std::vector<SensorMode*> sensor_modes;
-    uint32_t sensor_mode = std::numeric_limits<uint32_t>::max();
-    for(uint32_t i = 0;i < cameras.size();i++){
-        ICameraProperties * i_camera_prop= interface_cast<ICameraProperties>(cameras_in_use[i]);
-        if (!i_camera_prop){
-            throw std::runtime_error("Failed to get ICameraProperties interface");
+    if(camera.roi && !camera.crop_roi){
+        auto i_settings = interface_cast<IStreamSettings>(i_request->getStreamSettings(camera.stream.get()));
+        if(!i_settings || i_settings->setSourceClipRect(*camera.roi) != STATUS_OK){
+            // Capture the full frame and crop the region after capture instead.
+            if(verbose()){
+                std::cout << "camera " << camera.name << " does not support clipping, cropping the region of interest" << std::endl;
+            }
+            i_request->disableOutputStream(camera.stream.get());
+            camera.consumer.reset();
+            camera.stream.reset();
+            camera.crop_roi = true;
+            this->create_output(group,camera);
         }
-        sensor_modes.clear();
-        i_camera_prop->getBasicSensorModes(&sensor_modes);
+    }
+}
 
-        uint32_t cur_sensor_mode;
-        if (mode){
-            cur_sensor_mode = *mode;
-        }else{
-            cur_sensor_mode = select_sensor_mode(sensor_modes,fps);
-        }
-        if (sensor_mode != std::numeric_limits<uint32_t>::max() && cur_sensor_mode != sensor_mode){
-            throw std::runtime_error("Cameras can not agree on an sensor mode");
+void ArgusStream::crop(CameraStream & camera){
+    auto rect = roi_rect(this->groups[camera.group]->resolution,*camera.roi);
+    if(!camera.roi_dma_buffer){
+        NvBufferCreateParams create_params;
+        std::memset(&create_params,0,sizeof(NvBufferCreateParams));
+        create_params.width = rect.width;
+        create_params.height = rect.height;
+        create_params.layout = NvBufferLayout_Pitch;
+        create_params.payloadType = NvBufferPayload_SurfArray;
+        create_params.colorFormat = NvBufferColorFormat_YUV420;
+        create_params.nvbuf_tag = NvBufferTag_VIDEO_CONVERT;
+        if(NvBufferCreateEx(&camera.roi_dma_buffer,&create_params)){
+            camera.roi_dma_buffer = 0;
+            throw std::runtime_error("failed to create region of interest buffer");
         }
-        sensor_mode = cur_sensor_mode;
-        i_stream_settings->setCameraDevice(cameras_in_use[i]);
+    }
+    NvBufferTransformParams transform_params = {};
+    transform_params.transform_flag = NVBUFFER_TRANSFORM_CROP_SRC;
+    transform_params.src_rect = rect;
+    if(NvBufferTransform(camera.dma_buffer,camera.roi_dma_buffer,&transform_params)){
+        throw std::runtime_error("failed to crop region of interest");
+    }
+}
 
-        this->cameras.push_back(std::make_unique<CameraStream>());
+void ArgusStream::create_preview(CaptureGroup & group, CameraStream & camera){
+    UniqueObj<OutputStreamSettings> stream_settings(group.i_capture_session->createOutputStreamSettings(STREAM_TYPE_EGL));
+    auto i_stream_settings = interface_cast<IOutputStreamSettings>(stream_settings.get());
+    auto i_egl_stream_settings = interface_cast<IEGLOutputStreamSettings>(stream_settings.get());
+    if(!i_egl_stream_settings || !i_stream_settings){
+        throw std::runtime_error("Failed to create stream settings");
+    }
 
-        this->cameras[i]->stream.reset(i_capture_session->createOutputStream(stream_settings.get()));
-        auto i_stream = interface_cast<IEGLOutputStream>(this->cameras[i]->stream.get());
-        if(!i_stream){
-            throw std::runtime_error("failed to create stream for one of the cameras");
-        }
-        this->cameras[i]->i_stream = i_stream;
+    i_egl_stream_settings->setPixelFormat(PIXEL_FMT_YCbCr_420_888);
+    i_egl_stream_settings->setResolution(*this->preview_resolution);
+    i_egl_stream_settings->setEGLDisplay(eglGetDisplay(EGL_DEFAULT_DISPLAY));
+    // The capture id in the metadata pairs preview frames with the frames of the full output.
+    i_egl_stream_settings->setMetadataEnable(true);
+    i_stream_settings->setCameraDevice(this->provider->camera_devices().at(camera.device));
+
+    // A kept preview frame belongs to the previous output stream.
+    camera.pending_preview.reset();
+    camera.preview_stream.reset(group.i_capture_session->createOutputStream(stream_settings.get()));
+    auto i_stream = interface_cast<IEGLOutputStream>(camera.preview_stream.get());
+    if(!i_stream){
+        throw std::runtime_error("failed to create preview stream for one of the cameras");
+    }
+    camera.i_preview_stream = i_stream;
 
-        this->cameras[i]->consumer.reset(FrameConsumer::create(this->cameras[i]->stream.get()));
-        auto i_consumer = interface_cast<IFrameConsumer>(this->cameras[i]->consumer.get());
-        if(!i_consumer){
-            throw std::runtime_error("failed to create frame consumer for one of the cameras");
+    camera.preview_consumer.reset(FrameConsumer::create(camera.preview_stream.get()));
+    auto i_consumer = interface_cast<IFrameConsumer>(camera.preview_consumer.get());
+    if(!i_consumer){
+        throw std::runtime_error("failed to create preview frame consumer for one of the cameras");
+    }
+    camera.i_preview_consumer = i_consumer;
+    camera.preview_dma_buffer = 0;
+    camera.preview_converter = std::make_unique<BgraConverter>(this->preview_resolution->width(),this->preview_resolution->height());
+    interface_cast<IRequest>(group.request)->enableOutputStream(camera.preview_stream.get());
+}
+
+ModePlan ArgusStream::select_mode(const CaptureGroup & group, std::optional<uint32_t> mode, Size2D<uint32_t> resolution, float fps){
+    std::vector<std::vector<SensorModeInfo>> sensor_modes;
+    for(auto index: group.cameras){
+        sensor_modes.push_back(this->provider->sensor_mode_info(this->cameras[index]->device));
+    }
+    ModePlan plan;
+    if(mode){
+        for(uint32_t i = 0;i < group.cameras.size();i++){
+            if(*mode >= sensor_modes[i].size()){
+                auto stream = std::stringstream();
+                stream << "Camera \"" << this->cameras[group.cameras[i]]->name << "\" has no sensor mode " << *mode << ".";
+                throw std::runtime_error(stream.str());
+            }
         }
-        this->cameras[i]->i_consumer = i_consumer;
-        this->cameras[i]->name = std::get<1>(cameras[i]);
-        this->cameras[i]->dma_buffer = 0;
-        i_request->enableOutputStream(this->cameras[i]->stream.get());
+        // The plan is only informative, a requested mode is used even if no mode supports the fps.
+        try{
+            plan = plan_sensor_mode(sensor_modes,{resolution.width(),resolution.height()},fps);
+        }catch(const std::runtime_error &){
+        }
+        plan.mode = *mode;
+    }else{
+        plan = plan_sensor_mode(sensor_modes,{resolution.width(),resolution.height()},fps);
     }
+    if(verbose()){
+        for(auto & candidate: plan.candidates){
+            std::cout << "sensor mode[" << candidate.mode << "] " << candidate.width << "x" << candidate.height
+                << " fps headroom: " << candidate.fps_headroom
+                << (candidate.supports_fps ? "" : " (unsupported fps)")
+                << (candidate.covers_resolution ? "" : " (upscales)") << std::endl;
+        }
+        std::cout << "selected mode: " << plan.mode << std::endl;
+    }
+    return plan;
+}
 
+void ArgusStream::set_sensor_mode(CaptureGroup & group){
+    auto i_request = interface_cast<IRequest>(group.request);
     auto i_source_settings = interface_cast<ISourceSettings>(i_request->getSourceSettings());
     if(!i_source_settings){
         throw std::runtime_error("failed to create request for a camera");
     }
-    i_source_settings->setSensorMode(sensor_modes.at(sensor_mode));
-    i_source_settings->setFrameDurationRange(Range<uint64_t>(1e9/(double)fps));
-
-
-    if(settings){
-        this->apply_settings(*settings);
-    }
-    this->print_settings();
-
-    this->started = false;
+    i_source_settings->setSensorMode(this->provider->sensor_modes(this->cameras[group.cameras.back()]->device).at(group.sensor_mode));
+    i_source_settings->setFrameDurationRange(Range<uint64_t>(1e9/(double)group.fps));
 }
 
 ArgusStream::~ArgusStream(){
-    if (this->started){
-        this->i_capture_session->stopRepeat();
+    this->close();
+}
+
+void ArgusStream::close(){
+    if(this->closed){
+        return;
+    }
+    this->closed = true;
+    for(auto & group: this->groups){
+        if (this->started){
+            group->i_capture_session->stopRepeat();
+        }
+    }
+    for(auto & group: this->groups){
+        group->i_capture_session->waitForIdle();
     }
-    this->i_capture_session->waitForIdle();
     for(uint32_t i = 0;i < cameras.size();i++){
         this->cameras[i]->i_stream->disconnect();
 
         if(this->cameras[i]->dma_buffer){
             NvBufferDestroy(this->cameras[i]->dma_buffer);
+            this->cameras[i]->dma_buffer = 0;
+        }
+        if(this->cameras[i]->preview_stream){
+            this->cameras[i]->pending_preview.reset();
+            this->cameras[i]->i_preview_stream->disconnect();
+        }
+        if(this->cameras[i]->preview_dma_buffer){
+            NvBufferDestroy(this->cameras[i]->preview_dma_buffer);
+            this->cameras[i]->preview_dma_buffer = 0;
+        }
+        if(this->cameras[i]->roi_dma_buffer){
+            NvBufferDestroy(this->cameras[i]->roi_dma_buffer);
+            this->cameras[i]->roi_dma_buffer = 0;
         }
     }
+    this->sharpness_sampler.reset();
+    // Release the argus objects right away so the sensors are free for the next stream.
+    this->cameras.clear();
+    this->groups.clear();
     this->provider.reset();
 }
 
+bool ArgusStream::is_closed(){
+    return this->closed;
+}
 
-std::vector<ArgusStreamOutput> ArgusStream::next(bool skip){
-    std::vector<ArgusStreamOutput> res;
-    if(!this->started){
-        this->started = true;
-        if(i_capture_session->repeat(this->request.get()) != STATUS_OK){
-            throw std::runtime_error("failed to start capture request");
+ModePlan ArgusStream::sensor_mode_plan(uint32_t camera){
+    if(this->closed){
+        throw std::runtime_error("stream is closed");
+    }
+    if(camera >= this->cameras.size()){
+        throw std::runtime_error("camera index out of range");
+    }
+    return this->groups[this->cameras[camera]->group]->mode_plan;
+}
+
+LatencySummary ArgusStream::latency(Stage stage, bool reset){
+    return this->stage_latency[stage].summary(reset);
+}
+
+void ArgusStream::metrics(std::vector<Metric> & out, bool){
+    this->counters.snapshot(out);
+}
+
+
+void ArgusStream::enable_sharpness(uint32_t scale){
+    this->sharpness_scale = scale;
+    this->sharpness_sampler = std::make_unique<LumaSampler>(
+            std::max(this->resolution.width() / scale,16u),
+            std::max(this->resolution.height() / scale,16u));
+}
+
+void ArgusStream::enable_preview(Size2D<uint32_t> resolution){
+    if(this->started){
+        throw std::runtime_error("the preview must be enabled before capturing starts");
+    }
+    if(this->preview_resolution){
+        throw std::runtime_error("the preview is already enabled");
+    }
+    this->preview_resolution = resolution;
+    for(auto & group: this->groups){
+        for(auto index: group->cameras){
+            this->create_preview(*group,*this->cameras[index]);
         }
-        /*
-           for(uint32_t i = 0;i < this->cameras.size();i++){
-           this->cameras[i]->i_stream->waitUntilConnected();
-           }
-           */
     }
+}
+
+void ArgusStream::enable_metadata(){
+    this->metadata_enabled = true;
+    for(auto & group: this->groups){
+        enable_capture_statistics(group->request.get());
+    }
+}
 
+void ArgusStream::start_capture(){
+    if(this->started){
+        return;
+    }
+    this->started = true;
+    for(auto & group: this->groups){
+        if(group->i_capture_session->repeat(group->request.get()) != STATUS_OK){
+            throw std::runtime_error("failed to start capture request");
+        }
+    }
     for(uint32_t i = 0;i < this->cameras.size();i++){
-        UniqueObj<Frame> frame(this->cameras[i]->i_consumer->acquireFrame());
-        auto i_frame = interface_cast<IFrame>(frame.get());
-        if(!i_frame){
-            throw std::runtime_error("failed to get frame from camera");
+        // Timeout of 5 seconds in nanoseconds.
+        if(this->cameras[i]->i_stream->waitUntilConnected(5000000000ull) != STATUS_OK){
+            throw std::runtime_error("camera stream did not connect");
         }
+        if(this->cameras[i]->preview_stream && this->cameras[i]->i_preview_stream->waitUntilConnected(5000000000ull) != STATUS_OK){
+            throw std::runtime_error("camera preview stream did not connect");
+        }
+    }
+}
 
+bool ArgusStream::reconfigure_capture(std::optional<std::pair<uint32_t,uint32_t>> resolution,
+        std::optional<float> fps,
+        std::optional<uint32_t> mode){
+    if(this->closed){
+        throw std::runtime_error("stream is closed");
+    }
+    // Plan every group before stopping so an unsupported configuration leaves the stream as it was.
+    // Values a group sets in `camera_config` are kept.
+    std::vector<ModePlan> plans;
+    std::vector<Size2D<uint32_t>> resolutions;
+    std::vector<float> rates;
+    for(auto & group: this->groups){
+        bool change_resolution = resolution && group->default_resolution;
+        bool change_fps = fps && group->default_fps;
+        bool change_mode = mode && group->default_mode;
+        resolutions.push_back(change_resolution ? Size2D<uint32_t>(resolution->first,resolution->second) : group->resolution);
+        rates.push_back(change_fps ? *fps : group->fps);
+        bool resize = resolutions.back().width() != group->resolution.width()
+            || resolutions.back().height() != group->resolution.height();
+        plans.push_back(group->mode_plan);
+        if(change_mode || change_fps || resize){
+            // A group with its own sensor mode keeps it, otherwise the mode is planned again.
+            std::optional<uint32_t> new_mode = group->default_mode ? mode : std::optional<uint32_t>(group->sensor_mode);
+            plans.back() = this->select_mode(*group,new_mode,resolutions.back(),rates.back());
+        }
+    }
 
-        auto time_stamp = i_frame->getTime();
-        auto number = i_frame->getNumber();
-
-        if(!skip){
-            auto native_buffer = interface_cast<NV::IImageNativeBuffer>(i_frame->getImage());
-            if(!native_buffer){
-                throw std::runtime_error("native buffers not supported");
-            }
+    bool restart = this->started;
+    if(this->started){
+        for(auto & group: this->groups){
+            group->i_capture_session->stopRepeat();
+        }
+        this->started = false;
+    }
+    for(auto & group: this->groups){
+        group->i_capture_session->waitForIdle();
+    }
 
-            if(!this->cameras[i]->dma_buffer){
-                this->cameras[i]->dma_buffer = native_buffer->createNvBuffer(this->cameras[i]->i_stream->getResolution(),
-                        NVBUF_COLOR_FORMAT_YUV420,
-                        NVBUF_LAYOUT_BLOCK_LINEAR);
-                if(!this->cameras[i]->dma_buffer){
-                    throw std::runtime_error("failed to create dma buffer");
+    bool resized = false;
+    for(uint32_t g = 0;g < this->groups.size();g++){
+        auto & group = *this->groups[g];
+        if(resolutions[g].width() != group.resolution.width() || resolutions[g].height() != group.resolution.height()){
+            resized = true;
+            auto i_request = interface_cast<IRequest>(group.request);
+            group.resolution = resolutions[g];
+            for(auto index: group.cameras){
+                auto & camera = this->cameras[index];
+                i_request->disableOutputStream(camera->stream.get());
+                camera->i_stream->disconnect();
+                if(camera->dma_buffer){
+                    NvBufferDestroy(camera->dma_buffer);
+                    camera->dma_buffer = 0;
                 }
-            }else{
-                if(native_buffer->copyToNvBuffer(this->cameras[i]->dma_buffer) != STATUS_OK){
-                    throw std::runtime_error("failed to copy frame to buffer");
+                if(camera->roi_dma_buffer){
+                    NvBufferDestroy(camera->roi_dma_buffer);
+                    camera->roi_dma_buffer = 0;
                 }
+                camera->consumer.reset();
+                camera->stream.reset();
+                this->create_output(group,*camera);
+                camera->renumber = camera->last_number.has_value();
+                camera->last_output.reset();
+            }
+        }
+        group.fps = rates[g];
+        group.mode_plan = plans[g];
+        group.sensor_mode = plans[g].mode;
+        this->set_sensor_mode(group);
+    }
+    this->update_limits();
+    if(resized && this->sharpness_sampler){
+        this->enable_sharpness(this->sharpness_scale);
+    }
+
+    if(restart){
+        this->start_capture();
+    }
+    return resized;
+}
+
+uint32_t ArgusStream::update_settings(std::unordered_map<std::string,double> settings){
+    if(this->closed){
+        throw std::runtime_error("stream is closed");
+    }
+    // Validate the settings for every group before changing any request, so settings which are
+    // invalid for one group leave all of them as they were.
+    std::vector<GroupSettings> validated;
+    for(auto & group: this->groups){
+        validated.push_back(this->validate_settings(*group,settings));
+    }
+    for(size_t g = 0;g < this->groups.size();++g){
+        this->apply_settings(*this->groups[g],settings,validated[g]);
+    }
+    this->settings_id++;
+    for(auto & group: this->groups){
+        auto i_request = interface_cast<IRequest>(group->request.get());
+        i_request->setClientData(this->settings_id);
+        // Replacing the repeating request does not interrupt capturing.
+        if(this->started && group->i_capture_session->repeat(group->request.get()) != STATUS_OK){
+            throw std::runtime_error("failed to update capture request");
+        }
+    }
+    return this->settings_id;
+}
+
+std::optional<uint64_t> ArgusStream::settings_frame(uint32_t id){
+    std::lock_guard<std::mutex> guard(this->settings_mutex);
+    for(auto & entry: this->settings_frames){
+        if(entry.first == id){
+            return entry.second;
+        }
+    }
+    return std::nullopt;
+}
+
+bool ArgusStream::acquire(uint32_t i, bool skip, bool wait, ArgusStreamOutput & out){
+    auto & camera = *this->cameras[i];
+    INTERVAL(acquire);
+    auto acquire_start = std::chrono::steady_clock::now();
+    UniqueObj<Frame> frame;
+    if(wait){
+        frame.reset(camera.i_consumer->acquireFrame());
+    }else{
+        // Take the newest frame which is ready, the frames before it are released.
+        while(true){
+            UniqueObj<Frame> next(camera.i_consumer->acquireFrame(0));
+            if(!next){
+                break;
             }
+            frame.reset(next.release());
+        }
+        if(!frame){
+            return false;
+        }
+    }
+    auto i_frame = interface_cast<IFrame>(frame.get());
+    if(!i_frame){
+        throw std::runtime_error("failed to get frame from camera");
+    }
+
+
+    auto time_stamp = i_frame->getTime();
+    uint64_t number = i_frame->getNumber();
+    if(camera.renumber){
+        camera.number_offset = *camera.last_number + 1 - number;
+        camera.renumber = false;
+    }
+    number += camera.number_offset;
+    camera.last_number = number;
+
+    uint32_t settings_id = 0;
+    uint32_t capture_id = 0;
+    auto i_metadata = interface_cast<IArgusCaptureMetadata>(frame.get());
+    if(i_metadata){
+        auto i_capture_metadata = interface_cast<const ICaptureMetadata>(i_metadata->getMetadata());
+        if(i_capture_metadata){
+            settings_id = i_capture_metadata->getClientData();
+            capture_id = i_capture_metadata->getCaptureId();
+        }
+    }
+    FrameMetadata metadata = {};
+    if(this->metadata_enabled){
+        metadata.camera = i;
+        metadata.number = number;
+        read_capture_metadata(frame.get(),metadata);
+    }
+    if(i == 0 && settings_id != this->last_settings_id){
+        std::lock_guard<std::mutex> guard(this->settings_mutex);
+        this->last_settings_id = settings_id;
+        this->settings_frames.emplace_back(settings_id,number);
+        if(this->settings_frames.size() > 64){
+            this->settings_frames.pop_front();
+        }
+    }
+    this->clocks[i]->observe(time_stamp,monotonic_ns());
+    this->counters.acquired(i,number,!this->warming_up);
+    INTERVAL_FLOW(frame_flow(i,number));
+    INTERVAL_END(acquire);
+    this->stage_latency[Stage::Acquire].record_since(acquire_start);
+
+    if(!skip){
+        INTERVAL(copy_to_nvbuffer);
+        auto copy_start = std::chrono::steady_clock::now();
+        auto native_buffer = interface_cast<NV::IImageNativeBuffer>(i_frame->getImage());
+        if(!native_buffer){
+            throw std::runtime_error("native buffers not supported");
+        }
+
+        if(!camera.dma_buffer){
+            camera.dma_buffer = native_buffer->createNvBuffer(camera.i_stream->getResolution(),
+                    NVBUF_COLOR_FORMAT_YUV420,
+                    NVBUF_LAYOUT_BLOCK_LINEAR);
+            if(!camera.dma_buffer){
+                throw std::runtime_error("failed to create dma buffer");
+            }
+        }else{
+            if(native_buffer->copyToNvBuffer(camera.dma_buffer) != STATUS_OK){
+                throw std::runtime_error("failed to copy frame to buffer");
+            }
+        }
+        INTERVAL_END(copy_to_nvbuffer);
+        this->stage_latency[Stage::CopyToNvBuffer].record_since(copy_start);
+    }
+
+    // The following stages only see the region of interest.
+    int dma_buffer = camera.dma_buffer;
+    if(!skip && camera.crop_roi){
+        INTERVAL(crop);
+        auto crop_start = std::chrono::steady_clock::now();
+        this->crop(camera);
+        dma_buffer = camera.roi_dma_buffer;
+        INTERVAL_END(crop);
+        this->stage_latency[Stage::Crop].record_since(crop_start);
+    }
+
+    float sharpness = 0.0;
+    if(!skip && this->sharpness_sampler){
+        INTERVAL(sharpness);
+        auto sharpness_start = std::chrono::steady_clock::now();
+        this->sharpness_sampler->sample(dma_buffer,this->sharpness_luma);
+        sharpness = luma_laplacian_variance(this->sharpness_luma.data(),
+                this->sharpness_sampler->width,
+                this->sharpness_sampler->height,
+                this->sharpness_sampler->width);
+        INTERVAL_END(sharpness);
+        this->stage_latency[Stage::Sharpness].record_since(sharpness_start);
+    }
+    ImageBuffer preview{};
+    if(camera.preview_stream){
+        preview = this->acquire_preview(camera,capture_id,skip);
+    }
+    out = {
+        number,
+        time_stamp,
+        dma_buffer,
+        sharpness,
+        settings_id,
+        metadata,
+        preview,
+        true
+    };
+    return true;
+}
+
+void ArgusStream::warm_up_previews(const std::vector<ArgusStreamOutput> & frames){
+    for(uint32_t i = 0;i < this->cameras.size() && i < frames.size();i++){
+        auto & camera = *this->cameras[i];
+        if(camera.preview_converter){
+            camera.preview_converter->transform(frames[i].dma_buffer);
+            camera.preview_converter->read();
+        }
+    }
+}
+
+// The id of the capture a frame belongs to, 0 if the frame has no metadata.
+static uint32_t frame_capture_id(Frame * frame){
+    auto i_metadata = interface_cast<IArgusCaptureMetadata>(frame);
+    if(!i_metadata){
+        return 0;
+    }
+    auto i_capture_metadata = interface_cast<const ICaptureMetadata>(i_metadata->getMetadata());
+    return i_capture_metadata ? i_capture_metadata->getCaptureId() : 0;
+}
+
+ImageBuffer ArgusStream::acquire_preview(CameraStream & camera, uint32_t capture_id, bool skip){
+    INTERVAL(preview);
+    auto preview_start = std::chrono::steady_clock::now();
+    // Both outputs receive every capture, preview frames of earlier captures belong to
+    // frames of the full output which were dropped. A preview frame of a later capture
+    // belongs to a frame of the full output which is not yet acquired.
+    UniqueObj<Frame> frame(camera.pending_preview.release());
+    IFrame * i_frame = nullptr;
+    bool paired = false;
+    while(true){
+        if(!frame){
+            frame.reset(camera.i_preview_consumer->acquireFrame());
+        }
+        i_frame = interface_cast<IFrame>(frame.get());
+        if(!i_frame){
+            throw std::runtime_error("failed to get preview frame from camera");
+        }
+        uint32_t preview_id = frame_capture_id(frame.get());
+        if(capture_id == 0 || preview_id == 0){
+            // Without capture ids the frames can not be paired.
+            break;
+        }
+        if(preview_id > capture_id){
+            camera.pending_preview.reset(frame.release());
+            break;
+        }
+        if(preview_id == capture_id){
+            paired = true;
+            break;
+        }
+        frame.reset();
+    }
+
+    ImageBuffer image{};
+    if(paired && !skip){
+        auto native_buffer = interface_cast<NV::IImageNativeBuffer>(i_frame->getImage());
+        if(!native_buffer){
+            throw std::runtime_error("native buffers not supported");
+        }
+        if(!camera.preview_dma_buffer){
+            camera.preview_dma_buffer = native_buffer->createNvBuffer(camera.i_preview_stream->getResolution(),
+                    NVBUF_COLOR_FORMAT_YUV420,
+                    NVBUF_LAYOUT_BLOCK_LINEAR);
+            if(!camera.preview_dma_buffer){
+                throw std::runtime_error("failed to create preview dma buffer");
+            }
+        }else if(native_buffer->copyToNvBuffer(camera.preview_dma_buffer) != STATUS_OK){
+            throw std::runtime_error("failed to copy preview frame to buffer");
+        }
+        camera.preview_converter->transform(camera.preview_dma_buffer);
+        image = camera.preview_converter->read();
+    }
+    INTERVAL_END(preview);
+    this->stage_latency[Stage::Preview].record_since(preview_start);
+    return image;
+}
+
+std::vector<ArgusStreamOutput> ArgusStream::next(bool skip){
+    if(this->closed){
+        throw std::runtime_error("stream is closed");
+    }
+    std::vector<ArgusStreamOutput> res(this->cameras.size());
+    this->start_capture();
+
+    for(uint32_t i = 0;i < this->cameras.size();i++){
+        auto & camera = *this->cameras[i];
+        // The group of the first camera paces the stream, the cameras of other groups
+        // return their newest frame or repeat the last one if none arrived since.
+        bool wait = camera.group == 0 || !camera.last_output;
+        if(this->acquire(i,skip,wait,res[i])){
+            camera.last_output = res[i];
+            camera.last_output->fresh = false;
+        }else{
+            res[i] = *camera.last_output;
         }
-        res.push_back({
-                number,
-                time_stamp,
-                this->cameras[i]->dma_buffer
-                });
     }
     return res;
 }
@@ -0,0 +1,69 @@
+#include "jepture.hpp"
+
+#include <cstring>
+
+BgraConverter::BgraConverter(uint32_t width, uint32_t height){
+    this->width = width;
+    this->height = height;
+
+    this->transform_params = {};
+    this->transform_params.transform_flag = NVBUFFER_TRANSFORM_FILTER | NVBUFFER_TRANSFORM_FLIP;
+    this->transform_params.transform_flip = NvBufferTransform_None;
+    this->transform_params.transform_filter = NvBufferTransform_Filter_Nearest;
+
+    NvBufferCreateParams create_params;
+    std::memset(&create_params,0,sizeof(NvBufferCreateParams));
+    create_params.width = width;
+    create_params.height = height;
+    create_params.layout = NvBufferLayout_Pitch;
+    create_params.payloadType = NvBufferPayload_SurfArray;
+    create_params.colorFormat = NvBufferColorFormat_ARGB32;
+    create_params.nvbuf_tag = NvBufferTag_VIDEO_CONVERT;
+
+    this->dma_buffer = -1;
+    if(NvBufferCreateEx(&this->dma_buffer,&create_params)){
+        throw std::runtime_error("failed to create conversion buffer");
+    }
+}
+
+BgraConverter::~BgraConverter(){
+    if(this->dma_buffer != -1){
+        NvBufferDestroy(this->dma_buffer);
+    }
+}
+
+void BgraConverter::transform(int in_dma_buffer){
+    if(NvBufferTransform(in_dma_buffer,this->dma_buffer,&this->transform_params)){
+        throw std::runtime_error("failed to transform buffer");
+    }
+}
+
+ImageBuffer BgraConverter::read(std::shared_ptr<uint8_t[]> out){
+    NvBufferParams params;
+    if(NvBufferGetParams(this->dma_buffer,&params)){
+        throw std::runtime_error("failed to retrieve buffer params");
+    }
+    if(params.num_planes != 1 || params.height[0] != this->height || params.width[0] != this->width){
+        throw std::runtime_error("got invalid buffer_params");
+    }
+
+    void * data_ptr;
+    if(NvBufferMemMap(this->dma_buffer,0,NvBufferMem_Read_Write,&data_ptr)){
+        throw std::runtime_error("failed to map image buffer");
+    }
+    std::shared_ptr<uint8_t[]> out_buffer = out ? std::move(out) : std::shared_ptr<uint8_t[]>(new uint8_t[this->width * this->height * 4]);
+    NvBufferMemSyncForCpu(this->dma_buffer,0,&data_ptr);
+    for(uint32_t i = 0;i < this->height;++i){
+        uint8_t * src_ptr = (uint8_t *)data_ptr + i * params.pitch[0];
+        uint8_t * dst_ptr = out_buffer.get() + i * this->width * 4;
+        std::memcpy(dst_ptr, src_ptr, this->width * sizeof(uint32_t));
+    }
+    NvBufferMemUnMap(this->dma_buffer,0,&data_ptr);
+
+    return ImageBuffer{
+        out_buffer,
+        this->width,
+        this->height,
+        4,
+    };
+}
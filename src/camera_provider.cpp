@@ -0,0 +1,103 @@
+#include "camera_provider.hpp"
+#include "shared.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+
+bool verbose(){
+    static bool verbose = std::getenv("JEPTURE_VERBOSE") != nullptr;
+    return verbose;
+}
+
+CameraProviderHandle::CameraProviderHandle(){
+    this->provider.reset(CameraProvider::create());
+    this->i_provider = interface_cast<ICameraProvider>(this->provider);
+    if(!this->i_provider){
+        throw std::runtime_error("failed to create camera provider");
+    }
+    if(verbose()){
+        std::printf("Argus Version: %s\n", this->i_provider->getVersion().c_str());
+    }
+    this->i_provider->getCameraDevices(&this->devices);
+    this->modes.resize(this->devices.size());
+    this->mode_info.emplace(*this,this->devices.size());
+}
+
+const std::vector<SensorMode *> & CameraProviderHandle::sensor_modes(size_t device){
+    std::lock_guard<std::mutex> guard(this->mutex);
+    auto & modes = this->modes.at(device);
+    if(!modes){
+        auto i_camera_prop = interface_cast<ICameraProperties>(this->devices[device]);
+        if(!i_camera_prop){
+            throw std::runtime_error("Failed to get ICameraProperties interface");
+        }
+        modes.emplace();
+        i_camera_prop->getBasicSensorModes(&*modes);
+    }
+    return *modes;
+}
+
+const std::vector<SensorModeInfo> & CameraProviderHandle::sensor_mode_info(size_t device){
+    return this->mode_info->sensor_mode_info(device);
+}
+
+size_t CameraProviderHandle::sensor_mode_count(size_t device){
+    return this->sensor_modes(device).size();
+}
+
+std::vector<SensorModeInfo> CameraProviderHandle::query_sensor_modes(size_t device){
+    std::vector<SensorModeInfo> info;
+    for(auto mode: this->sensor_modes(device)){
+        auto i_sensor_mode = interface_cast<ISensorMode>(mode);
+        if(!i_sensor_mode){
+            throw std::runtime_error("Failed to get ISensorMode interface");
+        }
+        auto resolution = i_sensor_mode->getResolution();
+        auto duration = i_sensor_mode->getFrameDurationRange();
+        auto exposure = i_sensor_mode->getExposureTimeRange();
+        auto gain = i_sensor_mode->getAnalogGainRange();
+        info.push_back({
+                resolution.width(),resolution.height(),
+                duration.min(),duration.max(),
+                exposure.min(),exposure.max(),
+                gain.min(),gain.max(),
+                i_sensor_mode->getInputBitDepth(),
+                });
+    }
+    if(verbose()){
+        for(uint32_t i = 0;i < info.size();i++){
+            auto & mode = info[i];
+            std::cout << "sensor mode[" << i << "] fps: " << 1e9 / (double)mode.min_frame_duration
+                << " resolution: " << mode.width << "x" << mode.height << std::endl;
+        }
+    }
+    return info;
+}
+
+std::string CameraProviderHandle::identity(size_t device){
+    auto i_camera_prop = interface_cast<ICameraProperties>(this->devices.at(device));
+    if(!i_camera_prop){
+        throw std::runtime_error("Failed to get ICameraProperties interface");
+    }
+    auto uuid = i_camera_prop->getUUID();
+    char res[40];
+    std::snprintf(res,sizeof(res),"%08x-%04x-%04x-%04x-%02x%02x%02x%02x%02x%02x",
+            uuid.time_low,uuid.time_mid,uuid.time_hi_and_version,uuid.clock_seq,
+            uuid.node[0],uuid.node[1],uuid.node[2],uuid.node[3],uuid.node[4],uuid.node[5]);
+    return res;
+}
+
+// Never freed, so the provider is not destroyed while the argus library is unloaded at exit.
+static SharedInstance<CameraProviderHandle> & shared_provider = *new SharedInstance<CameraProviderHandle>([]{
+        return std::make_shared<CameraProviderHandle>();
+    });
+
+std::shared_ptr<CameraProviderHandle> shared_camera_provider(){
+    return shared_provider.acquire();
+}
+
+void release_camera_provider(){
+    shared_provider.release();
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <Argus/Argus.h>
+#include "mode_cache.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+using namespace Argus;
+
+// Whether the JEPTURE_VERBOSE environment variable is set, enables printing the camera
+// provider version, the sensor modes and the capture settings.
+bool verbose();
+
+/*
+ * The argus camera provider with its camera devices and sensor modes.
+ *
+ * Creating a provider and enumerating its devices takes seconds, so one provider is
+ * shared by all streams of a process, see `shared_camera_provider`. The devices are
+ * enumerated once and the sensor modes of a device when they are first requested.
+ */
+class CameraProviderHandle: public SensorModeSource{
+    UniqueObj<CameraProvider> provider;
+    ICameraProvider * i_provider;
+    std::vector<CameraDevice *> devices;
+
+    std::mutex mutex;
+    std::vector<std::optional<std::vector<SensorMode *>>> modes;
+    std::optional<SensorModeCache> mode_info;
+
+public:
+    CameraProviderHandle();
+
+    ICameraProvider * get(){
+        return this->i_provider;
+    }
+
+    const std::vector<CameraDevice *> & camera_devices(){
+        return this->devices;
+    }
+
+    const std::vector<SensorMode *> & sensor_modes(size_t device);
+    const std::vector<SensorModeInfo> & sensor_mode_info(size_t device);
+
+    // Identifies a camera device across processes, from its UUID.
+    std::string identity(size_t device) override;
+    size_t sensor_mode_count(size_t device) override;
+    std::vector<SensorModeInfo> query_sensor_modes(size_t device) override;
+};
+
+// Returns the provider shared by the streams of this process, creating it if needed.
+std::shared_ptr<CameraProviderHandle> shared_camera_provider();
+
+// Stops keeping the shared provider alive between streams, it is destroyed once the
+// last stream using it is closed.
+void release_camera_provider();
@@ -0,0 +1,103 @@
+#include "capture_metadata.hpp"
+
+#include <vector>
+
+using namespace Argus;
+using namespace EGLStream;
+
+static uint32_t ae_state_code(const AeState & state){
+    if(state == AE_STATE_SEARCHING){
+        return 1;
+    }else if(state == AE_STATE_CONVERGED){
+        return 2;
+    }else if(state == AE_STATE_FLASH_REQUIRED){
+        return 3;
+    }else if(state == AE_STATE_TIMEOUT){
+        return 4;
+    }
+    return 0;
+}
+
+static uint32_t awb_state_code(const AwbState & state){
+    if(state == AWB_STATE_SEARCHING){
+        return 1;
+    }else if(state == AWB_STATE_CONVERGED){
+        return 2;
+    }else if(state == AWB_STATE_LOCKED){
+        return 3;
+    }
+    return 0;
+}
+
+static void histogram_stats(const IBayerHistogram * i_histogram, FrameMetadata & out){
+    std::vector<BayerTuple<uint32_t>> bins;
+    if(i_histogram->getHistogram(&bins) != STATUS_OK || bins.size() < 2){
+        return;
+    }
+    double total = 0.0;
+    double weighted = 0.0;
+    for(size_t i = 0;i < bins.size();i++){
+        double count = (double)bins[i].gEven() + (double)bins[i].gOdd();
+        total += count;
+        weighted += count * i;
+    }
+    if(total == 0.0){
+        return;
+    }
+    out.brightness = weighted / total / (double)(bins.size() - 1);
+    out.dark_fraction = ((double)bins.front().gEven() + bins.front().gOdd()) / total;
+    out.clipped_fraction = ((double)bins.back().gEven() + bins.back().gOdd()) / total;
+}
+
+static void sharpness_stats(const IBayerSharpnessMap * i_sharpness, FrameMetadata & out){
+    Array2D<BayerTuple<float>> values;
+    if(i_sharpness->getSharpnessValues(&values) != STATUS_OK){
+        return;
+    }
+    auto size = values.size();
+    if(size.area() == 0){
+        return;
+    }
+    double sum = 0.0;
+    for(uint32_t y = 0;y < size.height();y++){
+        for(uint32_t x = 0;x < size.width();x++){
+            sum += values(x,y).gEven() + values(x,y).gOdd();
+        }
+    }
+    out.isp_sharpness = sum / (2.0 * size.area());
+}
+
+void enable_capture_statistics(Request * request){
+    auto i_sharpness_settings = interface_cast<IBayerSharpnessMapSettings>(request);
+    if(i_sharpness_settings){
+        i_sharpness_settings->setBayerSharpnessMapEnable(true);
+    }
+}
+
+bool read_capture_metadata(Frame * frame, FrameMetadata & out){
+    auto i_metadata = interface_cast<IArgusCaptureMetadata>(frame);
+    if(!i_metadata){
+        return false;
+    }
+    auto i_capture_metadata = interface_cast<const ICaptureMetadata>(i_metadata->getMetadata());
+    if(!i_capture_metadata){
+        return false;
+    }
+    out.exposure_time = i_capture_metadata->getSensorExposureTime();
+    out.frame_duration = i_capture_metadata->getFrameDuration();
+    out.analog_gain = i_capture_metadata->getSensorAnalogGain();
+    out.isp_gain = i_capture_metadata->getIspDigitalGain();
+    out.scene_lux = i_capture_metadata->getSceneLux();
+    out.ae_state = ae_state_code(i_capture_metadata->getAeState());
+    out.awb_state = awb_state_code(i_capture_metadata->getAwbState());
+
+    auto i_histogram = interface_cast<const IBayerHistogram>(i_capture_metadata->getBayerHistogram());
+    if(i_histogram){
+        histogram_stats(i_histogram,out);
+    }
+    auto i_sharpness = interface_cast<const IBayerSharpnessMap>(i_capture_metadata->getBayerSharpnessMap());
+    if(i_sharpness){
+        sharpness_stats(i_sharpness,out);
+    }
+    return true;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <Argus/Argus.h>
+#include <EGLStream/EGLStream.h>
+
+#include <cstdint>
+
+// Capture metadata of a frame reported by the ISP, plain data so it can be returned
+// as a numpy record.
+struct FrameMetadata{
+    uint32_t camera;
+    uint64_t number;
+    // Exposure time and frame duration in nanoseconds.
+    uint64_t exposure_time;
+    uint64_t frame_duration;
+    float analog_gain;
+    float isp_gain;
+    float scene_lux;
+    // 0 inactive, 1 searching, 2 converged, 3 flash required, 4 timeout.
+    uint32_t ae_state;
+    // 0 inactive, 1 searching, 2 converged, 3 locked.
+    uint32_t awb_state;
+    // Mean of the green channels of the bayer histogram scaled to 0..1, and the
+    // fractions of pixels in the lowest and the highest bin.
+    float brightness;
+    float dark_fraction;
+    float clipped_fraction;
+    // Mean of the green channels of the bayer sharpness map, 0 if it is not reported.
+    float isp_sharpness;
+};
+
+// Enables the statistics read by `read_capture_metadata` which are off by default.
+void enable_capture_statistics(Argus::Request * request);
+
+// Reads the capture metadata of `frame`, returns false if the frame has none.
+bool read_capture_metadata(EGLStream::Frame * frame, FrameMetadata & out);
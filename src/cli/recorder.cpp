@@ -0,0 +1,276 @@
+#include "../jepture.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+static const char * usage =
+    "usage: jepture-recorder [options]\n"
+    "\n"
+    "Records jpegs from one or more cameras until interrupted.\n"
+    "\n"
+    "options:\n"
+    "  -c, --camera ID:NAME        camera to record, can be given more than once\n"
+    "  -r, --resolution WxH        capture resolution (default 1920x1080)\n"
+    "  -f, --fps FPS               target frame rate (default 30)\n"
+    "  -m, --mode MODE             sensor mode, selected from the fps if not given\n"
+    "  -s, --setting KEY=VALUE     capture setting, can be given more than once\n"
+    "  -o, --output DIR            directory to write the jpegs to (default ./data)\n"
+    "      --staging KEY=VALUE     stage jpegs in memory, see the staging option of JpegStream\n"
+    "      --motion KEY=VALUE      only record frames with motion, see the motion option of JpegStream\n"
+    "      --sharpness KEY=VALUE   score and filter sharpness, see the sharpness option of JpegStream\n"
+    "  -n, --frames N              stop after N frames per camera\n"
+    "      --stats SECONDS         interval between statistics lines, 0 disables them (default 1)\n"
+    "      --config FILE           read options from a file, one `option = value` per line\n"
+    "  -h, --help                  show this message\n";
+
+static std::atomic<bool> stopping(false);
+
+static void handle_stop(int){
+    stopping = true;
+}
+
+struct RecorderOptions{
+    std::vector<std::tuple<uint32_t,std::string>> cameras;
+    std::pair<uint32_t,uint32_t> resolution = {1920,1080};
+    float fps = 30.0;
+    std::optional<uint32_t> mode;
+    std::optional<std::unordered_map<std::string,double>> settings;
+    std::string output = "./data";
+    std::optional<std::unordered_map<std::string,double>> staging;
+    std::optional<std::unordered_map<std::string,double>> motion;
+    std::optional<std::unordered_map<std::string,double>> sharpness;
+    uint64_t frames = 0;
+    double stats = 1.0;
+};
+
+static double parse_number(const std::string & option, const std::string & value){
+    try{
+        size_t end;
+        double res = std::stod(value,&end);
+        if(end == value.size()){
+            return res;
+        }
+    }catch(const std::exception &){
+    }
+    throw std::runtime_error("invalid number `" + value + "` for option `" + option + "`");
+}
+
+// Parses `KEY=VALUE` into a dictionary option.
+static void parse_entry(const std::string & option, const std::string & value, std::optional<std::unordered_map<std::string,double>> & out){
+    auto split = value.find('=');
+    if(split == std::string::npos){
+        throw std::runtime_error("expected KEY=VALUE for option `" + option + "`, got `" + value + "`");
+    }
+    if(!out){
+        out.emplace();
+    }
+    (*out)[value.substr(0,split)] = parse_number(option,value.substr(split + 1));
+}
+
+static void parse_config_file(const std::string & path, RecorderOptions & options);
+
+static void apply_option(std::string option, const std::string & value, RecorderOptions & options){
+    if(option == "c") option = "camera";
+    if(option == "r") option = "resolution";
+    if(option == "f") option = "fps";
+    if(option == "m") option = "mode";
+    if(option == "s") option = "setting";
+    if(option == "o") option = "output";
+    if(option == "n") option = "frames";
+
+    if(option == "camera"){
+        auto split = value.find(':');
+        auto id = parse_number(option,value.substr(0,split));
+        std::string name = split == std::string::npos ? "camera" + value : value.substr(split + 1);
+        options.cameras.emplace_back((uint32_t)id,name);
+    }else if(option == "resolution"){
+        auto split = value.find('x');
+        if(split == std::string::npos){
+            throw std::runtime_error("expected WxH for option `resolution`, got `" + value + "`");
+        }
+        options.resolution = {
+            (uint32_t)parse_number(option,value.substr(0,split)),
+            (uint32_t)parse_number(option,value.substr(split + 1)),
+        };
+    }else if(option == "fps"){
+        options.fps = parse_number(option,value);
+    }else if(option == "mode"){
+        options.mode = (uint32_t)parse_number(option,value);
+    }else if(option == "setting"){
+        parse_entry(option,value,options.settings);
+    }else if(option == "output"){
+        options.output = value;
+    }else if(option == "staging"){
+        parse_entry(option,value,options.staging);
+    }else if(option == "motion"){
+        parse_entry(option,value,options.motion);
+    }else if(option == "sharpness"){
+        parse_entry(option,value,options.sharpness);
+    }else if(option == "frames"){
+        options.frames = parse_number(option,value);
+    }else if(option == "stats"){
+        options.stats = parse_number(option,value);
+    }else if(option == "config"){
+        parse_config_file(value,options);
+    }else{
+        throw std::runtime_error("unknown option `" + option + "`");
+    }
+}
+
+static std::string trim(const std::string & value){
+    auto begin = value.find_first_not_of(" \t\r");
+    if(begin == std::string::npos){
+        return "";
+    }
+    auto end = value.find_last_not_of(" \t\r");
+    return value.substr(begin,end - begin + 1);
+}
+
+static void parse_config_file(const std::string & path, RecorderOptions & options){
+    std::ifstream file(path);
+    if(!file){
+        throw std::runtime_error("could not open config file `" + path + "`");
+    }
+    std::string line;
+    while(std::getline(file,line)){
+        line = trim(line.substr(0,line.find('#')));
+        if(line.empty()){
+            continue;
+        }
+        auto split = line.find('=');
+        if(split == std::string::npos){
+            throw std::runtime_error("expected `option = value` in config file, got `" + line + "`");
+        }
+        apply_option(trim(line.substr(0,split)),trim(line.substr(split + 1)),options);
+    }
+}
+
+static RecorderOptions parse_arguments(int argc, char ** argv){
+    RecorderOptions options;
+    for(int i = 1;i < argc;i++){
+        std::string arg(argv[i]);
+        if(arg == "-h" || arg == "--help"){
+            std::cout << usage;
+            std::exit(0);
+        }
+        std::string option;
+        std::optional<std::string> value;
+        if(arg.rfind("--",0) == 0){
+            option = arg.substr(2);
+            auto split = option.find('=');
+            if(split != std::string::npos){
+                value = option.substr(split + 1);
+                option = option.substr(0,split);
+            }
+        }else if(arg.size() == 2 && arg[0] == '-'){
+            option = arg.substr(1);
+        }else{
+            throw std::runtime_error("unexpected argument `" + arg + "`");
+        }
+        if(!value){
+            if(i + 1 >= argc){
+                throw std::runtime_error("missing value for option `" + option + "`");
+            }
+            value = argv[++i];
+        }
+        apply_option(option,*value,options);
+    }
+    if(options.cameras.empty()){
+        options.cameras.emplace_back(0,"camera0");
+    }
+    return options;
+}
+
+// Counters of one statistics interval.
+struct Interval{
+    uint64_t frames = 0;
+    uint64_t written = 0;
+    uint64_t drops = 0;
+    // Time from capture until the frame was returned, in seconds.
+    std::vector<double> ages;
+};
+
+static void print_stats(const Interval & interval, double seconds, size_t cameras, JpegStream & stream){
+    auto ages = interval.ages;
+    std::sort(ages.begin(),ages.end());
+    double p50 = ages.empty() ? 0.0 : ages[ages.size() / 2];
+    double max = ages.empty() ? 0.0 : ages.back();
+    auto staging = stream.staging_stats();
+    std::fprintf(stderr,"%7.2f fps/camera  %6.2f written/s  drops %-5lu  age p50 %6.2f ms max %6.2f ms  staged %6.1f MB  dropped %lu files\n",
+            (double)interval.frames / cameras / seconds,
+            (double)interval.written / seconds,
+            (unsigned long)interval.drops,
+            p50 * 1e3,max * 1e3,
+            (double)staging.staged_bytes / (1024.0 * 1024.0),
+            (unsigned long)staging.dropped_files);
+}
+
+int main(int argc, char ** argv){
+    RecorderOptions options;
+    try{
+        options = parse_arguments(argc,argv);
+    }catch(const std::exception & e){
+        std::cerr << "error: " << e.what() << "\n\n" << usage;
+        return 2;
+    }
+
+    std::signal(SIGINT,handle_stop);
+    std::signal(SIGTERM,handle_stop);
+
+    try{
+        JpegStream stream(options.cameras,options.resolution,options.fps,options.mode,options.settings,
+                options.output,options.staging,std::nullopt,options.motion,options.sharpness,std::nullopt,std::nullopt,false,false);
+
+        using clock = std::chrono::steady_clock;
+        std::vector<uint64_t> last_numbers;
+        Interval interval;
+        Interval total;
+        auto interval_start = clock::now();
+        auto start = interval_start;
+        uint64_t groups = 0;
+        while(!stopping && (options.frames == 0 || groups < options.frames)){
+            auto frames = stream.next(false);
+            // Capture the next frame group while this one is counted.
+            stream.prefetch();
+            groups++;
+
+            if(last_numbers.empty()){
+                for(auto & frame: frames){
+                    last_numbers.push_back(frame.number - 1);
+                }
+            }
+            for(uint32_t i = 0;i < frames.size();i++){
+                uint64_t drops = frames[i].number > last_numbers[i] + 1 ? frames[i].number - last_numbers[i] - 1 : 0;
+                last_numbers[i] = frames[i].number;
+                for(auto counters: {&interval,&total}){
+                    counters->frames += 1;
+                    counters->written += frames[i].written;
+                    counters->drops += drops;
+                }
+                interval.ages.push_back(frames[i].age_ns * 1e-9);
+            }
+
+            auto now = clock::now();
+            double elapsed = std::chrono::duration<double>(now - interval_start).count();
+            if(options.stats > 0.0 && elapsed >= options.stats){
+                print_stats(interval,elapsed,frames.size(),stream);
+                interval = Interval{};
+                interval_start = now;
+            }
+        }
+        stream.close();
+        double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+        std::fprintf(stderr,"recorded %lu frames (%lu written, %lu dropped) in %.1f s\n",
+                (unsigned long)total.frames,(unsigned long)total.written,(unsigned long)total.drops,elapsed);
+    }catch(const std::exception & e){
+        std::cerr << "error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,18 @@
+#include "config.hpp"
+
+#include <sstream>
+#include <stdexcept>
+
+double config_value(const std::unordered_map<std::string,double> & config, const char * kind, const char * name, double def, double min, double max){
+    auto value = config.find(name);
+    if(value == config.end()){
+        return def;
+    }
+    if(value->second < min || value->second > max){
+        auto stream = std::stringstream();
+        stream << "Invalid " << kind << " value `" << name << "` value was: `" << value->second
+            << "` valid range was allowed is `" << min << ".." << max << "`.";
+        throw std::runtime_error(stream.str());
+    }
+    return value->second;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+
+// Looks up an optional value of a dictionary of options, throws if the value is
+// outside of the valid range. `kind` names the option dictionary in the error.
+double config_value(const std::unordered_map<std::string,double> & config, const char * kind, const char * name, double def, double min, double max);
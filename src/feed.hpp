@@ -0,0 +1,192 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/*
+ * Runs a producer continuously on a capture thread and queues up to `depth`
+ * results for the consumer.
+ *
+ * Every queued result increments an eventfd so the consumer can wait for results
+ * in an event loop instead of blocking a thread. The producer waits when the
+ * queue is full. An exception thrown by the producer stops the feed and is
+ * rethrown to the consumer once the queue is empty.
+ */
+template<class T>
+class FrameFeed{
+    std::function<T()> produce;
+    size_t depth;
+    int fd;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<T> queue;
+    std::exception_ptr error;
+    bool stopping;
+    bool pausing;
+    std::thread thread;
+
+    void signal(){
+        uint64_t one = 1;
+        if(::write(this->fd,&one,sizeof(one)) < 0){
+            // The counter can only overflow after 2^64 - 1 unread results.
+        }
+    }
+
+    void run(){
+        std::unique_lock<std::mutex> lock(this->mutex);
+        while(true){
+            this->cond.wait(lock,[this]{ return this->stopping || this->pausing || this->queue.size() < this->depth; });
+            if(this->stopping || this->pausing){
+                return;
+            }
+            lock.unlock();
+            std::optional<T> result;
+            std::exception_ptr error;
+            try{
+                result = this->produce();
+            }catch(...){
+                error = std::current_exception();
+            }
+            lock.lock();
+            if(this->stopping){
+                return;
+            }
+            if(error){
+                this->error = error;
+                this->signal();
+                this->cond.notify_all();
+                return;
+            }
+            this->queue.push_back(std::move(*result));
+            this->signal();
+            this->cond.notify_all();
+        }
+    }
+
+public:
+    FrameFeed(std::function<T()> produce, size_t depth = 4)
+        : produce(std::move(produce)), depth(depth), fd(-1), stopping(false), pausing(false)
+    {
+    }
+
+    ~FrameFeed(){
+        this->stop();
+        if(this->fd != -1){
+            ::close(this->fd);
+        }
+    }
+
+    bool running(){
+        std::lock_guard<std::mutex> guard(this->mutex);
+        return this->thread.joinable() && !this->stopping;
+    }
+
+    // Number of queued results.
+    size_t size(){
+        std::lock_guard<std::mutex> guard(this->mutex);
+        return this->queue.size();
+    }
+
+    // Starts the capture thread if it is not yet running and returns the eventfd
+    // which becomes readable when results are queued.
+    int start(){
+        std::lock_guard<std::mutex> guard(this->mutex);
+        if(this->stopping){
+            throw std::runtime_error("stream is closed");
+        }
+        if(this->fd == -1){
+            this->fd = eventfd(0,EFD_NONBLOCK | EFD_CLOEXEC);
+            if(this->fd < 0){
+                this->fd = -1;
+                throw std::runtime_error("failed to create eventfd");
+            }
+        }
+        if(!this->thread.joinable()){
+            this->thread = std::thread(&FrameFeed::run,this);
+        }
+        return this->fd;
+    }
+
+    // Takes a queued result without blocking, returns false if there is none.
+    bool try_pop(T & out){
+        std::lock_guard<std::mutex> guard(this->mutex);
+        uint64_t count;
+        if(::read(this->fd,&count,sizeof(count)) < 0){
+            // Nothing to clear, the counter was already zero.
+        }
+        if(this->queue.empty()){
+            if(this->error){
+                std::rethrow_exception(this->error);
+            }
+            if(this->stopping){
+                throw std::runtime_error("stream is closed");
+            }
+            return false;
+        }
+        out = std::move(this->queue.front());
+        this->queue.pop_front();
+        this->cond.notify_all();
+        return true;
+    }
+
+    // Waits for the next result.
+    T pop(){
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->cond.wait(lock,[this]{ return !this->queue.empty() || this->error || this->stopping; });
+        if(this->queue.empty()){
+            if(this->error){
+                std::rethrow_exception(this->error);
+            }
+            throw std::runtime_error("stream is closed");
+        }
+        T res = std::move(this->queue.front());
+        this->queue.pop_front();
+        this->cond.notify_all();
+        return res;
+    }
+
+    // Stops the capture thread until the next start, waiting for a running capture to finish.
+    // Queued results are kept and waiting consumers keep waiting. Returns whether the
+    // capture thread was running.
+    bool pause(){
+        {
+            std::lock_guard<std::mutex> guard(this->mutex);
+            if(!this->thread.joinable() || this->stopping){
+                return false;
+            }
+            this->pausing = true;
+        }
+        this->cond.notify_all();
+        this->thread.join();
+        std::lock_guard<std::mutex> guard(this->mutex);
+        this->pausing = false;
+        return true;
+    }
+
+    // Stops the capture thread, waiting for a running capture to finish. The
+    // eventfd is signaled so a waiting consumer notices the feed has stopped.
+    void stop(){
+        {
+            std::lock_guard<std::mutex> guard(this->mutex);
+            this->stopping = true;
+            this->queue.clear();
+            if(this->fd != -1){
+                this->signal();
+            }
+        }
+        this->cond.notify_all();
+        if(this->thread.joinable()){
+            this->thread.join();
+        }
+    }
+};
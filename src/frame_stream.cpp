@@ -0,0 +1,322 @@
+#include "jepture.hpp"
+
+#include <algorithm>
+#include <limits>
+
+FrameData frame_data(const JpegStreamOutput & output, uint32_t camera){
+    return FrameData{camera,output.number,output.time_stamp,output.sharpness,nullptr,0,0,0,output.age_ns};
+}
+
+FrameData frame_data(const JpegBytesStreamOutput & output, uint32_t camera){
+    return FrameData{
+        camera,output.number,output.time_stamp,output.sharpness,
+        output.bytes.empty() ? nullptr : (const uint8_t *)output.bytes.data(),output.bytes.size(),0,0,
+        output.age_ns
+    };
+}
+
+FrameData frame_data(const NumpyStreamOutput & output, uint32_t camera){
+    const auto & image = output.image;
+    return FrameData{
+        camera,output.number,output.time_stamp,output.sharpness,
+        image.data.get(),(size_t)image.width * image.height * image.channels,image.width,image.height,
+        output.age_ns
+    };
+}
+
+template<class Output>
+FrameStream<Output>::FrameStream(
+        std::vector<std::tuple<uint32_t,std::string> > cameras,
+        std::pair<uint32_t,uint32_t> resolution,
+        float fps,
+        std::optional<uint32_t> mode,
+        std::optional<std::unordered_map<std::string,double>> settings,
+        std::optional<std::unordered_map<std::string,std::unordered_map<std::string,double>>> camera_config)
+    : ArgusStream(cameras,resolution,fps,mode,settings,camera_config),
+    prefetcher([this]{ return this->capture(false); }),
+    feed([this]{ return this->capture(false); }),
+    dispatching(false)
+{
+}
+
+template<class Output>
+void FrameStream<Output>::start(bool warmup){
+    std::lock_guard<std::mutex> guard(this->next_mutex);
+    if(this->closed){
+        throw std::runtime_error("stream is closed");
+    }
+    this->start_capture();
+    if(warmup){
+        this->warming_up = true;
+        try{
+            this->warm_up();
+        }catch(...){
+            this->warming_up = false;
+            throw;
+        }
+        this->warming_up = false;
+        // The latencies of the warm up are not representative.
+        this->stage_latency.reset();
+    }
+}
+
+template<class Output>
+void FrameStream<Output>::warm_up(){
+    this->warm_up_previews(ArgusStream::next(false));
+}
+
+template<class Output>
+void FrameStream<Output>::resized(){
+}
+
+template<class Output>
+bool FrameStream<Output>::capture_writes(){
+    return false;
+}
+
+template<class Output>
+void FrameStream<Output>::reconfigure(std::optional<std::pair<uint32_t,uint32_t>> resolution,
+        std::optional<float> fps,
+        std::optional<uint32_t> mode){
+    std::lock_guard<std::mutex> guard(this->next_mutex);
+    if(this->closed){
+        throw std::runtime_error("stream is closed");
+    }
+    // Queued frames stay queued, consumers of the feed wait until it resumes.
+    bool feeding = this->feed.pause();
+    this->prefetcher.discard();
+    try{
+        if(this->reconfigure_capture(resolution,fps,mode)){
+            this->resized();
+        }
+    }catch(...){
+        if(feeding){
+            this->feed.start();
+        }
+        throw;
+    }
+    if(feeding){
+        this->feed.start();
+    }
+}
+
+template<class Output>
+uint32_t FrameStream<Output>::update_settings(std::unordered_map<std::string,double> settings){
+    std::lock_guard<std::mutex> guard(this->next_mutex);
+    return ArgusStream::update_settings(settings);
+}
+
+template<class Output>
+std::vector<Output> FrameStream<Output>::next(bool skip){
+    return this->next_group(skip,[this,skip]{ return this->capture(skip); });
+}
+
+template<class Output>
+std::vector<Output> FrameStream<Output>::next_group(bool skip, const std::function<std::vector<Output>()> & capture_group){
+    std::unique_lock<std::mutex> lock(this->next_mutex);
+    std::vector<Output> res;
+    if(this->feed.running()){
+        // The lock is not held while waiting so close can stop the feed.
+        lock.unlock();
+        res = this->feed.pop();
+    }else if(this->prefetcher.pending() && (!skip || this->capture_writes())){
+        // Skipping can not undo the writes of a prefetched group, it is delivered as processed.
+        res = this->prefetcher.take();
+        skip = false;
+    }else{
+        if(this->prefetcher.pending()){
+            // The prefetched group is processed, a skipped group is captured without processing.
+            this->prefetcher.discard();
+        }
+        res = capture_group();
+    }
+    if(!skip){
+        this->delivered(res);
+    }
+    return res;
+}
+
+template<class Output>
+void FrameStream<Output>::next_metadata(size_t n, std::vector<FrameMetadata> & out){
+    if(!this->metadata_enabled){
+        throw std::runtime_error("capture metadata is not enabled");
+    }
+    std::lock_guard<std::mutex> guard(this->next_mutex);
+    if(this->feed.running()){
+        throw std::runtime_error("next_metadata can not be used while frames are captured continuously");
+    }
+    // A prefetched frame group was processed, the frames are captured without processing instead.
+    this->prefetcher.discard();
+    for(size_t i = 0;i < n;i++){
+        for(auto & frame: this->capture(true)){
+            // A repeated frame of a slower capture group was already reported.
+            if(frame.fresh){
+                out.push_back(frame.metadata);
+            }
+        }
+    }
+}
+
+template<class Output>
+std::vector<std::vector<Output>> FrameStream<Output>::next_many(size_t n, std::vector<FrameRecord> & records){
+    std::vector<std::vector<Output>> groups;
+    groups.reserve(n);
+    uint64_t offset = 0;
+    for(size_t i = 0;i < n;i++){
+        groups.push_back(this->next(false));
+        this->record_group(groups.back(),offset,records);
+    }
+    return groups;
+}
+
+template<class Output>
+void FrameStream<Output>::record_group(const std::vector<Output> & group, uint64_t & offset, std::vector<FrameRecord> & records){
+    if(this->last_numbers.size() != group.size()){
+        this->last_numbers.assign(group.size(),std::numeric_limits<uint64_t>::max());
+    }
+    for(uint32_t camera = 0;camera < group.size();camera++){
+        auto data = frame_data(group[camera],camera);
+        uint64_t & last = this->last_numbers[camera];
+        bool known = last != std::numeric_limits<uint64_t>::max();
+        uint64_t drops = known && data.number > last + 1 ? data.number - last - 1 : 0;
+        last = data.number;
+        records.push_back({camera,data.number,data.time_stamp,drops,offset,data.size,data.age_ns});
+        offset += data.size;
+    }
+}
+
+template<class Output>
+void FrameStream<Output>::prefetch(){
+    std::lock_guard<std::mutex> guard(this->next_mutex);
+    if(!this->closed && !this->feed.running()){
+        this->prefetcher.request();
+    }
+}
+
+template<class Output>
+int FrameStream<Output>::start_feed(){
+    std::lock_guard<std::mutex> guard(this->next_mutex);
+    if(this->closed){
+        throw std::runtime_error("stream is closed");
+    }
+    if(!this->feed.running()){
+        // From now on only the feed captures frames.
+        this->prefetcher.stop();
+    }
+    return this->feed.start();
+}
+
+template<class Output>
+bool FrameStream<Output>::poll(std::vector<Output> & out){
+    if(!this->feed.try_pop(out)){
+        return false;
+    }
+    this->delivered(out);
+    return true;
+}
+
+template<class Output>
+void FrameStream<Output>::on_frame(std::function<bool(std::vector<std::vector<Output>> &)> callback, size_t batch){
+    std::lock_guard<std::mutex> guard(this->next_mutex);
+    if(this->closed){
+        throw std::runtime_error("stream is closed");
+    }
+    if(this->dispatching){
+        throw std::runtime_error("a frame callback is already registered");
+    }
+    if(this->dispatcher.joinable()){
+        this->dispatcher.join();
+    }
+    if(!this->feed.running()){
+        this->prefetcher.stop();
+    }
+    this->feed.start();
+    batch = std::max(batch,(size_t)1);
+    this->dispatching = true;
+    this->dispatcher = std::thread([this,callback,batch]{
+        std::vector<std::vector<Output>> frames;
+        frames.reserve(batch);
+        while(true){
+            try{
+                frames.push_back(this->feed.pop());
+                this->delivered(frames.back());
+            }catch(...){
+                // The stream was closed or capturing failed, `next` reports the error.
+                break;
+            }
+            if(frames.size() < batch){
+                continue;
+            }
+            if(!callback(frames)){
+                frames.clear();
+                break;
+            }
+            frames.clear();
+        }
+        if(!frames.empty()){
+            callback(frames);
+        }
+        this->dispatching = false;
+    });
+}
+
+template<class Output>
+void FrameStream<Output>::delivered(std::vector<Output> & frames){
+    uint64_t now = monotonic_ns();
+    int64_t realtime_offset = (int64_t)(realtime_ns() - now);
+    for(uint32_t i = 0;i < frames.size() && i < this->clocks.size();i++){
+        auto & frame = frames[i];
+        frame.capture_monotonic_ns = this->clocks[i]->to_monotonic(frame.time_stamp);
+        frame.capture_realtime_ns = frame.capture_monotonic_ns + realtime_offset;
+        frame.delivery_ns = now;
+        frame.age_ns = now > frame.capture_monotonic_ns ? now - frame.capture_monotonic_ns : 0;
+        // A repeated frame was counted when it was first returned.
+        if(frame.fresh){
+            this->counters.camera(i).returned.fetch_add(1,std::memory_order_relaxed);
+            this->stage_latency[Stage::EndToEnd].record(frame.age_ns);
+        }
+    }
+}
+
+template<class Output>
+void FrameStream<Output>::stop_dispatcher(){
+    if(this->dispatcher.get_id() == std::this_thread::get_id()){
+        throw std::logic_error("a stream can not be closed from its frame callback");
+    }
+    // Stopping the feed ends the dispatch loop after the pending callback.
+    this->feed.stop();
+    if(this->dispatcher.joinable()){
+        this->dispatcher.join();
+    }
+}
+
+template<class Output>
+void FrameStream<Output>::metrics(std::vector<Metric> & out, bool gauges){
+    ArgusStream::metrics(out,gauges);
+    if(gauges){
+        out.push_back(gauge_metric("feed_queue_depth","Frame groups captured by the feed and not yet returned.",this->feed.size()));
+    }
+}
+
+template<class Output>
+std::vector<Metric> FrameStream<Output>::metrics_snapshot(){
+    std::vector<Metric> res;
+    collect_metrics(this,res);
+    return res;
+}
+
+template<class Output>
+void FrameStream<Output>::close(){
+    // The exporter must be done with the stream before its resources are released.
+    unregister_metrics(this);
+    this->stop_dispatcher();
+    std::lock_guard<std::mutex> guard(this->next_mutex);
+    // A callback registered while stopping has seen the stopped feed and exits.
+    this->stop_dispatcher();
+    this->prefetcher.stop();
+    ArgusStream::close();
+}
+
+template class FrameStream<JpegStreamOutput>;
+template class FrameStream<JpegBytesStreamOutput>;
+template class FrameStream<NumpyStreamOutput>;
@@ -0,0 +1,88 @@
+#include "histogram.hpp"
+
+#include <algorithm>
+
+LatencyHistogram::LatencyHistogram(): max(0){
+    for(auto & count: this->counts){
+        count.store(0,std::memory_order_relaxed);
+    }
+}
+
+size_t LatencyHistogram::bucket(uint64_t ns){
+    if(ns >> max_bits){
+        return bucket_count - 1;
+    }
+    if(ns < (1u << sub_bucket_bits)){
+        return ns;
+    }
+    // The exponent selects the power of two, the highest bits below the leading one
+    // select the linear bucket within it.
+    unsigned exponent = 64 - __builtin_clzll(ns) - sub_bucket_bits;
+    return ((size_t)exponent << sub_bucket_bits) + ((ns >> (exponent - 1)) - (1u << sub_bucket_bits));
+}
+
+uint64_t LatencyHistogram::bucket_value(size_t index){
+    size_t exponent = index >> sub_bucket_bits;
+    uint64_t sub_bucket = index & ((1u << sub_bucket_bits) - 1);
+    if(exponent == 0){
+        return sub_bucket;
+    }
+    uint64_t width = (uint64_t)1 << (exponent - 1);
+    return (sub_bucket + (1u << sub_bucket_bits)) * width + width / 2;
+}
+
+void LatencyHistogram::record(uint64_t ns){
+    this->counts[bucket(ns)].fetch_add(1,std::memory_order_relaxed);
+    uint64_t current = this->max.load(std::memory_order_relaxed);
+    while(ns > current && !this->max.compare_exchange_weak(current,ns,std::memory_order_relaxed)){
+    }
+}
+
+LatencySummary LatencyHistogram::summary(bool reset){
+    std::array<uint64_t,bucket_count> counts;
+    uint64_t total = 0;
+    for(size_t i = 0;i < bucket_count;i++){
+        counts[i] = reset ? this->counts[i].exchange(0,std::memory_order_relaxed) : this->counts[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+    uint64_t max = reset ? this->max.exchange(0,std::memory_order_relaxed) : this->max.load(std::memory_order_relaxed);
+
+    LatencySummary res{total,0,0,0,0,max};
+    if(total == 0){
+        return res;
+    }
+    std::pair<double,uint64_t *> percentiles[] = {
+        {0.5,&res.p50},
+        {0.9,&res.p90},
+        {0.99,&res.p99},
+        {0.999,&res.p999},
+    };
+    uint64_t seen = 0;
+    size_t next = 0;
+    for(size_t i = 0;i < bucket_count && next < 4;i++){
+        seen += counts[i];
+        while(next < 4 && seen >= percentiles[next].first * total){
+            // The bucket middle can lie above the largest latency of the window.
+            *percentiles[next].second = std::min(bucket_value(i),max);
+            next++;
+        }
+    }
+    return res;
+}
+
+const char * stage_name(Stage stage){
+    switch(stage){
+        case Stage::Acquire: return "acquire";
+        case Stage::CopyToNvBuffer: return "copy_to_nvbuffer";
+        case Stage::Crop: return "crop";
+        case Stage::Sharpness: return "sharpness";
+        case Stage::Motion: return "motion";
+        case Stage::Encode: return "encode";
+        case Stage::Transform: return "transform";
+        case Stage::MapCopy: return "map_copy";
+        case Stage::FileWrite: return "file_write";
+        case Stage::Preview: return "preview";
+        case Stage::EndToEnd: return "end_to_end";
+        default: return "unknown";
+    }
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Percentiles of the latencies recorded in a window, in nanoseconds.
+struct LatencySummary{
+    uint64_t count;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+};
+
+/*
+ * A log bucketed histogram of latencies in nanoseconds with constant memory.
+ *
+ * Every power of two is split into 32 linear buckets, so a percentile is within about
+ * 3% of the recorded latency. Latencies above 2^40 ns (about 18 minutes) are counted
+ * in the last bucket. Recording only uses relaxed atomics and can be done from any thread.
+ */
+class LatencyHistogram{
+public:
+    static constexpr unsigned sub_bucket_bits = 5;
+    static constexpr unsigned max_bits = 40;
+    static constexpr size_t bucket_count = (max_bits - sub_bucket_bits + 1) << sub_bucket_bits;
+
+    LatencyHistogram();
+
+    void record(uint64_t ns);
+
+    // Records the time passed since `start`.
+    void record_since(std::chrono::steady_clock::time_point start){
+        this->record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    // Summarizes the window since the last reset. With `reset` a new window is started,
+    // latencies recorded concurrently land in either window.
+    LatencySummary summary(bool reset);
+
+private:
+    std::array<std::atomic<uint64_t>,bucket_count> counts;
+    std::atomic<uint64_t> max;
+
+    static size_t bucket(uint64_t ns);
+    // Middle of the range of latencies counted in a bucket.
+    static uint64_t bucket_value(size_t index);
+};
+
+enum class Stage{
+    Acquire = 0,
+    CopyToNvBuffer,
+    // Cropping the region of interest when the ISP does not clip it.
+    Crop,
+    Sharpness,
+    Motion,
+    Encode,
+    Transform,
+    MapCopy,
+    FileWrite,
+    // Acquiring and converting the frame of the preview output.
+    Preview,
+    // From the sensor time stamp of a frame until it is returned by the stream.
+    EndToEnd,
+    Count,
+};
+
+const char * stage_name(Stage stage);
+
+// A latency histogram for every stage of the capture pipeline.
+class StageLatency{
+    std::array<LatencyHistogram,(size_t)Stage::Count> histograms;
+
+public:
+    LatencyHistogram & operator[](Stage stage){
+        return this->histograms[(size_t)stage];
+    }
+
+    void reset(){
+        for(auto & histogram: this->histograms){
+            histogram.summary(true);
+        }
+    }
+};
@@ -7,57 +7,253 @@
 #include <EGLStream/NV/ImageNativeBuffer.h>
 #include <nvbuf_utils.h>
 
-#include <pybind11/pybind11.h>
-#include <pybind11/numpy.h>
-
+#include <atomic>
+#include <deque>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <optional>
 #include <string>
+#include <tuple>
+#include <unordered_map>
 #include <vector>
 #include <unistd.h>
 #include "filesystem.hpp"
+#include "prefetch.hpp"
+#include "feed.hpp"
+#include "staging.hpp"
+#include "preroll.hpp"
+#include "luma.hpp"
+#include "histogram.hpp"
+#include "sensor_clock.hpp"
+#include "metrics.hpp"
+#include "camera_provider.hpp"
+#include "capture_metadata.hpp"
 
 using namespace Argus;
 using namespace EGLStream;
 
 namespace fs = ghc::filesystem;
-namespace py = pybind11;
+
+struct CameraData{
+    uint32_t id;
+    std::string name;
+};
+
+/*
+ * Downscales the luma plane of frames into a small pitch linear buffer which can
+ * be read by the cpu.
+ */
+class LumaSampler{
+    int dma_buffer;
+    void * data;
+    NvBufferParams params;
+    NvBufferTransformParams transform_params;
+
+public:
+    uint32_t width;
+    uint32_t height;
+
+    LumaSampler(uint32_t width, uint32_t height);
+    ~LumaSampler();
+
+    // Writes the downscaled luma plane of `in_dma_buffer` to `out` without padding.
+    void sample(int in_dma_buffer, std::vector<uint8_t> & out);
+};
+
+// An image in host memory which can be shared without copying.
+struct ImageBuffer{
+    std::shared_ptr<uint8_t[]> data;
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;
+};
+
+/*
+ * Converts frames to pitch linear BGRA images of a fixed size and copies them
+ * to host memory.
+ */
+class BgraConverter{
+    int dma_buffer;
+    NvBufferTransformParams transform_params;
+
+public:
+    uint32_t width;
+    uint32_t height;
+
+    BgraConverter(uint32_t width, uint32_t height);
+    ~BgraConverter();
+
+    // Converts `in_dma_buffer` to BGRA, scaled to the size of the converter.
+    void transform(int in_dma_buffer);
+    // Copies the last converted image to `out`, which holds width * height * 4 bytes, or to a
+    // new image buffer if `out` is null.
+    ImageBuffer read(std::shared_ptr<uint8_t[]> out = nullptr);
+};
+
+struct ArgusStreamOutput{
+    uint64_t number;
+    uint64_t time_stamp;
+    int dma_buffer;
+    // Variance of the laplacian of the luma plane, 0 if sharpness scoring is not enabled.
+    float sharpness;
+    // Id of the settings the frame was captured with, see `update_settings`.
+    uint32_t settings_id;
+    // Capture metadata, only read if metadata is enabled.
+    FrameMetadata metadata;
+    // The frame of the preview output as a BGRA image, empty if there is no preview or the frame was skipped.
+    ImageBuffer preview;
+    // Whether the frame was captured since the previous frame group, false if a camera
+    // of another capture group repeats its last frame.
+    bool fresh;
+};
 
 struct CameraStream{
     std::string name;
+    // Index of the camera device at the camera provider.
+    uint32_t device;
+    // Index of the capture group of the camera.
+    uint32_t group;
+    // The region of the frame the camera outputs, in fractions of the frame. The full frame if not set.
+    std::optional<Rectangle<float>> roi;
+    // Whether the region is cropped from the full frame after capture because the ISP did not
+    // accept the clip rectangle.
+    bool crop_roi;
+    int roi_dma_buffer;
     UniqueObj<FrameConsumer> consumer;
     UniqueObj<OutputStream> stream;
     IEGLOutputStream * i_stream;
     IFrameConsumer * i_consumer;
     int dma_buffer;
+    // The smaller preview output of the camera, captured by the same requests as the full output.
+    UniqueObj<FrameConsumer> preview_consumer;
+    UniqueObj<OutputStream> preview_stream;
+    IEGLOutputStream * i_preview_stream;
+    IFrameConsumer * i_preview_consumer;
+    int preview_dma_buffer;
+    std::unique_ptr<BgraConverter> preview_converter;
+    // A preview frame of a later capture than the last frame of the full output, kept for the
+    // frame of the full output it belongs to.
+    UniqueObj<Frame> pending_preview;
+    // Added to the frame numbers of the output stream, so the numbers continue where
+    // they left off when the output stream is recreated.
+    uint64_t number_offset;
+    std::optional<uint64_t> last_number;
+    bool renumber;
+    // The last frame of the camera, returned again while a camera of a slower group has no new frame.
+    std::optional<ArgusStreamOutput> last_output;
 };
 
-struct CameraData{
-    uint32_t id;
-    std::string name;
+// Cameras which share a capture session, and with it the resolution, sensor mode, frame rate
+// and settings.
+struct CaptureGroup{
+    UniqueObj<CaptureSession> session;
+    UniqueObj<Request> request;
+    ICaptureSession * i_capture_session;
+    Size2D<uint32_t> resolution;
+    float fps;
+    uint32_t sensor_mode;
+    ModePlan mode_plan;
+    // Whether the resolution, frame rate and sensor mode are the ones of the stream, and not set
+    // by the `camera_config` of the cameras of the group. Only these are changed by reconfigure.
+    bool default_resolution;
+    bool default_fps;
+    bool default_mode;
+    // Indices of the cameras of the group in the stream.
+    std::vector<uint32_t> cameras;
 };
 
-struct ArgusStreamOutput{
-    uint64_t number;
-    uint64_t time_stamp;
-    int dma_buffer;
+// The ranges of a capture group after applying settings, computed by `validate_settings`.
+struct GroupSettings{
+    Range<float> isp_gain_range;
+    Range<float> gain_range;
+    Range<uint64_t> exposure_range;
 };
 
-class ArgusStream{
+class ArgusStream: public MetricSource {
 protected:
+    // The largest resolution and frame rate of the capture groups, buffers shared by all
+    // cameras are sized by them.
     Size2D<uint32_t> resolution;
     float fps;
 
     std::vector<std::unique_ptr<CameraStream>> cameras;
-    UniqueObj<CameraProvider> provider;
-    UniqueObj<CaptureSession> session;
-    UniqueObj<Request> request;
+    std::shared_ptr<CameraProviderHandle> provider;
+    // The group of the first camera paces the stream.
+    std::vector<std::unique_ptr<CaptureGroup>> groups;
 
-    ICaptureSession * i_capture_session;
+    std::unique_ptr<LumaSampler> sharpness_sampler;
+    std::vector<uint8_t> sharpness_luma;
+    uint32_t sharpness_scale;
+    bool metadata_enabled;
+    std::optional<Size2D<uint32_t>> preview_resolution;
 
-    void apply_settings(std::unordered_map<std::string,double> settings);
-    void print_settings();
+    // Checks `settings` against the limits of the group without changing its request.
+    GroupSettings validate_settings(CaptureGroup & group, const std::unordered_map<std::string,double> & settings);
+    // Sets `settings` on the request of the group, `validated` is the result of `validate_settings`.
+    void apply_settings(CaptureGroup & group, const std::unordered_map<std::string,double> & settings,
+            const GroupSettings & validated);
+    void print_settings(CaptureGroup & group);
+    // Creates the output stream and frame consumer of `camera` at the resolution of the group
+    // and enables it in the request of the group.
+    void create_output(CaptureGroup & group, CameraStream & camera);
+    // Creates the preview output stream of `camera` and enables it in the request of the group.
+    void create_preview(CaptureGroup & group, CameraStream & camera);
+    // Converts `frames` with the preview converters of the cameras, so the first preview is as fast
+    // as the following ones.
+    void warm_up_previews(const std::vector<ArgusStreamOutput> & frames);
+    // Acquires the frame of the preview output captured together with the frame `capture_id`
+    // and converts it. Returns an empty image if the capture has no preview frame, or if the
+    // capture id is unknown.
+    ImageBuffer acquire_preview(CameraStream & camera, uint32_t capture_id, bool skip);
+    // Plans the sensor mode of the cameras of a group, the plan selects `mode` if it is given.
+    ModePlan select_mode(const CaptureGroup & group, std::optional<uint32_t> mode, Size2D<uint32_t> resolution, float fps);
+    void set_sensor_mode(CaptureGroup & group);
+    // Crops the region of interest out of the last frame of a camera which is captured at full size.
+    void crop(CameraStream & camera);
+    // Sets the resolution and frame rate of the stream to the largest of the groups.
+    void update_limits();
+    // Acquires a frame of camera `i`. Without `wait` the newest ready frame is taken and
+    // false is returned if there is none.
+    bool acquire(uint32_t i, bool skip, bool wait, ArgusStreamOutput & out);
+    // Starts the repeating capture request and waits until the streams are connected.
+    void start_capture();
+    // Changes the resolution, frame rate or sensor mode of the groups which use the ones of the
+    // stream while keeping the sessions. Capturing stops, only the output streams are recreated
+    // if the resolution changes, and capturing resumes if it was started. Returns whether the
+    // resolution of a group changed.
+    bool reconfigure_capture(std::optional<std::pair<uint32_t,uint32_t>> resolution,
+            std::optional<float> fps,
+            std::optional<uint32_t> mode);
 
     bool started;
+    bool closed;
+    // Frames acquired while warming up are not counted as acquired.
+    bool warming_up;
+
+    StageLatency stage_latency;
+    // Maps the sensor time stamps of every camera to the host clock, kept after close
+    // for frames which are still delivered.
+    std::vector<std::unique_ptr<SensorClock>> clocks;
+    StreamMetrics counters;
+
+    // The isp gain range of a fresh request, settings are validated against it and the
+    // ranges of the sensor mode.
+    Range<float> isp_gain_limits;
+    // Id of the latest settings, stored as the client data of the request.
+    uint32_t settings_id;
+    uint32_t last_settings_id;
+    // The first frame number of camera 0 captured with the latest settings ids.
+    std::deque<std::pair<uint32_t,uint64_t>> settings_frames;
+    std::mutex settings_mutex;
+
+    // Applies settings to the request without restarting the capture and returns the
+    // id of the settings.
+    uint32_t update_settings(std::unordered_map<std::string,double> settings);
+
+    // Held while capturing so a capture never overlaps with a prefetch or close.
+    std::mutex next_mutex;
 
 public:
     ArgusStream(
@@ -65,23 +261,225 @@ public:
             std::pair<uint32_t,uint32_t> resolution,
             float fps,
             std::optional<uint32_t> mode,
-            std::optional<std::unordered_map<std::string,double>> settings);
+            std::optional<std::unordered_map<std::string,double>> settings,
+            std::optional<std::unordered_map<std::string,std::unordered_map<std::string,double>>> camera_config);
 
     virtual ~ArgusStream();
 
+    // Stops capturing and releases the cameras and all buffers, the stream can
+    // not be used afterwards. Calling close more than once has no effect.
+    virtual void close();
+    bool is_closed();
+
+    // Scores the sharpness of every captured frame on the luma plane downscaled by `scale`.
+    void enable_sharpness(uint32_t scale);
+    // Reads the capture metadata of every captured frame.
+    void enable_metadata();
+    // Adds a preview output of `resolution` to every camera, returned with the frames as BGRA images.
+    // Must be called before capturing starts.
+    void enable_preview(Size2D<uint32_t> resolution);
+
+    // Latencies of a pipeline stage since the last reset.
+    LatencySummary latency(Stage stage, bool reset);
+    // The sensor mode selected for the current configuration of a camera and the modes it was selected from.
+    ModePlan sensor_mode_plan(uint32_t camera);
+    // The resolution of the frames of a camera, the size of its region of interest if it has one.
+    Size2D<uint32_t> camera_resolution(uint32_t camera);
+    // The number of the first frame captured with the settings `id`, if it was captured.
+    std::optional<uint64_t> settings_frame(uint32_t id);
+
+    void metrics(std::vector<Metric> & out, bool gauges) override;
+
     std::vector<ArgusStreamOutput> next(bool skip);
 };
 
+// Profile flow of a frame, links the timings of a frame across the pipeline stages in traces.
+inline uint64_t frame_flow(uint32_t camera, uint64_t number){
+    return (uint64_t)(camera + 1) << 48 | (number & ((1ull << 48) - 1));
+}
+
+// Plain data of a frame passed to native frame callbacks.
+struct FrameData{
+    uint32_t camera;
+    uint64_t number;
+    uint64_t time_stamp;
+    float sharpness;
+    // The encoded jpeg or the BGRA image, null if the stream does not return frame data
+    // or the frame was skipped. Only valid during the callback.
+    const uint8_t * data;
+    size_t size;
+    uint32_t width;
+    uint32_t height;
+    uint64_t age_ns;
+};
+
+// Metadata of a frame returned by `next_many`.
+struct FrameRecord{
+    uint32_t camera;
+    uint64_t number;
+    uint64_t time_stamp;
+    // Frames missed by the stream since the previous frame of this camera returned by `next_many`.
+    uint64_t drops;
+    // Location of the frame data in the concatenated frame data of the batch.
+    uint64_t offset;
+    uint64_t size;
+    uint64_t age_ns;
+};
+
+// Receives `count` frames, the frames of every frame group are ordered by camera.
+typedef void (*FrameCallback)(void * context, const FrameData * frames, size_t count);
+
+/*
+ * Delivers the frames of an ArgusStream after they are processed by `capture`.
+ *
+ * Frames are either captured on the calling thread, captured one frame ahead by a
+ * prefetcher or captured continuously by a feed which signals an eventfd for every
+ * frame, so frames can be awaited from an event loop.
+ */
+template<class Output>
+class FrameStream: protected ArgusStream {
+protected:
+    Prefetch<std::vector<Output>> prefetcher;
+    FrameFeed<std::vector<Output>> feed;
+    std::thread dispatcher;
+    std::atomic<bool> dispatching;
+    std::vector<uint64_t> last_numbers;
+
+    virtual std::vector<Output> capture(bool skip) = 0;
+    // Captures a frame without returning it so every buffer of the pipeline is allocated.
+    virtual void warm_up();
+    // Reallocates the buffers which depend on the resolution after it changed.
+    virtual void resized();
+    // Whether capturing a frame group also writes it, a prefetched group of such a stream was
+    // already written and can not be skipped anymore.
+    virtual bool capture_writes();
+    void stop_dispatcher();
+    // Sets the host times of frames returned to the user and records their end to end latency.
+    void delivered(std::vector<Output> & frames);
+    // Returns the next frame group like `next`, a group which is not taken from the feed or the
+    // prefetcher is captured by `capture_group` while the stream is locked.
+    std::vector<Output> next_group(bool skip, const std::function<std::vector<Output>()> & capture_group);
+    // Appends a record for every frame of `group` to `records`, `offset` is advanced by the size
+    // of every frame.
+    void record_group(const std::vector<Output> & group, uint64_t & offset, std::vector<FrameRecord> & records);
+
+public:
+    FrameStream(std::vector<std::tuple<uint32_t,std::string> > cameras, 
+            std::pair<uint32_t,uint32_t> resolution, 
+            float fps, 
+            std::optional<uint32_t> mode,
+            std::optional<std::unordered_map<std::string,double>> settings,
+            std::optional<std::unordered_map<std::string,std::unordered_map<std::string,double>>> camera_config);
+
+    // Starts capturing without waiting for the first call to `next`. With `warmup` a frame
+    // is captured and processed without being returned, so all buffers are allocated and
+    // the first returned frame is as fast as the following ones.
+    void start(bool warmup);
+    // Changes the resolution, frame rate or sensor mode of the cameras without closing the stream.
+    // A value set for a camera in `camera_config` is kept. Without a mode the sensor mode is selected
+    // again when the frame rate changes. Frames captured before are still returned, a running feed or
+    // frame callback continues afterwards.
+    void reconfigure(std::optional<std::pair<uint32_t,uint32_t>> resolution,
+            std::optional<float> fps,
+            std::optional<uint32_t> mode);
+    // Applies settings to the capture without interrupting it and returns the id of the
+    // settings, frames captured with them carry the id.
+    uint32_t update_settings(std::unordered_map<std::string,double> settings);
+    // Returns the next frame, taken from the feed once it is started. With `skip` the frame is
+    // not processed and a pending prefetched frame is discarded. Frames of the feed are always
+    // processed, so `skip` has no effect while the feed is running. A prefetched frame of a
+    // stream which writes its frames was already written, it is returned as a processed frame.
+    std::vector<Output> next(bool skip);
+    // Captures the next `n` frame groups without processing them and appends the capture
+    // metadata of every new frame to `out`, repeated frames of slower capture groups are left
+    // out. A pending prefetched frame group is discarded, fails while the feed is running.
+    void next_metadata(size_t n, std::vector<FrameMetadata> & out);
+    // Returns the next `n` frame groups and appends a record for every frame to `records`.
+    std::vector<std::vector<Output>> next_many(size_t n, std::vector<FrameRecord> & records);
+    // Starts capturing the next frame in the background, it is returned by the next call to `next`.
+    void prefetch();
+    // Starts capturing continuously and returns an eventfd which is readable when frames are queued.
+    // A pending prefetched frame is discarded.
+    int start_feed();
+    // Takes a frame queued by the feed without blocking, returns false if there is none.
+    bool poll(std::vector<Output> & out);
+    // Captures continuously and calls `callback` from a dispatch thread with every `batch` frame groups.
+    // Dispatching stops when the callback returns false or the stream is closed, closing the
+    // stream from the callback is not allowed.
+    void on_frame(std::function<bool(std::vector<std::vector<Output>> &)> callback, size_t batch);
+    void close() override;
+    using ArgusStream::is_closed;
+    using ArgusStream::latency;
+    using ArgusStream::settings_frame;
+    using ArgusStream::sensor_mode_plan;
+    using ArgusStream::camera_resolution;
+
+    void metrics(std::vector<Metric> & out, bool gauges) override;
+    // Snapshot of the counters and queue depths of the stream.
+    std::vector<Metric> metrics_snapshot();
+};
+
 struct JpegStreamOutput{
     uint64_t number;
     uint64_t time_stamp;
+    // Motion score of the frame, 0 if the motion gate is not enabled.
+    float motion;
+    // Whether the frame was encoded, false if it was skipped or rejected by the motion gate.
+    bool encoded;
+    // Whether a jpeg of the camera was written, or handed to the preroll, with this frame. Within a
+    // sharpness window an encoded frame can still be replaced by a sharper one, the sharpest frame of
+    // the window is written with the frame which ends the window.
+    bool written;
+    float sharpness;
+    // Id of the settings the frame was captured with, see `update_settings`.
+    uint32_t settings_id = 0;
+    FrameMetadata metadata = {};
+    // The frame of the preview output as a BGRA image, empty if there is no preview.
+    ImageBuffer preview = {};
+    // False if the camera had no new frame and the last frame is repeated, see `camera_config`.
+    bool fresh = true;
+    // The sensor time stamp on CLOCK_MONOTONIC and CLOCK_REALTIME, in nanoseconds.
+    uint64_t capture_monotonic_ns = 0;
+    uint64_t capture_realtime_ns = 0;
+    // CLOCK_MONOTONIC time at which the frame was returned, in nanoseconds.
+    uint64_t delivery_ns = 0;
+    // Time from capture until the frame was returned, in nanoseconds.
+    uint64_t age_ns = 0;
+};
+
+// The sharpest frame seen in the current window of frames.
+struct SharpnessWindow{
+    uint32_t count;
+    float best;
+    uint64_t number;
+    uint64_t time_stamp;
+    std::vector<unsigned char> jpeg;
 };
 
-class JpegStream: protected ArgusStream {
+class JpegStream: public FrameStream<JpegStreamOutput> {
     std::unique_ptr<NvJPEGEncoder> nv;
     std::vector<fs::path> directories;
     unsigned char * jpeg_buffer;
     unsigned long jpeg_buffer_size;
+    std::unique_ptr<StagingWriter> staging;
+    std::unique_ptr<PrerollRecorder> preroll;
+    std::vector<MotionGate> motion;
+    std::unique_ptr<LumaSampler> luma_sampler;
+    std::vector<uint8_t> luma;
+    float sharpness_threshold;
+    uint32_t sharpness_window;
+    std::vector<SharpnessWindow> windows;
+
+    std::vector<JpegStreamOutput> capture(bool skip) override;
+    void warm_up() override;
+    void resized() override;
+    bool capture_writes() override;
+    // Writes the sharpest frame of the current window of every camera.
+    void flush_windows();
+
+    void metrics(std::vector<Metric> & out, bool gauges) override;
+    void store(size_t camera, uint64_t number, const unsigned char * data, size_t size);
+    void output(size_t camera, uint64_t number, uint64_t time_stamp, const unsigned char * data, size_t size);
 
 public:
     JpegStream(std::vector<std::tuple<uint32_t,std::string> > cameras, 
@@ -89,58 +487,145 @@ public:
             float fps, 
             std::optional<uint32_t> mode,
             std::optional<std::unordered_map<std::string,double>> settings,
-            std::string directory);
+            std::string directory,
+            std::optional<std::unordered_map<std::string,double>> staging,
+            std::optional<std::unordered_map<std::string,double>> preroll,
+            std::optional<std::unordered_map<std::string,double>> motion,
+            std::optional<std::unordered_map<std::string,double>> sharpness,
+            std::optional<std::unordered_map<std::string,std::unordered_map<std::string,double>>> camera_config,
+            std::optional<std::unordered_map<std::string,double>> preview,
+            bool metadata,
+            bool warmup);
     ~JpegStream();
 
-    
-    std::vector<JpegStreamOutput> next(bool skip);
+    void close() override;
+
+    void trigger(double pre_seconds, double post_seconds);
+
+    StagingStats staging_stats();
+    PrerollStats preroll_stats();
 };
 
 struct JpegBytesStreamOutput{
     uint64_t number;
     uint64_t time_stamp;
-    py::bytes bytes;
+    std::string bytes;
+    float sharpness;
+    // Id of the settings the frame was captured with, see `update_settings`.
+    uint32_t settings_id = 0;
+    FrameMetadata metadata = {};
+    // The frame of the preview output as a BGRA image, empty if there is no preview.
+    ImageBuffer preview = {};
+    // False if the camera had no new frame and the last frame is repeated, see `camera_config`.
+    bool fresh = true;
+    // The sensor time stamp on CLOCK_MONOTONIC and CLOCK_REALTIME, in nanoseconds.
+    uint64_t capture_monotonic_ns = 0;
+    uint64_t capture_realtime_ns = 0;
+    // CLOCK_MONOTONIC time at which the frame was returned, in nanoseconds.
+    uint64_t delivery_ns = 0;
+    // Time from capture until the frame was returned, in nanoseconds.
+    uint64_t age_ns = 0;
 };
 
-class JpegBytesStream: protected ArgusStream {
+class JpegBytesStream: public FrameStream<JpegBytesStreamOutput> {
     std::unique_ptr<NvJPEGEncoder> nv;
-    std::vector<fs::path> directories;
     unsigned char * jpeg_buffer;
     unsigned long jpeg_buffer_size;
 
+    std::vector<JpegBytesStreamOutput> capture(bool skip) override;
+    void warm_up() override;
+    void resized() override;
+
+    void metrics(std::vector<Metric> & out, bool gauges) override;
+
 public:
     JpegBytesStream(std::vector<std::tuple<uint32_t,std::string> > cameras, 
             std::pair<uint32_t,uint32_t> resolution, 
             float fps, 
             std::optional<uint32_t> mode,
-            std::optional<std::unordered_map<std::string,double>> settings);
+            std::optional<std::unordered_map<std::string,double>> settings,
+            std::optional<std::unordered_map<std::string,double>> sharpness,
+            std::optional<std::unordered_map<std::string,std::unordered_map<std::string,double>>> camera_config,
+            std::optional<std::unordered_map<std::string,double>> preview,
+            bool metadata,
+            bool warmup);
     ~JpegBytesStream();
-
-    
-    std::vector<JpegBytesStreamOutput> next(bool skip);
 };
 
 struct NumpyStreamOutput{
     uint64_t number;
     uint64_t time_stamp;
-    py::array_t<uint8_t> array;
+    // The image in BGRA format, empty if the frame was skipped. A repeated frame has the image of
+    // the frame it repeats.
+    ImageBuffer image;
+    float sharpness;
+    // Id of the settings the frame was captured with, see `update_settings`.
+    uint32_t settings_id = 0;
+    FrameMetadata metadata = {};
+    // The frame of the preview output as a BGRA image, empty if there is no preview.
+    ImageBuffer preview = {};
+    // False if the camera had no new frame and the last frame is repeated, see `camera_config`.
+    bool fresh = true;
+    // The sensor time stamp on CLOCK_MONOTONIC and CLOCK_REALTIME, in nanoseconds.
+    uint64_t capture_monotonic_ns = 0;
+    uint64_t capture_realtime_ns = 0;
+    // CLOCK_MONOTONIC time at which the frame was returned, in nanoseconds.
+    uint64_t delivery_ns = 0;
+    // Time from capture until the frame was returned, in nanoseconds.
+    uint64_t age_ns = 0;
 };
 
-class NumpyStream: protected ArgusStream {
-    int dma_buffer;
-    NvBufferTransformParams transform_params;
+// Describes the frame of `camera` in a frame group for a native frame callback.
+FrameData frame_data(const JpegStreamOutput & output, uint32_t camera);
+FrameData frame_data(const JpegBytesStreamOutput & output, uint32_t camera);
+FrameData frame_data(const NumpyStreamOutput & output, uint32_t camera);
+
+// Describes the frames of a batch of frame groups for a native frame callback, ordered by frame group and camera.
+template<class Output>
+std::vector<FrameData> frame_data(const std::vector<std::vector<Output>> & groups){
+    std::vector<FrameData> frames;
+    for(auto & group: groups){
+        for(uint32_t i = 0;i < group.size();i++){
+            frames.push_back(frame_data(group[i],i));
+        }
+    }
+    return frames;
+}
+
+class NumpyStream: public FrameStream<NumpyStreamOutput> {
+    // Converter of every camera, cameras of different capture groups differ in resolution.
+    std::vector<std::unique_ptr<BgraConverter>> converters;
+    // The last image of every camera, returned again for repeated frames.
+    std::vector<ImageBuffer> last_images;
 
-    py::array_t<uint8_t> copy_buffer(int in_dma_buffer);
+    ImageBuffer copy_buffer(int in_dma_buffer, uint32_t camera, std::shared_ptr<uint8_t[]> out = nullptr);
+    std::vector<NumpyStreamOutput> capture(bool skip) override;
+    // Captures like `capture` and converts the image of camera `i` into `buffer` at `offset` + `i`
+    // images, or into new image buffers if `buffer` is null.
+    std::vector<NumpyStreamOutput> capture_into(bool skip, const std::shared_ptr<uint8_t[]> & buffer, size_t offset);
+    void warm_up() override;
+    void resized() override;
+
+    void metrics(std::vector<Metric> & out, bool gauges) override;
 
 public:
     NumpyStream(std::vector<std::tuple<uint32_t,std::string> > cameras, 
             std::pair<uint32_t,uint32_t> resolution, 
             float fps, 
             std::optional<uint32_t> mode,
-            std::optional<std::unordered_map<std::string,double>> settings
+            std::optional<std::unordered_map<std::string,double>> settings,
+            std::optional<std::unordered_map<std::string,double>> sharpness,
+            std::optional<std::unordered_map<std::string,std::unordered_map<std::string,double>>> camera_config,
+            std::optional<std::unordered_map<std::string,double>> preview,
+            bool metadata,
+            bool warmup
             );
     ~NumpyStream();
 
-    
-    std::vector<NumpyStreamOutput> next(bool skip);
+    void close() override;
+    // Returns the next `n` frame groups like `next_many` with their images in one buffer of
+    // `n` * cameras images, ordered by frame group and camera. Captured frames are converted into
+    // the buffer, only frames taken from the feed or the prefetcher are copied. Throws if the
+    // cameras differ in resolution.
+    std::vector<std::vector<NumpyStreamOutput>> next_stacked(size_t n, std::vector<FrameRecord> & records, ImageBuffer & stacked);
 };
@@ -0,0 +1,199 @@
+#include "jepture_c.h"
+#include "jepture.hpp"
+
+static thread_local std::string last_error;
+
+static jepture_frame to_c_frame(const FrameData & data){
+    return jepture_frame{data.camera,data.number,data.time_stamp,data.sharpness,data.data,data.size,data.width,data.height,data.age_ns};
+}
+
+struct jepture_stream{
+    virtual ~jepture_stream() = default;
+    virtual size_t next(jepture_frame * frames, size_t capacity) = 0;
+    virtual void on_frame(jepture_frame_callback callback, void * context, size_t batch) = 0;
+    virtual void start(bool warmup) = 0;
+    virtual void close() = 0;
+};
+
+template<class Stream>
+struct StreamHandle: jepture_stream{
+    std::unique_ptr<Stream> stream;
+    // Number of frames of every frame group.
+    size_t cameras;
+    // Keeps the data of the last frames alive until the next call.
+    decltype(stream->next(false)) last;
+
+    StreamHandle(std::unique_ptr<Stream> stream, size_t cameras): stream(std::move(stream)), cameras(cameras) {}
+
+    size_t next(jepture_frame * frames, size_t capacity) override {
+        // Checked before capturing, so a too small buffer does not lose a frame group.
+        if(this->cameras > capacity){
+            throw std::runtime_error("frame buffer is too small for all cameras");
+        }
+        if(!frames){
+            throw std::runtime_error("frames is null");
+        }
+        this->last = this->stream->next(false);
+        for(uint32_t i = 0;i < this->last.size();i++){
+            frames[i] = to_c_frame(frame_data(this->last[i],i));
+        }
+        return this->last.size();
+    }
+
+    void on_frame(jepture_frame_callback callback, void * context, size_t batch) override {
+        this->stream->on_frame([callback,context](auto & groups){
+            std::vector<jepture_frame> frames;
+            for(auto & data: frame_data(groups)){
+                frames.push_back(to_c_frame(data));
+            }
+            callback(context,frames.data(),frames.size());
+            return true;
+        },batch);
+    }
+
+    void start(bool warmup) override {
+        this->stream->start(warmup);
+    }
+
+    void close() override {
+        this->stream->close();
+    }
+};
+
+struct StreamArgs{
+    std::vector<std::tuple<uint32_t,std::string>> cameras;
+    std::pair<uint32_t,uint32_t> resolution;
+    float fps;
+    std::optional<uint32_t> mode;
+    std::optional<std::unordered_map<std::string,double>> settings;
+};
+
+static StreamArgs stream_args(const jepture_stream_config * config){
+    if(!config){
+        throw std::runtime_error("config is null");
+    }
+    if(config->camera_count != 0 && !config->cameras){
+        throw std::runtime_error("cameras is null");
+    }
+    if(config->setting_count != 0 && !config->settings){
+        throw std::runtime_error("settings is null");
+    }
+    StreamArgs args;
+    for(size_t i = 0;i < config->camera_count;i++){
+        args.cameras.emplace_back(config->cameras[i].id,config->cameras[i].name ? config->cameras[i].name : "");
+    }
+    args.resolution = {config->width,config->height};
+    args.fps = config->fps;
+    if(config->mode >= 0){
+        args.mode = config->mode;
+    }
+    if(config->setting_count != 0){
+        args.settings.emplace();
+        for(size_t i = 0;i < config->setting_count;i++){
+            if(!config->settings[i].name){
+                throw std::runtime_error("setting name is null");
+            }
+            (*args.settings)[config->settings[i].name] = config->settings[i].value;
+        }
+    }
+    return args;
+}
+
+static jepture_stream & checked(jepture_stream * stream){
+    if(!stream){
+        throw std::runtime_error("stream is null");
+    }
+    return *stream;
+}
+
+// Runs `f`, storing the message of an exception as the last error.
+template<class F>
+static int guarded(F f){
+    try{
+        f();
+        return 0;
+    }catch(const std::exception & e){
+        last_error = e.what();
+    }catch(...){
+        last_error = "unknown error";
+    }
+    return -1;
+}
+
+extern "C" {
+
+int jepture_api_version(void){
+    return JEPTURE_C_API_VERSION;
+}
+
+const char * jepture_last_error(void){
+    return last_error.c_str();
+}
+
+jepture_stream * jepture_jpeg_stream_create(const jepture_stream_config * config, const char * directory){
+    jepture_stream * res = nullptr;
+    guarded([&]{
+        auto args = stream_args(config);
+        auto stream = std::make_unique<JpegStream>(args.cameras,args.resolution,args.fps,args.mode,args.settings,
+                directory ? directory : "./data",std::nullopt,std::nullopt,std::nullopt,std::nullopt,std::nullopt,std::nullopt,false,false);
+        res = new StreamHandle<JpegStream>(std::move(stream),args.cameras.size());
+    });
+    return res;
+}
+
+jepture_stream * jepture_jpeg_bytes_stream_create(const jepture_stream_config * config){
+    jepture_stream * res = nullptr;
+    guarded([&]{
+        auto args = stream_args(config);
+        auto stream = std::make_unique<JpegBytesStream>(args.cameras,args.resolution,args.fps,args.mode,args.settings,std::nullopt,std::nullopt,std::nullopt,false,false);
+        res = new StreamHandle<JpegBytesStream>(std::move(stream),args.cameras.size());
+    });
+    return res;
+}
+
+jepture_stream * jepture_image_stream_create(const jepture_stream_config * config){
+    jepture_stream * res = nullptr;
+    guarded([&]{
+        auto args = stream_args(config);
+        auto stream = std::make_unique<NumpyStream>(args.cameras,args.resolution,args.fps,args.mode,args.settings,std::nullopt,std::nullopt,std::nullopt,false,false);
+        res = new StreamHandle<NumpyStream>(std::move(stream),args.cameras.size());
+    });
+    return res;
+}
+
+int jepture_stream_next(jepture_stream * stream, jepture_frame * frames, size_t capacity, size_t * count){
+    return guarded([&]{
+        size_t written = checked(stream).next(frames,capacity);
+        if(count){
+            *count = written;
+        }
+    });
+}
+
+int jepture_stream_on_frame(jepture_stream * stream, jepture_frame_callback callback, void * context, size_t batch){
+    return guarded([&]{
+        auto & handle = checked(stream);
+        if(!callback){
+            throw std::runtime_error("callback is null");
+        }
+        handle.on_frame(callback,context,batch);
+    });
+}
+
+int jepture_stream_start(jepture_stream * stream, int warmup){
+    return guarded([&]{
+        checked(stream).start(warmup != 0);
+    });
+}
+
+int jepture_stream_close(jepture_stream * stream){
+    return guarded([&]{
+        checked(stream).close();
+    });
+}
+
+void jepture_stream_destroy(jepture_stream * stream){
+    delete stream;
+}
+
+}
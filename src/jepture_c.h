@@ -0,0 +1,90 @@
+#pragma once
+
+/*
+ * C interface to the jepture streams for FFI users.
+ *
+ * Functions which can fail return 0 on success and -1 on failure, or NULL for
+ * constructors. The message of the last failure on the calling thread is returned
+ * by jepture_last_error. A NULL stream, config or frame buffer is reported as a
+ * failure, jepture_stream_destroy accepts NULL.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define JEPTURE_C_API_VERSION 2
+
+typedef struct jepture_stream jepture_stream;
+
+typedef struct jepture_camera{
+    uint32_t id;
+    // Name of the camera, the JPEG stream writes frames to a directory with this name.
+    const char * name;
+} jepture_camera;
+
+typedef struct jepture_setting{
+    const char * name;
+    double value;
+} jepture_setting;
+
+typedef struct jepture_stream_config{
+    const jepture_camera * cameras;
+    size_t camera_count;
+    uint32_t width;
+    uint32_t height;
+    float fps;
+    // Sensor mode to use, -1 selects a mode based on the fps.
+    int32_t mode;
+    // Capture settings, the same settings as the `settings` dict of the python streams.
+    const jepture_setting * settings;
+    size_t setting_count;
+} jepture_stream_config;
+
+typedef struct jepture_frame{
+    uint32_t camera;
+    uint64_t number;
+    uint64_t time_stamp;
+    float sharpness;
+    // The encoded jpeg or the BGRA image, NULL for the JPEG stream. Valid until the
+    // next call to jepture_stream_next or jepture_stream_destroy, or during the callback.
+    const uint8_t * data;
+    size_t size;
+    uint32_t width;
+    uint32_t height;
+    // Nanoseconds from the capture of the frame until it was returned, on CLOCK_MONOTONIC.
+    uint64_t age_ns;
+} jepture_frame;
+
+// Receives `count` frames, the frames of every frame group are ordered by camera.
+typedef void (*jepture_frame_callback)(void * context, const jepture_frame * frames, size_t count);
+
+int jepture_api_version(void);
+const char * jepture_last_error(void);
+
+// Encodes frames and writes them to `directory`/<camera name>/<number>.jpg.
+jepture_stream * jepture_jpeg_stream_create(const jepture_stream_config * config, const char * directory);
+// Encodes frames and returns the jpegs.
+jepture_stream * jepture_jpeg_bytes_stream_create(const jepture_stream_config * config);
+// Converts frames to BGRA images.
+jepture_stream * jepture_image_stream_create(const jepture_stream_config * config);
+
+// Captures the next frame group and writes one frame per camera to `frames`, which must
+// have room for `capacity` frames. The number of frames written is stored in `count` unless it
+// is NULL. Fails without capturing if `capacity` is smaller than the number of cameras.
+int jepture_stream_next(jepture_stream * stream, jepture_frame * frames, size_t capacity, size_t * count);
+// Captures continuously and calls `callback` from a native thread with every `batch` frame groups.
+int jepture_stream_on_frame(jepture_stream * stream, jepture_frame_callback callback, void * context, size_t batch);
+// Starts capturing before the first frame is requested. With `warmup` non-zero a frame is captured
+// and processed without being returned, so the first returned frame is as fast as the following ones.
+int jepture_stream_start(jepture_stream * stream, int warmup);
+// Stops capturing and releases the cameras, the stream must still be destroyed.
+int jepture_stream_close(jepture_stream * stream);
+void jepture_stream_destroy(jepture_stream * stream);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,7 +1,10 @@
 #include "jepture.hpp"
 #include "profile.hpp"
+#include "config.hpp"
 
+#include <algorithm>
 #include <cstdio>
+#include <cstring>
 #include <sstream>
 #include <limits>
 #include <iostream>
@@ -12,8 +15,16 @@ JpegStream::JpegStream(
         float fps, 
         std::optional<uint32_t> mode,
         std::optional<std::unordered_map<std::string,double>> settings,
-        std::string directory)
-    : ArgusStream(cameras,resolution,fps,mode,settings),
+        std::string directory,
+        std::optional<std::unordered_map<std::string,double>> staging,
+        std::optional<std::unordered_map<std::string,double>> preroll,
+        std::optional<std::unordered_map<std::string,double>> motion,
+        std::optional<std::unordered_map<std::string,double>> sharpness,
+        std::optional<std::unordered_map<std::string,std::unordered_map<std::string,double>>> camera_config,
+        std::optional<std::unordered_map<std::string,double>> preview,
+        bool metadata,
+        bool warmup)
+    : FrameStream(cameras,resolution,fps,mode,settings,camera_config),
     nv(NvJPEGEncoder::createJPEGEncoder("nvjpegjepture"))
 {
     for(uint32_t i = 0;i < this->cameras.size();i++){
@@ -23,38 +34,269 @@ JpegStream::JpegStream(
     }
     this->jpeg_buffer_size = this->resolution.width() * this->resolution.height() * 3 / 2;
     this->jpeg_buffer = new unsigned char[this->jpeg_buffer_size];
+
+    if(staging){
+        this->staging = std::make_unique<StagingWriter>(*staging,&this->stage_latency[Stage::FileWrite],&this->counters);
+    }
+    if(preroll){
+        this->preroll = std::make_unique<PrerollRecorder>(this->cameras.size(),this->fps,*preroll,
+                [this](size_t camera, uint64_t number, const unsigned char * data, size_t size){
+                    this->store(camera,number,data,size);
+                });
+    }
+    if(motion){
+        for(uint32_t i = 0;i < this->cameras.size();i++){
+            this->motion.emplace_back(*motion);
+        }
+        auto scale = this->motion[0].scale;
+        this->luma_sampler = std::make_unique<LumaSampler>(
+                std::max(this->resolution.width() / scale,16u),
+                std::max(this->resolution.height() / scale,16u));
+    }
+    this->sharpness_threshold = 0.0;
+    this->sharpness_window = 1;
+    if(sharpness){
+        this->enable_sharpness(config_value(*sharpness,"sharpness","scale",4.0,1.0,64.0));
+        this->sharpness_threshold = config_value(*sharpness,"sharpness","threshold",0.0,0.0,1e9);
+        this->sharpness_window = config_value(*sharpness,"sharpness","window",1.0,1.0,1e6);
+        this->windows.resize(this->cameras.size(),SharpnessWindow{0,-1.0,0,0,{}});
+    }
+    if(preview){
+        this->enable_preview(Size2D<uint32_t>(
+                config_value(*preview,"preview","width",640.0,16.0,65536.0),
+                config_value(*preview,"preview","height",360.0,16.0,65536.0)));
+    }
+    if(metadata){
+        this->enable_metadata();
+    }
+    if(warmup){
+        this->start(true);
+    }
+    register_metrics(this);
+}
+
+void JpegStream::store(size_t camera, uint64_t number, const unsigned char * data, size_t size){
+    // Also called from the preroll thread and for frames of an earlier window.
+    INTERVAL_FLOW(frame_flow(camera,number));
+    std::string file_name(std::to_string(number));
+    file_name.append(".jpg");
+    if(this->staging){
+        this->staging->push(this->directories[camera] / file_name,data,size);
+    }else{
+        auto write_start = std::chrono::steady_clock::now();
+        if(write_file(this->directories[camera] / file_name,data,size)){
+            this->counters.written_files.fetch_add(1,std::memory_order_relaxed);
+            this->counters.written_bytes.fetch_add(size,std::memory_order_relaxed);
+        }
+        this->stage_latency[Stage::FileWrite].record_since(write_start);
+    }
+}
+
+void JpegStream::output(size_t camera, uint64_t number, uint64_t time_stamp, const unsigned char * data, size_t size){
+    if(this->preroll){
+        this->preroll->push(camera,number,time_stamp,data,size);
+    }else{
+        this->store(camera,number,data,size);
+    }
+}
+
+static void encode_metrics(StreamMetrics & counters, std::vector<Metric> & out){
+    out.push_back(counter_metric("encoded_frames_total","Frames encoded to jpeg.",
+                counters.encoded_frames.load(std::memory_order_relaxed)));
+    out.push_back(counter_metric("encoded_bytes_total","Bytes of the encoded jpegs.",
+                counters.encoded_bytes.load(std::memory_order_relaxed)));
 }
 
-std::vector<JpegStreamOutput> JpegStream::next(bool skip = false){
+void JpegStream::metrics(std::vector<Metric> & out, bool gauges){
+    FrameStream::metrics(out,gauges);
+    encode_metrics(this->counters,out);
+    out.push_back(counter_metric("written_files_total","Jpegs written to storage.",
+                this->counters.written_files.load(std::memory_order_relaxed)));
+    out.push_back(counter_metric("written_bytes_total","Bytes of the jpegs written to storage.",
+                this->counters.written_bytes.load(std::memory_order_relaxed)));
+    if(gauges && this->staging){
+        auto stats = this->staging->stats();
+        out.push_back(gauge_metric("staging_queue_files","Jpegs staged in memory and not yet written.",stats.staged_files));
+        out.push_back(gauge_metric("staging_queue_bytes","Bytes staged in memory and not yet written.",stats.staged_bytes));
+        out.push_back(counter_metric("staging_dropped_files_total","Jpegs dropped by the staging tier.",stats.dropped_files));
+    }
+    if(gauges && this->preroll){
+        auto stats = this->preroll->stats();
+        out.push_back(gauge_metric("preroll_buffered_frames","Jpegs buffered in the pre-roll rings.",stats.buffered_frames));
+    }
+}
+
+void JpegStream::close(){
+    FrameStream::close();
+    std::lock_guard<std::mutex> guard(this->next_mutex);
+    this->luma_sampler.reset();
+    // The last window of a stopped recording is incomplete, its sharpest frame is still written.
+    this->flush_windows();
+    // Finish writing triggered and staged frames before returning.
+    this->preroll.reset();
+    this->staging.reset();
+}
+
+// Encodes a frame into the jpeg buffer once, which initializes the encoder.
+static void warm_up_encoder(NvJPEGEncoder * nv, int dma_buffer, unsigned char *& jpeg_buffer, unsigned long & jpeg_buffer_size){
+    // Touch every page of the buffer so encoding does not fault them in.
+    std::memset(jpeg_buffer,0,jpeg_buffer_size);
+    unsigned long buffer_size = jpeg_buffer_size;
+    if(nv->encodeFromFd(dma_buffer,JCS_YCbCr,&jpeg_buffer,buffer_size,90) < 0){
+        throw std::runtime_error("failed to encode jpeg");
+    }
+    if(buffer_size > jpeg_buffer_size){
+        jpeg_buffer_size = buffer_size;
+    }
+}
+
+// Grows the jpeg buffer to hold an uncompressed frame of `resolution`.
+static void reserve_jpeg_buffer(unsigned char *& jpeg_buffer, unsigned long & jpeg_buffer_size, const Size2D<uint32_t> & resolution){
+    unsigned long size = resolution.width() * resolution.height() * 3 / 2;
+    if(size <= jpeg_buffer_size){
+        return;
+    }
+    delete[] jpeg_buffer;
+    jpeg_buffer = new unsigned char[size];
+    jpeg_buffer_size = size;
+}
+
+void JpegStream::resized(){
+    reserve_jpeg_buffer(this->jpeg_buffer,this->jpeg_buffer_size,this->resolution);
+    if(this->luma_sampler){
+        auto scale = this->motion[0].scale;
+        this->luma_sampler = std::make_unique<LumaSampler>(
+                std::max(this->resolution.width() / scale,16u),
+                std::max(this->resolution.height() / scale,16u));
+    }
+}
+
+bool JpegStream::capture_writes(){
+    return true;
+}
+
+void JpegStream::warm_up(){
+    auto frames = ArgusStream::next(false);
+    if(this->luma_sampler){
+        this->luma_sampler->sample(frames[0].dma_buffer,this->luma);
+    }
+    warm_up_encoder(this->nv.get(),frames[0].dma_buffer,this->jpeg_buffer,this->jpeg_buffer_size);
+    this->warm_up_previews(frames);
+}
+
+std::vector<JpegStreamOutput> JpegStream::capture(bool skip){
     auto frames = ArgusStream::next(skip);
     std::vector<JpegStreamOutput> res;
     for(uint32_t i = 0;i < this->cameras.size();i++){
-        if(!skip){
+        INTERVAL_FLOW(frame_flow(i,frames[i].number));
+        float motion = 0.0;
+        bool written = false;
+        // A repeated frame of a slower capture group was already handled when it was captured.
+        bool encode = !skip && frames[i].fresh;
+        if(encode && frames[i].sharpness < this->sharpness_threshold){
+            encode = false;
+        }
+        if(encode && this->luma_sampler){
+            INTERVAL(motion);
+            auto motion_start = std::chrono::steady_clock::now();
+            this->luma_sampler->sample(frames[i].dma_buffer,this->luma);
+            encode = this->motion[i].check(this->luma,frames[i].time_stamp,motion);
+            INTERVAL_END(motion);
+            this->stage_latency[Stage::Motion].record_since(motion_start);
+        }
+        // Within a window only frames sharper than the best frame so far are encoded.
+        if(encode && this->sharpness_window > 1 && frames[i].sharpness <= this->windows[i].best){
+            encode = false;
+        }
+        if(encode){
             unsigned long buffer_size = this->jpeg_buffer_size;
+            INTERVAL(encode);
+            auto encode_start = std::chrono::steady_clock::now();
             auto ret = this->nv->encodeFromFd(frames[i].dma_buffer, JCS_YCbCr, &this->jpeg_buffer,buffer_size,90);
             if(ret < 0){
                 throw std::runtime_error("failed to encode jpeg");
             }
+            INTERVAL_END(encode);
+            this->stage_latency[Stage::Encode].record_since(encode_start);
+            this->counters.encoded_frames.fetch_add(1,std::memory_order_relaxed);
+            this->counters.encoded_bytes.fetch_add(buffer_size,std::memory_order_relaxed);
             if(buffer_size > this->jpeg_buffer_size){
                 this->jpeg_buffer_size = buffer_size;
             }
-            std::string file_name(std::to_string(frames[i].number));
-            file_name.append(".jpg");
-            std::fstream s(this->directories[i] / file_name, s.binary | s.trunc | s.out);
-            s.write((char *)this->jpeg_buffer,buffer_size);
-            s.flush();
-            s.close();
+            if(this->sharpness_window > 1){
+                auto & window = this->windows[i];
+                window.best = frames[i].sharpness;
+                window.number = frames[i].number;
+                window.time_stamp = frames[i].time_stamp;
+                window.jpeg.assign(this->jpeg_buffer,this->jpeg_buffer + buffer_size);
+            }else{
+                this->output(i,frames[i].number,frames[i].time_stamp,this->jpeg_buffer,buffer_size);
+                written = true;
+            }
+        }
+        if(!skip && frames[i].fresh && this->sharpness_window > 1){
+            auto & window = this->windows[i];
+            window.count += 1;
+            if(window.count >= this->sharpness_window){
+                written = window.best >= 0.0;
+                if(written){
+                    this->output(i,window.number,window.time_stamp,window.jpeg.data(),window.jpeg.size());
+                }
+                window.count = 0;
+                window.best = -1.0;
+            }
         }
 
         res.push_back({
                 frames[i].number,
                 frames[i].time_stamp,
+                motion,
+                encode,
+                written,
+                frames[i].sharpness,
+                frames[i].settings_id,
+                frames[i].metadata,
+                frames[i].preview,
+                frames[i].fresh,
         });
     }
     return res;
 }
 
+void JpegStream::flush_windows(){
+    for(size_t i = 0;i < this->windows.size();i++){
+        auto & window = this->windows[i];
+        if(window.best >= 0.0){
+            this->output(i,window.number,window.time_stamp,window.jpeg.data(),window.jpeg.size());
+        }
+        window.count = 0;
+        window.best = -1.0;
+    }
+}
+
+void JpegStream::trigger(double pre_seconds, double post_seconds){
+    if(!this->preroll){
+        throw std::runtime_error("trigger requires the stream to be created with a preroll");
+    }
+    this->preroll->trigger(pre_seconds,post_seconds);
+}
+
+PrerollStats JpegStream::preroll_stats(){
+    if(!this->preroll){
+        return PrerollStats{};
+    }
+    return this->preroll->stats();
+}
+
+StagingStats JpegStream::staging_stats(){
+    if(!this->staging){
+        return StagingStats{};
+    }
+    return this->staging->stats();
+}
+
 JpegStream::~JpegStream(){
+    this->close();
     delete[] this->jpeg_buffer;
 }
 
@@ -64,25 +306,64 @@ JpegBytesStream::JpegBytesStream(
         std::pair<uint32_t,uint32_t> resolution, 
         float fps, 
         std::optional<uint32_t> mode,
-        std::optional<std::unordered_map<std::string,double>> settings
+        std::optional<std::unordered_map<std::string,double>> settings,
+        std::optional<std::unordered_map<std::string,double>> sharpness,
+        std::optional<std::unordered_map<std::string,std::unordered_map<std::string,double>>> camera_config,
+        std::optional<std::unordered_map<std::string,double>> preview,
+        bool metadata,
+        bool warmup
         )
-    : ArgusStream(cameras,resolution,fps,mode,settings),
+    : FrameStream(cameras,resolution,fps,mode,settings,camera_config),
     nv(NvJPEGEncoder::createJPEGEncoder("nvjpegjepture"))
 {
     this->jpeg_buffer_size = this->resolution.width() * this->resolution.height() * 3 / 2;
     this->jpeg_buffer = new unsigned char[this->jpeg_buffer_size];
+    if(sharpness){
+        this->enable_sharpness(config_value(*sharpness,"sharpness","scale",4.0,1.0,64.0));
+    }
+    if(preview){
+        this->enable_preview(Size2D<uint32_t>(
+                config_value(*preview,"preview","width",640.0,16.0,65536.0),
+                config_value(*preview,"preview","height",360.0,16.0,65536.0)));
+    }
+    if(metadata){
+        this->enable_metadata();
+    }
+    if(warmup){
+        this->start(true);
+    }
+    register_metrics(this);
+}
+
+void JpegBytesStream::resized(){
+    reserve_jpeg_buffer(this->jpeg_buffer,this->jpeg_buffer_size,this->resolution);
 }
 
-std::vector<JpegBytesStreamOutput> JpegBytesStream::next(bool skip = false){
+void JpegBytesStream::warm_up(){
+    auto frames = ArgusStream::next(false);
+    warm_up_encoder(this->nv.get(),frames[0].dma_buffer,this->jpeg_buffer,this->jpeg_buffer_size);
+    this->warm_up_previews(frames);
+}
+
+std::vector<JpegBytesStreamOutput> JpegBytesStream::capture(bool skip){
     auto frames = ArgusStream::next(skip);
     std::vector<JpegBytesStreamOutput> res;
     for(uint32_t i = 0;i < this->cameras.size();i++){
-        unsigned long buffer_size = this->jpeg_buffer_size;
-        if(!skip){
+        // Skipped and repeated frames are returned without an image.
+        bool encode = !skip && frames[i].fresh;
+        unsigned long buffer_size = encode ? this->jpeg_buffer_size : 0;
+        if(encode){
+            INTERVAL_FLOW(frame_flow(i,frames[i].number));
+            INTERVAL(encode);
+            auto encode_start = std::chrono::steady_clock::now();
             auto ret = this->nv->encodeFromFd(frames[i].dma_buffer, JCS_YCbCr, &this->jpeg_buffer,buffer_size,90);
             if(ret < 0){
                 throw std::runtime_error("failed to encode jpeg");
             }
+            INTERVAL_END(encode);
+            this->stage_latency[Stage::Encode].record_since(encode_start);
+            this->counters.encoded_frames.fetch_add(1,std::memory_order_relaxed);
+            this->counters.encoded_bytes.fetch_add(buffer_size,std::memory_order_relaxed);
             if(buffer_size > this->jpeg_buffer_size){
                 this->jpeg_buffer_size = buffer_size;
             }
@@ -91,12 +372,23 @@ std::vector<JpegBytesStreamOutput> JpegBytesStream::next(bool skip = false){
         res.push_back({
                 frames[i].number,
                 frames[i].time_stamp,
-                std::string((char *)this->jpeg_buffer,buffer_size)
+                std::string((char *)this->jpeg_buffer,buffer_size),
+                frames[i].sharpness,
+                frames[i].settings_id,
+                frames[i].metadata,
+                frames[i].preview,
+                frames[i].fresh
         });
     }
     return res;
 }
 
+void JpegBytesStream::metrics(std::vector<Metric> & out, bool gauges){
+    FrameStream::metrics(out,gauges);
+    encode_metrics(this->counters,out);
+}
+
 JpegBytesStream::~JpegBytesStream(){
+    this->close();
     delete[] this->jpeg_buffer;
 }
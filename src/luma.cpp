@@ -0,0 +1,131 @@
+#include "luma.hpp"
+#include "config.hpp"
+
+#include <algorithm>
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+uint64_t luma_sad(const uint8_t * a, const uint8_t * b, size_t size){
+    uint64_t sum = 0;
+    size_t i = 0;
+#if defined(__ARM_NEON) && defined(__aarch64__)
+    // 16 bit lanes can hold 128 absolute differences before widening.
+    while(i + 16 <= size){
+        size_t block = size - i < 16 * 128 ? (size - i) / 16 * 16 : 16 * 128;
+        uint16x8_t acc = vdupq_n_u16(0);
+        for(size_t end = i + block;i < end;i += 16){
+            uint8x16_t diff = vabdq_u8(vld1q_u8(a + i),vld1q_u8(b + i));
+            acc = vpadalq_u8(acc,diff);
+        }
+        sum += vaddlvq_u16(acc);
+    }
+#elif defined(__SSE2__)
+    __m128i acc = _mm_setzero_si128();
+    for(;i + 16 <= size;i += 16){
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+        acc = _mm_add_epi64(acc,_mm_sad_epu8(va,vb));
+    }
+    sum += (uint64_t)_mm_cvtsi128_si64(acc) + (uint64_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(acc,acc));
+#endif
+    for(;i < size;i++){
+        sum += a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+    }
+    return sum;
+}
+
+double luma_laplacian_variance(const uint8_t * data, uint32_t width, uint32_t height, size_t pitch){
+    if(width < 3 || height < 3){
+        return 0.0;
+    }
+    int64_t sum = 0;
+    uint64_t sum_sq = 0;
+    for(uint32_t y = 1;y + 1 < height;y++){
+        const uint8_t * up = data + (y - 1) * pitch;
+        const uint8_t * row = up + pitch;
+        const uint8_t * down = row + pitch;
+        uint32_t x = 1;
+        // Each block is small enough that the 32 bit lanes of squares can not overflow.
+        while(x + 9 <= width){
+            uint32_t end = std::min(x + 1024,width - 8);
+#if defined(__ARM_NEON) && defined(__aarch64__)
+            int32x4_t acc = vdupq_n_s32(0);
+            int32x4_t acc_sq = vdupq_n_s32(0);
+            for(;x < end;x += 8){
+                int16x8_t center = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(row + x)));
+                uint16x8_t cross = vaddl_u8(vld1_u8(up + x),vld1_u8(down + x));
+                cross = vaddw_u8(cross,vld1_u8(row + x - 1));
+                cross = vaddw_u8(cross,vld1_u8(row + x + 1));
+                int16x8_t lap = vsubq_s16(vreinterpretq_s16_u16(cross),vshlq_n_s16(center,2));
+                acc = vpadalq_s16(acc,lap);
+                acc_sq = vmlal_s16(acc_sq,vget_low_s16(lap),vget_low_s16(lap));
+                acc_sq = vmlal_high_s16(acc_sq,lap,lap);
+            }
+            sum += vaddlvq_s32(acc);
+            sum_sq += vaddlvq_u32(vreinterpretq_u32_s32(acc_sq));
+#elif defined(__SSE2__)
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i ones = _mm_set1_epi16(1);
+            __m128i acc = _mm_setzero_si128();
+            __m128i acc_sq = _mm_setzero_si128();
+            for(;x < end;x += 8){
+                __m128i center = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row + x)),zero);
+                __m128i cross = _mm_add_epi16(
+                        _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(up + x)),zero),
+                        _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(down + x)),zero));
+                cross = _mm_add_epi16(cross,_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row + x - 1)),zero));
+                cross = _mm_add_epi16(cross,_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row + x + 1)),zero));
+                __m128i lap = _mm_sub_epi16(cross,_mm_slli_epi16(center,2));
+                acc = _mm_add_epi32(acc,_mm_madd_epi16(lap,ones));
+                acc_sq = _mm_add_epi32(acc_sq,_mm_madd_epi16(lap,lap));
+            }
+            alignas(16) int32_t lanes[4];
+            alignas(16) uint32_t lanes_sq[4];
+            _mm_store_si128((__m128i *)lanes,acc);
+            _mm_store_si128((__m128i *)lanes_sq,acc_sq);
+            for(int i = 0;i < 4;i++){
+                sum += lanes[i];
+                sum_sq += lanes_sq[i];
+            }
+#else
+            break;
+#endif
+        }
+        for(;x + 1 < width;x++){
+            int32_t lap = (int32_t)up[x] + down[x] + row[x - 1] + row[x + 1] - 4 * (int32_t)row[x];
+            sum += lap;
+            sum_sq += lap * lap;
+        }
+    }
+    double count = (double)(width - 2) * (double)(height - 2);
+    double mean = (double)sum / count;
+    return (double)sum_sq / count - mean * mean;
+}
+
+MotionGate::MotionGate(std::unordered_map<std::string,double> config){
+    this->threshold = config_value(config,"motion","threshold",4.0,0.0,255.0);
+    this->keep_alive = config_value(config,"motion","keep_alive",0.0,0.0,1e6) * 1e9;
+    this->scale = config_value(config,"motion","scale",8.0,1.0,64.0);
+    this->last_pass = 0;
+}
+
+bool MotionGate::check(const std::vector<uint8_t> & luma, uint64_t time_stamp, float & score){
+    if(this->reference.size() != luma.size()){
+        this->reference = luma;
+        this->last_pass = time_stamp;
+        score = 255.0;
+        return true;
+    }
+    score = (double)luma_sad(luma.data(),this->reference.data(),luma.size()) / (double)luma.size();
+    bool pass = score >= this->threshold
+        || (this->keep_alive != 0 && time_stamp >= this->last_pass + this->keep_alive);
+    if(pass){
+        this->reference = luma;
+        this->last_pass = time_stamp;
+    }
+    return pass;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Sum of absolute differences between two luma planes of `size` bytes.
+uint64_t luma_sad(const uint8_t * a, const uint8_t * b, size_t size);
+
+// Variance of the 4-neighbour laplacian of a luma plane with rows `pitch` bytes apart, a measure
+// of sharpness.
+double luma_laplacian_variance(const uint8_t * data, uint32_t width, uint32_t height, size_t pitch);
+
+/*
+ * Decides whether a frame contains enough motion to be kept.
+ *
+ * The score of a frame is the mean absolute difference per pixel between its
+ * downscaled luma plane and the luma plane of the last frame that passed the gate.
+ *
+ * Supported config values:
+ *  - threshold: minimum score for a frame to pass, in luma levels (default 4).
+ *  - keep_alive: let a frame pass at least every this many seconds, 0 disables (default 0).
+ *  - scale: factor by which the luma plane is downscaled before scoring (default 8).
+ */
+class MotionGate{
+    std::vector<uint8_t> reference;
+    double threshold;
+    uint64_t keep_alive;
+    uint64_t last_pass;
+
+public:
+    uint32_t scale;
+
+    MotionGate(std::unordered_map<std::string,double> config);
+
+    // Scores the frame and returns whether it passes the gate, a passing frame
+    // becomes the new reference.
+    bool check(const std::vector<uint8_t> & luma, uint64_t time_stamp, float & score);
+};
@@ -0,0 +1,51 @@
+#include "jepture.hpp"
+
+#include <cstring>
+
+LumaSampler::LumaSampler(uint32_t width, uint32_t height){
+    this->width = width;
+    this->height = height;
+
+    this->transform_params = {};
+    this->transform_params.transform_flag = NVBUFFER_TRANSFORM_FILTER;
+    this->transform_params.transform_filter = NvBufferTransform_Filter_Smart;
+
+    NvBufferCreateParams create_params;
+    std::memset(&create_params,0,sizeof(NvBufferCreateParams));
+    create_params.width = width;
+    create_params.height = height;
+    create_params.layout = NvBufferLayout_Pitch;
+    create_params.payloadType = NvBufferPayload_SurfArray;
+    create_params.colorFormat = NvBufferColorFormat_YUV420;
+    create_params.nvbuf_tag = NvBufferTag_VIDEO_CONVERT;
+
+    this->dma_buffer = -1;
+    if(NvBufferCreateEx(&this->dma_buffer,&create_params)){
+        throw std::runtime_error("failed to create luma buffer");
+    }
+    if(NvBufferGetParams(this->dma_buffer,&this->params)){
+        throw std::runtime_error("failed to retrieve buffer params");
+    }
+    // The buffer stays mapped for the lifetime of the sampler, it is small.
+    if(NvBufferMemMap(this->dma_buffer,0,NvBufferMem_Read,&this->data)){
+        throw std::runtime_error("failed to map luma buffer");
+    }
+}
+
+LumaSampler::~LumaSampler(){
+    if(this->dma_buffer != -1){
+        NvBufferMemUnMap(this->dma_buffer,0,&this->data);
+        NvBufferDestroy(this->dma_buffer);
+    }
+}
+
+void LumaSampler::sample(int in_dma_buffer, std::vector<uint8_t> & out){
+    if(NvBufferTransform(in_dma_buffer,this->dma_buffer,&this->transform_params)){
+        throw std::runtime_error("failed to downscale luma plane");
+    }
+    NvBufferMemSyncForCpu(this->dma_buffer,0,&this->data);
+    out.resize(this->width * this->height);
+    for(uint32_t i = 0;i < this->height;++i){
+        std::memcpy(out.data() + i * this->width,(uint8_t *)this->data + i * this->params.pitch[0],this->width);
+    }
+}
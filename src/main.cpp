@@ -1,13 +1,416 @@
 #include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
 #include <pybind11/stl.h>
 
 #include "jepture.hpp"
+#include "profile.hpp"
+
+#include <chrono>
+#include <cstring>
 
 #define STRINGIFY(x) #x
 #define MACRO_STRINGIFY(x) STRINGIFY(x)
 
 namespace py = pybind11;
 
+// Wraps an image in a numpy array which shares the memory of the image.
+static py::array_t<uint8_t> image_to_array(const ImageBuffer & image){
+    if(!image.data){
+        return py::array_t<uint8_t>();
+    }
+    auto owner = new std::shared_ptr<uint8_t[]>(image.data);
+    py::capsule clean_up(owner,[](void *owner){
+            delete reinterpret_cast<std::shared_ptr<uint8_t[]> *>(owner);
+    });
+    return py::array_t<uint8_t>(
+            std::array<long int,3>({ (long int)image.height, (long int)image.width, (long int)image.channels }),
+            std::array<long int,3>({ (long int)image.width * image.channels, (long int)image.channels, 1 }),
+            image.data.get(),
+            clean_up );
+}
+
+static py::array_t<FrameRecord> records_to_array(const std::vector<FrameRecord> & records){
+    return py::array_t<FrameRecord>(records.size(),records.data());
+}
+
+// Deletes a stream without holding the GIL. Closing a stream joins its dispatch thread, which
+// needs the GIL to run a python callback and to release the callback when it exits.
+struct StreamDeleter{
+    template<class Stream>
+    void operator()(Stream * stream) const {
+        py::gil_scoped_release release;
+        delete stream;
+    }
+};
+
+template<class Stream>
+using StreamClass = py::class_<Stream,std::unique_ptr<Stream,StreamDeleter>>;
+
+// Adds close, the context manager and the iterator protocol to a stream class.
+template<class Stream>
+static void def_lifecycle(StreamClass<Stream> & cls){
+    cls.def("close",&Stream::close, py::call_guard<py::gil_scoped_release>(),
+                R"pbdoc(
+                    Stops capturing and immediately releases the cameras and all buffers.
+
+                    The stream can not be used after it is closed. Calling close more than once has no effect.
+                )pbdoc")
+        .def("start",&Stream::start, py::arg("warmup") = true, py::call_guard<py::gil_scoped_release>(),
+                R"pbdoc(
+                    Starts capturing without waiting for the first call to next.
+
+                    Parameters
+                    ----------
+                    warmup: bool, optional
+                        Also capture and process one frame which is not returned, so all buffers are allocated
+                        and the first returned frame is as fast as the following ones, (default is True)
+                )pbdoc")
+        .def("reconfigure",&Stream::reconfigure,
+                py::arg("resolution") = std::optional<std::pair<uint32_t,uint32_t>>(),
+                py::arg("fps") = std::optional<float>(),
+                py::arg("mode") = std::optional<uint32_t>(),
+                py::call_guard<py::gil_scoped_release>(),
+                R"pbdoc(
+                    Changes the resolution, frame rate or sensor mode without closing the stream.
+
+                    The capture session and the cameras are kept, only the output streams are recreated when the
+                    resolution changes. Frames captured before are still returned and frame numbers continue. A
+                    running frame callback or async iteration continues with the new configuration.
+
+                    Only the values of the stream are changed: a camera whose `camera_config` sets the resolution
+                    (`width` or `height`), `fps` or `mode` keeps that value.
+
+                    Parameters
+                    ----------
+                    resolution: (int,int), optional
+                        The new capture resolution.
+                    fps: float, optional
+                        The new frame rate, the sensor mode is selected again unless a mode is given.
+                    mode: int, optional
+                        The sensor mode to use.
+                )pbdoc")
+        .def("update_settings",&Stream::update_settings, py::arg("settings"), py::call_guard<py::gil_scoped_release>(),
+                R"pbdoc(
+                    Applies capture settings without interrupting the capture.
+
+                    The settings are validated against the ranges of the sensor mode before any is applied, takes
+                    the same settings as the `settings` argument of the constructor. Frames captured with the new
+                    settings have the returned id as their `settings_id`.
+
+                    Parameters
+                    ----------
+                    settings: dict[str,float]
+                        The settings to change, settings which are not given keep their value.
+
+                    Returns
+                    -------
+                    int
+                        The id of the settings.
+                )pbdoc")
+        .def("sensor_mode_plan",[](Stream & stream, uint32_t camera){ return stream.sensor_mode_plan(camera); }, py::arg("camera") = 0,
+                R"pbdoc(
+                    Returns the ModePlan the sensor mode of the current configuration of a camera was selected with.
+
+                    Parameters
+                    ----------
+                    camera: int, optional
+                        The index of the camera in the stream, (default is 0)
+                )pbdoc")
+        .def("settings_frame",[](Stream & stream, uint32_t id){ return stream.settings_frame(id); }, py::arg("id"),
+                R"pbdoc(
+                    Returns the number of the first frame captured with the settings `id`.
+
+                    Returns None if no frame with the settings was captured yet. Only the latest 64 settings are
+                    remembered.
+                )pbdoc")
+        .def("__enter__",[](py::object self){ return self; })
+        .def("__exit__",[](Stream & stream, py::args){
+                py::gil_scoped_release release;
+                stream.close();
+            })
+        .def("__iter__",[](py::object self){ return self; })
+        .def("__next__",[](Stream & stream){
+                if(stream.is_closed()){
+                    throw py::stop_iteration();
+                }
+                auto res = stream.next(false);
+                // Capture the next frame while python processes this one.
+                stream.prefetch();
+                return res;
+            }, py::call_guard<py::gil_scoped_release>(),
+                R"pbdoc(
+                    Returns the next frame, the frame after it is captured in the background.
+                )pbdoc");
+}
+
+template<class Stream>
+static void def_latency(StreamClass<Stream> & cls){
+    cls.def("latency",[](Stream & stream, bool reset){
+                std::vector<std::pair<Stage,LatencySummary>> summaries;
+                {
+                    py::gil_scoped_release release;
+                    for(size_t i = 0;i < (size_t)Stage::Count;i++){
+                        summaries.emplace_back((Stage)i,stream.latency((Stage)i,reset));
+                    }
+                }
+                py::dict res;
+                for(auto & [stage,summary]: summaries){
+                    if(summary.count == 0){
+                        continue;
+                    }
+                    py::dict entry;
+                    entry["count"] = summary.count;
+                    entry["p50"] = summary.p50 * 1e-9;
+                    entry["p90"] = summary.p90 * 1e-9;
+                    entry["p99"] = summary.p99 * 1e-9;
+                    entry["p99.9"] = summary.p999 * 1e-9;
+                    entry["max"] = summary.max * 1e-9;
+                    res[stage_name(stage)] = entry;
+                }
+                return res;
+            }, py::arg("reset") = false,
+                R"pbdoc(
+                    Returns latency histogram percentiles of the pipeline stages of this stream.
+
+                    The latencies are always recorded, with constant memory per stage. The result maps every
+                    stage that ran since the last reset (acquire, copy_to_nvbuffer, sharpness, motion, encode,
+                    transform, map_copy, file_write) to a dict with `count` and the `p50`, `p90`, `p99`,
+                    `p99.9` and `max` latencies in seconds. `end_to_end` is the time from the sensor time stamp
+                    of a frame until it is returned. Percentiles are accurate to about 3%.
+
+                    Parameters
+                    ----------
+                    reset: bool, optional
+                        Start a new window after reading the latencies, (default is False)
+                )pbdoc");
+}
+
+template<class Stream>
+static void def_metrics(StreamClass<Stream> & cls){
+    cls.def("metrics",[](Stream & stream){
+                std::vector<Metric> metrics;
+                {
+                    py::gil_scoped_release release;
+                    metrics = stream.metrics_snapshot();
+                }
+                py::dict res;
+                for(auto & metric: metrics){
+                    if(metric.camera.empty()){
+                        res[py::str(metric.name)] = metric.value;
+                        continue;
+                    }
+                    if(!res.contains(metric.name)){
+                        res[py::str(metric.name)] = py::dict();
+                    }
+                    res[py::str(metric.name)][py::str(metric.camera)] = metric.value;
+                }
+                return res;
+            },
+                R"pbdoc(
+                    Returns a snapshot of the counters and queue depths of this stream.
+
+                    The result maps every metric to its value, per camera metrics (frames_acquired_total,
+                    frames_returned_total and frames_dropped_total) map to a dict from camera name to value.
+                    Queue depths are only included while the stream is open.
+                )pbdoc");
+}
+
+template<class Stream>
+static void def_metadata(StreamClass<Stream> & cls){
+    cls.def("next_metadata",[](Stream & stream, size_t n){
+                std::vector<FrameMetadata> metadata;
+                {
+                    py::gil_scoped_release release;
+                    stream.next_metadata(n,metadata);
+                }
+                return py::array_t<FrameMetadata>(metadata.size(),metadata.data());
+            }, py::arg("n") = 1,
+                R"pbdoc(
+                    Captures the next `n` frame groups without processing them and returns their capture metadata.
+
+                    Requires `metadata=True` and can not be used while frames are awaited or passed to a frame
+                    callback. A frame prepared by prefetch is discarded. Returns a structured numpy array with a
+                    record for every new frame, frames repeated while a slower camera has no new frame are left
+                    out. The records have the fields `camera`, `number`, `exposure_time` and `frame_duration` (ns),
+                    `analog_gain`, `isp_gain`, `scene_lux`, `ae_state` (0 inactive, 1 searching, 2 converged,
+                    3 flash required, 4 timeout), `awb_state` (0 inactive, 1 searching, 2 converged, 3 locked),
+                    `brightness` (mean of the green bayer histogram from 0 to 1), `dark_fraction` and
+                    `clipped_fraction` (fractions of pixels in the lowest and highest histogram bin) and
+                    `isp_sharpness`.
+                )pbdoc");
+}
+
+// Returns an asyncio future for the next frame of the feed of a stream.
+//
+// The eventfd of the feed is registered with the running event loop, so waiting
+// for a frame does not occupy a thread of the loop's executor.
+template<class Stream>
+static py::object async_next(py::object self){
+    auto & stream = self.cast<Stream &>();
+    auto loop = py::module_::import("asyncio").attr("get_running_loop")();
+    auto future = loop.attr("create_future")();
+    if(stream.is_closed()){
+        future.attr("set_exception")(py::module_::import("builtins").attr("StopAsyncIteration")());
+        return future;
+    }
+    int fd;
+    {
+        py::gil_scoped_release release;
+        fd = stream.start_feed();
+    }
+    // Settles the future if a frame is queued, returns whether the future is done.
+    auto deliver = [self, future]() -> bool {
+        if(future.attr("done")().cast<bool>()){
+            return true;
+        }
+        auto & stream = self.cast<Stream &>();
+        decltype(stream.next(false)) frames;
+        try{
+            if(!stream.poll(frames)){
+                return false;
+            }
+        }catch(const std::exception & e){
+            auto builtins = py::module_::import("builtins");
+            if(stream.is_closed()){
+                future.attr("set_exception")(builtins.attr("StopAsyncIteration")());
+            }else{
+                future.attr("set_exception")(builtins.attr("RuntimeError")(e.what()));
+            }
+            return true;
+        }
+        future.attr("set_result")(py::cast(std::move(frames)));
+        return true;
+    };
+    if(!deliver()){
+        loop.attr("add_reader")(fd,py::cpp_function([deliver, loop, fd](){
+            if(deliver()){
+                loop.attr("remove_reader")(fd);
+            }
+        }));
+    }
+    return future;
+}
+
+// A feed of consecutive numbers which needs no cameras, bound as `_SyntheticFeed` to test the
+// asynchronous interface. Every number takes `interval_ms` to produce, after `count` numbers
+// the producer throws `error`.
+class SyntheticFeed{
+    std::atomic<bool> closed;
+    uint64_t next_number;
+    FrameFeed<uint64_t> feed;
+
+public:
+    SyntheticFeed(uint64_t count, double interval_ms, std::string error)
+        : closed(false), next_number(0), feed([this,count,interval_ms,error]{
+            std::this_thread::sleep_for(std::chrono::duration<double,std::milli>(interval_ms));
+            if(this->next_number == count){
+                throw std::runtime_error(error);
+            }
+            return this->next_number++;
+        })
+    {
+    }
+
+    bool is_closed(){
+        return this->closed;
+    }
+
+    int start_feed(){
+        return this->feed.start();
+    }
+
+    bool poll(uint64_t & out){
+        return this->feed.try_pop(out);
+    }
+
+    uint64_t next(bool){
+        this->feed.start();
+        return this->feed.pop();
+    }
+
+    void close(){
+        this->closed = true;
+        this->feed.stop();
+    }
+};
+
+// Keeps a python object alive from threads which do not hold the GIL.
+static std::shared_ptr<py::object> keep_alive(py::object object){
+    return std::shared_ptr<py::object>(new py::object(std::move(object)),[](py::object * object){
+        py::gil_scoped_acquire acquire;
+        delete object;
+    });
+}
+
+// Registers a python callable or a capsule holding a FrameCallback as frame callback.
+template<class Stream>
+static void on_frame(Stream & stream, py::object callback, size_t batch){
+    if(py::isinstance<py::capsule>(callback)){
+        auto capsule = callback.cast<py::capsule>();
+        auto function = (FrameCallback)PyCapsule_GetPointer(capsule.ptr(),"jepture.frame_callback");
+        if(!function){
+            throw py::error_already_set();
+        }
+        void * context = PyCapsule_GetContext(capsule.ptr());
+        auto owner = keep_alive(callback);
+        py::gil_scoped_release release;
+        stream.on_frame([function,context,owner](auto & groups){
+            auto frames = frame_data(groups);
+            function(context,frames.data(),frames.size());
+            return true;
+        },batch);
+        return;
+    }
+    auto owner = keep_alive(callback);
+    py::gil_scoped_release release;
+    stream.on_frame([owner](auto & groups){
+        // The GIL is acquired once for the whole batch.
+        py::gil_scoped_acquire acquire;
+        try{
+            py::object res = (*owner)(py::cast(groups,py::return_value_policy::copy));
+            return res.ptr() != Py_False;
+        }catch(py::error_already_set & e){
+            e.discard_as_unraisable(*owner);
+            return true;
+        }
+    },batch);
+}
+
+// Adds awaiting frames, frame callbacks and the asynchronous iterator protocol to a stream class.
+template<class Stream>
+static void def_async(StreamClass<Stream> & cls){
+    cls.def("anext",&async_next<Stream>,
+                R"pbdoc(
+                    Returns an awaitable which resolves to the next frame.
+
+                    The first call starts capturing frames continuously on a native thread, which signals
+                    the event loop through an eventfd when a frame is ready. Frames are queued up to a
+                    small depth, after that capturing waits for the frames to be taken.
+                    Only one frame should be awaited at a time.
+                )pbdoc")
+        .def("on_frame",&on_frame<Stream>, py::arg("callback"), py::arg("batch") = 1,
+                R"pbdoc(
+                    Captures frames continuously and passes them to `callback` from a native thread.
+
+                    The callback receives a list of `batch` frame groups and is called with the GIL
+                    acquired once per batch. Returning False from the callback stops the callbacks,
+                    they also stop when the stream is closed. Exceptions raised by the callback are
+                    reported as unraisable exceptions. The stream must not be closed from the callback.
+
+                    Parameters
+                    ----------
+                    callback: callable or capsule
+                        A python callable, or a capsule named `jepture.frame_callback` holding a C function
+                        `void (*)(void * context, const FrameData * frames, size_t count)` which is called
+                        without the GIL. The context of the capsule is passed as `context`, `frames` holds
+                        the frames of all cameras of every frame group in the batch.
+                    batch: int, optional
+                        The number of frame groups passed to every call, (default is 1)
+                )pbdoc")
+        .def("__aiter__",[](py::object self){ return self; })
+        .def("__anext__",&async_next<Stream>);
+}
+
 
 PYBIND11_MODULE(jepture, m) {
     m.doc() = R"pbdoc(
@@ -22,17 +425,67 @@ PYBIND11_MODULE(jepture, m) {
            JpegStream
     )pbdoc";
     
+    PYBIND11_NUMPY_DTYPE(FrameRecord, camera, number, time_stamp, drops, offset, size, age_ns);
+    PYBIND11_NUMPY_DTYPE(FrameMetadata, camera, number, exposure_time, frame_duration, analog_gain, isp_gain,
+            scene_lux, ae_state, awb_state, brightness, dark_fraction, clipped_fraction, isp_sharpness);
+
     py::class_<JpegStreamOutput>(m,"JpegStreamOutput")
         .def_readwrite("number",&JpegStreamOutput::number)
-        .def_readwrite("time_stamp",&JpegStreamOutput::time_stamp);
+        .def_readwrite("time_stamp",&JpegStreamOutput::time_stamp)
+        .def_readwrite("motion",&JpegStreamOutput::motion)
+        .def_readwrite("encoded",&JpegStreamOutput::encoded)
+        .def_readwrite("written",&JpegStreamOutput::written)
+        .def_readwrite("sharpness",&JpegStreamOutput::sharpness)
+        .def_readonly("capture_monotonic_ns",&JpegStreamOutput::capture_monotonic_ns)
+        .def_readonly("capture_realtime_ns",&JpegStreamOutput::capture_realtime_ns)
+        .def_readonly("delivery_ns",&JpegStreamOutput::delivery_ns)
+        .def_readonly("age_ns",&JpegStreamOutput::age_ns)
+        .def_readonly("settings_id",&JpegStreamOutput::settings_id)
+        .def_readonly("fresh",&JpegStreamOutput::fresh)
+        .def_property_readonly("preview",[](const JpegStreamOutput & output){ return image_to_array(output.preview); })
+        .def_property_readonly("metadata",[](const JpegStreamOutput & output){
+                return py::object(py::array_t<FrameMetadata>(1,&output.metadata)[py::int_(0)]);
+            });
+
+    py::class_<StagingStats>(m,"StagingStats", R"pbdoc(
+        Counters of the memory staging tier returned by JpegStream.staging_stats().
+    )pbdoc")
+        .def_readonly("staged_bytes",&StagingStats::staged_bytes)
+        .def_readonly("staged_files",&StagingStats::staged_files)
+        .def_readonly("migrated_bytes",&StagingStats::migrated_bytes)
+        .def_readonly("migrated_files",&StagingStats::migrated_files)
+        .def_readonly("dropped_bytes",&StagingStats::dropped_bytes)
+        .def_readonly("dropped_files",&StagingStats::dropped_files)
+        .def_readonly("failed_writes",&StagingStats::failed_writes)
+        .def_readonly("migration_lag_ns",&StagingStats::migration_lag_ns)
+        .def_readonly("dropping",&StagingStats::dropping);
 
-    py::class_<JpegStream>(m,"JpegStream", R"pbdoc(
+    py::class_<PrerollStats>(m,"PrerollStats", R"pbdoc(
+        Counters of the preroll returned by JpegStream.preroll_stats().
+    )pbdoc")
+        .def_readonly("buffered_frames",&PrerollStats::buffered_frames)
+        .def_readonly("buffered_bytes",&PrerollStats::buffered_bytes)
+        .def_readonly("written_frames",&PrerollStats::written_frames)
+        .def_readonly("lost_frames",&PrerollStats::lost_frames)
+        .def_readonly("dropped_frames",&PrerollStats::dropped_frames)
+        .def_readonly("recording",&PrerollStats::recording);
+
+    StreamClass<JpegStream> jpeg_stream(m,"JpegStream", R"pbdoc(
                 A stream of jpegs.
 
                 Encodes and then writes frame directly to disk as jpeg files using nvidia's gpu accelerated jpeg encoder.
-            )pbdoc")
-        .def(py::init<std::vector<std::tuple<uint32_t,std::string> > , std::pair<uint32_t,uint32_t> , float , std::optional<uint32_t>,std::optional<std::unordered_map<std::string,double>>,  std::string >(),
+            )pbdoc");
+    jpeg_stream
+        .def(py::init<std::vector<std::tuple<uint32_t,std::string> > , std::pair<uint32_t,uint32_t> , float , std::optional<uint32_t>,std::optional<std::unordered_map<std::string,double>>,  std::string, std::optional<std::unordered_map<std::string,double>>, std::optional<std::unordered_map<std::string,double>>, std::optional<std::unordered_map<std::string,double>>, std::optional<std::unordered_map<std::string,double>>, std::optional<std::unordered_map<std::string,std::unordered_map<std::string,double>>>, std::optional<std::unordered_map<std::string,double>>, bool, bool >(),
                 py::arg("cameras"), py::arg("resolution"), py::arg("fps"), py::arg("mode") = std::optional<uint32_t>(),py::arg("settings") = std::optional<std::unordered_map<std::string,double>>() ,py::arg("image_dir") = "./data",
+                py::arg("staging") = std::optional<std::unordered_map<std::string,double>>(),
+                py::arg("preroll") = std::optional<std::unordered_map<std::string,double>>(),
+                py::arg("motion") = std::optional<std::unordered_map<std::string,double>>(),
+                py::arg("sharpness") = std::optional<std::unordered_map<std::string,double>>(),
+                py::arg("camera_config") = std::optional<std::unordered_map<std::string,std::unordered_map<std::string,double>>>(),
+                py::arg("preview") = std::optional<std::unordered_map<std::string,double>>(),
+                py::arg("metadata") = false,
+                py::arg("warmup") = false,
                 R"pbdoc(
                     Parameters
                     ----------
@@ -47,8 +500,47 @@ PYBIND11_MODULE(jepture, m) {
                         A sensor mode to use. If empty the implementation will select a sensor mode based on the target fps.
                     image_dir: str, optional
                         The directory to write the jpeg files to, (default is './data')
+                    staging: dict, optional
+                        Stage encoded jpegs in memory and migrate them to `image_dir` in the background.
+                        Keys are `budget` (bytes), `rate` (bytes per second, 0 is unlimited),
+                        `high_watermark` and `low_watermark` (fractions of the budget) and
+                        `drop` (0 drops new frames, 1 drops the oldest staged frames when full).
+                    preroll: dict, optional
+                        Keep the last encoded frames of every camera in memory instead of writing them.
+                        Frames are only written after a call to `trigger`.
+                        Keys are `seconds` (length of the preroll, default 5), `bytes` (memory per camera)
+                        and `frames` (maximum number of frames per camera).
+                    motion: dict, optional
+                        Only encode frames which differ enough from the last encoded frame.
+                        Keys are `threshold` (mean absolute luma difference, default 4),
+                        `keep_alive` (encode a frame at least every this many seconds, default never)
+                        and `scale` (downscale factor of the luma plane, default 8).
+                    sharpness: dict, optional
+                        Score the sharpness of every frame as the variance of the laplacian of the downscaled luma plane.
+                        Keys are `scale` (downscale factor of the luma plane, default 4),
+                        `threshold` (frames with a lower score are not written, default 0)
+                        and `window` (only write the sharpest frame of every window of this many frames, default 1).
+                        The sharpest frame of the last, incomplete window is written when the stream is closed.
+                    camera_config: dict, optional
+                        Configuration of individual cameras keyed by camera name. Keys are `width`, `height`, `fps` and
+                        `mode`, which override the arguments of the stream, any other key is a capture setting. Cameras
+                        with the same configuration share a capture session. The cameras which share the session of the
+                        first camera pace the stream, cameras of other sessions return their newest frame or repeat their
+                        last frame with `fresh` set to False.
+                        The keys `roi_x`, `roi_y`, `roi_width` and `roi_height` select a region of interest in pixels of
+                        the frame, the camera returns only this region and every later stage works on its size.
+                    preview: dict, optional
+                        Capture a second, smaller output of every camera from the same exposures, returned as a BGRA
+                        array in `preview` of every frame. Keys are `width` (default 640) and `height` (default 360).
+                        The preview is empty for a frame whose capture has no preview frame.
+                    metadata: bool, optional
+                        Read the capture metadata of every frame, returned as the `metadata` record of frames and
+                        by next_metadata, (default is False)
+                    warmup: bool, optional
+                        Start capturing in the constructor and process one frame which is not returned, so the
+                        first frame returned by next is as fast as the following ones, (default is False)
                 )pbdoc")
-        .def("next",&JpegStream::next, py::arg("skip") = false,
+        .def("next",&JpegStream::next, py::arg("skip") = false, py::call_guard<py::gil_scoped_release>(),
                 R"pbdoc(
                     Captures the next frame
 
@@ -57,21 +549,84 @@ PYBIND11_MODULE(jepture, m) {
                     Parameters
                     ----------
                     skip: bool, optional
-                        Skip writing the next frame
+                        Skip writing the next frame. A frame prepared by prefetch was already written, it is
+                        returned as a written frame instead of being skipped. Frames which are awaited or passed
+                        to a frame callback are always processed, skip has no effect for them.
+                )pbdoc")
+        .def("trigger",&JpegStream::trigger, py::arg("pre_seconds"), py::arg("post_seconds"),
+                R"pbdoc(
+                    Writes the preroll frames of the last `pre_seconds` and keeps writing frames for the next `post_seconds`.
+
+                    Frames are written from a background thread, this function does not wait for the writes.
+                    Calling trigger while a previous window is still being recorded extends that window.
+                    For a camera without a buffered frame yet, the window is placed around its next frame.
+
+                    Parameters
+                    ----------
+                    pre_seconds: float
+                        The number of seconds before the latest frame to write.
+                    post_seconds: float
+                        The number of seconds after the latest frame to keep writing.
+                )pbdoc")
+        .def("preroll_stats",&JpegStream::preroll_stats,
+                R"pbdoc(
+                    Returns the counters of the preroll, all zero if the preroll is not enabled.
+                )pbdoc")
+        .def("staging_stats",&JpegStream::staging_stats,
+                R"pbdoc(
+                    Returns the counters of the staging tier, all zero if staging is not enabled.
+                )pbdoc");
+    jpeg_stream
+        .def("next_many",[](JpegStream & stream, size_t n){
+                std::vector<FrameRecord> records;
+                {
+                    py::gil_scoped_release release;
+                    stream.next_many(n,records);
+                }
+                return records_to_array(records);
+            }, py::arg("n"),
+                R"pbdoc(
+                    Captures the next `n` frame groups in one call.
+
+                    Returns a structured numpy array with a record for every frame, with the fields
+                    `camera`, `number`, `time_stamp`, `drops` (frames missed since the previous frame of the
+                    camera returned by next_many), `offset`, `size` and `age_ns`.
                 )pbdoc");
+    def_lifecycle(jpeg_stream);
+    def_async(jpeg_stream);
+    def_latency(jpeg_stream);
+    def_metrics(jpeg_stream);
+    def_metadata(jpeg_stream);
 
     py::class_<JpegBytesStreamOutput>(m,"JpegBytesStreamOutput")
         .def_readwrite("number",&JpegBytesStreamOutput::number)
         .def_readwrite("time_stamp",&JpegBytesStreamOutput::time_stamp)
-        .def_readwrite("bytes",&JpegBytesStreamOutput::bytes);
+        .def_property_readonly("bytes",[](const JpegBytesStreamOutput & output){ return py::bytes(output.bytes); })
+        .def_readwrite("sharpness",&JpegBytesStreamOutput::sharpness)
+        .def_readonly("capture_monotonic_ns",&JpegBytesStreamOutput::capture_monotonic_ns)
+        .def_readonly("capture_realtime_ns",&JpegBytesStreamOutput::capture_realtime_ns)
+        .def_readonly("delivery_ns",&JpegBytesStreamOutput::delivery_ns)
+        .def_readonly("age_ns",&JpegBytesStreamOutput::age_ns)
+        .def_readonly("settings_id",&JpegBytesStreamOutput::settings_id)
+        .def_readonly("fresh",&JpegBytesStreamOutput::fresh)
+        .def_property_readonly("preview",[](const JpegBytesStreamOutput & output){ return image_to_array(output.preview); })
+        .def_property_readonly("metadata",[](const JpegBytesStreamOutput & output){
+                return py::object(py::array_t<FrameMetadata>(1,&output.metadata)[py::int_(0)]);
+            });
 
-    py::class_<JpegBytesStream>(m,"JpegBytesStream", R"pbdoc(
+    StreamClass<JpegBytesStream> jpeg_bytes_stream(m,"JpegBytesStream", R"pbdoc(
                 A stream of jpegs.
 
                 Encodes and then writes returns the bytes of the encoded jpeg.
-            )pbdoc")
-        .def(py::init<std::vector<std::tuple<uint32_t,std::string> > , std::pair<uint32_t,uint32_t> , float , std::optional<uint32_t>,std::optional<std::unordered_map<std::string,double>>>(),
+            )pbdoc");
+    jpeg_bytes_stream
+        .def(py::init<std::vector<std::tuple<uint32_t,std::string> > , std::pair<uint32_t,uint32_t> , float , std::optional<uint32_t>,std::optional<std::unordered_map<std::string,double>>, std::optional<std::unordered_map<std::string,double>>, std::optional<std::unordered_map<std::string,std::unordered_map<std::string,double>>>, std::optional<std::unordered_map<std::string,double>>, bool, bool>(),
                 py::arg("cameras"), py::arg("resolution"), py::arg("fps"), py::arg("mode") = std::optional<uint32_t>(),py::arg("settings") = std::optional<std::unordered_map<std::string,double>>(),
+                py::arg("sharpness") = std::optional<std::unordered_map<std::string,double>>(),
+                py::arg("camera_config") = std::optional<std::unordered_map<std::string,std::unordered_map<std::string,double>>>(),
+                py::arg("preview") = std::optional<std::unordered_map<std::string,double>>(),
+                py::arg("metadata") = false,
+                py::arg("warmup") = false,
                 R"pbdoc(
                     Parameters
                     ----------
@@ -84,8 +639,28 @@ PYBIND11_MODULE(jepture, m) {
                         The target fps to capture frames at.
                     mode: int, optional
                         A sensor mode to use. If empty the implementation will select a sensor mode based on the target fps.
+                    sharpness: dict, optional
+                        Score the sharpness of every frame, the only key is `scale` (downscale factor of the luma plane, default 4).
+                    camera_config: dict, optional
+                        Configuration of individual cameras keyed by camera name. Keys are `width`, `height`, `fps` and
+                        `mode`, which override the arguments of the stream, any other key is a capture setting. Cameras
+                        with the same configuration share a capture session. The cameras which share the session of the
+                        first camera pace the stream, cameras of other sessions return their newest frame or repeat their
+                        last frame with `fresh` set to False.
+                        The keys `roi_x`, `roi_y`, `roi_width` and `roi_height` select a region of interest in pixels of
+                        the frame, the camera returns only this region and every later stage works on its size.
+                    preview: dict, optional
+                        Capture a second, smaller output of every camera from the same exposures, returned as a BGRA
+                        array in `preview` of every frame. Keys are `width` (default 640) and `height` (default 360).
+                        The preview is empty for a frame whose capture has no preview frame.
+                    metadata: bool, optional
+                        Read the capture metadata of every frame, returned as the `metadata` record of frames and
+                        by next_metadata, (default is False)
+                    warmup: bool, optional
+                        Start capturing in the constructor and process one frame which is not returned, so the
+                        first frame returned by next is as fast as the following ones, (default is False)
                 )pbdoc")
-        .def("next",&JpegBytesStream::next, py::arg("skip") = false,
+        .def("next",&JpegBytesStream::next, py::arg("skip") = false, py::call_guard<py::gil_scoped_release>(),
                 R"pbdoc(
                     Captures the next frame
 
@@ -94,8 +669,38 @@ PYBIND11_MODULE(jepture, m) {
                     Parameters
                     ----------
                     skip: bool, optional
-                        Skip writing the next frame
+                        Skip writing the next frame, a frame prepared by prefetch is discarded. Frames which are
+                        awaited or passed to a frame callback are always processed, skip has no effect for them.
                 )pbdoc");
+    jpeg_bytes_stream
+        .def("next_many",[](JpegBytesStream & stream, size_t n){
+                std::vector<FrameRecord> records;
+                std::string bytes;
+                {
+                    py::gil_scoped_release release;
+                    auto groups = stream.next_many(n,records);
+                    bytes.reserve(records.empty() ? 0 : records.back().offset + records.back().size);
+                    for(auto & group: groups){
+                        for(auto & frame: group){
+                            bytes.append(frame.bytes);
+                        }
+                    }
+                }
+                return py::make_tuple(records_to_array(records),py::bytes(bytes));
+            }, py::arg("n"),
+                R"pbdoc(
+                    Captures the next `n` frame groups in one call.
+
+                    Returns a tuple of a structured numpy array with a record for every frame and the
+                    concatenated jpegs of all frames. A jpeg is located in the bytes by the `offset` and `size`
+                    fields of its record, the other fields are `camera`, `number`, `time_stamp`, `age_ns` and
+                    `drops` (frames missed since the previous frame of the camera returned by next_many).
+                )pbdoc");
+    def_lifecycle(jpeg_bytes_stream);
+    def_async(jpeg_bytes_stream);
+    def_latency(jpeg_bytes_stream);
+    def_metrics(jpeg_bytes_stream);
+    def_metadata(jpeg_bytes_stream);
 
 
 
@@ -104,13 +709,30 @@ PYBIND11_MODULE(jepture, m) {
     )pbdoc")
         .def_readwrite("number",&NumpyStreamOutput::number)
         .def_readwrite("time_stamp",&NumpyStreamOutput::time_stamp)
-        .def_readwrite("array",&NumpyStreamOutput::array);
+        .def_property_readonly("array",[](const NumpyStreamOutput & output){ return image_to_array(output.image); })
+        .def_readwrite("sharpness",&NumpyStreamOutput::sharpness)
+        .def_readonly("capture_monotonic_ns",&NumpyStreamOutput::capture_monotonic_ns)
+        .def_readonly("capture_realtime_ns",&NumpyStreamOutput::capture_realtime_ns)
+        .def_readonly("delivery_ns",&NumpyStreamOutput::delivery_ns)
+        .def_readonly("age_ns",&NumpyStreamOutput::age_ns)
+        .def_readonly("settings_id",&NumpyStreamOutput::settings_id)
+        .def_readonly("fresh",&NumpyStreamOutput::fresh)
+        .def_property_readonly("preview",[](const NumpyStreamOutput & output){ return image_to_array(output.preview); })
+        .def_property_readonly("metadata",[](const NumpyStreamOutput & output){
+                return py::object(py::array_t<FrameMetadata>(1,&output.metadata)[py::int_(0)]);
+            });
 
-    py::class_<NumpyStream>(m,"NumpyStream", R"pbdoc(
+    StreamClass<NumpyStream> numpy_stream(m,"NumpyStream", R"pbdoc(
                 A stream of numpy arrays containing a image in ABGR format.
-            )pbdoc")
-        .def(py::init<std::vector<std::tuple<uint32_t,std::string> > , std::pair<uint32_t,uint32_t> , float , std::optional<uint32_t>, std::optional<std::unordered_map<std::string,double>>>(),
+            )pbdoc");
+    numpy_stream
+        .def(py::init<std::vector<std::tuple<uint32_t,std::string> > , std::pair<uint32_t,uint32_t> , float , std::optional<uint32_t>, std::optional<std::unordered_map<std::string,double>>, std::optional<std::unordered_map<std::string,double>>, std::optional<std::unordered_map<std::string,std::unordered_map<std::string,double>>>, std::optional<std::unordered_map<std::string,double>>, bool, bool>(),
                 py::arg("cameras"), py::arg("resolution"), py::arg("fps"), py::arg("mode") = std::optional<uint32_t>(),py::arg("settings") = std::optional<std::unordered_map<std::string,double>>(),
+                py::arg("sharpness") = std::optional<std::unordered_map<std::string,double>>(),
+                py::arg("camera_config") = std::optional<std::unordered_map<std::string,std::unordered_map<std::string,double>>>(),
+                py::arg("preview") = std::optional<std::unordered_map<std::string,double>>(),
+                py::arg("metadata") = false,
+                py::arg("warmup") = false,
                 R"pbdoc(
                     Parameters
                     ----------
@@ -123,8 +745,28 @@ PYBIND11_MODULE(jepture, m) {
                         The target fps to capture frames at.
                     mode: int, optional
                         A sensor mode to use. If empty the implementation will select a sensor mode based on the target fps.
+                    sharpness: dict, optional
+                        Score the sharpness of every frame, the only key is `scale` (downscale factor of the luma plane, default 4).
+                    camera_config: dict, optional
+                        Configuration of individual cameras keyed by camera name. Keys are `width`, `height`, `fps` and
+                        `mode`, which override the arguments of the stream, any other key is a capture setting. Cameras
+                        with the same configuration share a capture session. The cameras which share the session of the
+                        first camera pace the stream, cameras of other sessions return their newest frame or repeat their
+                        last frame with `fresh` set to False.
+                        The keys `roi_x`, `roi_y`, `roi_width` and `roi_height` select a region of interest in pixels of
+                        the frame, the camera returns only this region and every later stage works on its size.
+                    preview: dict, optional
+                        Capture a second, smaller output of every camera from the same exposures, returned as a BGRA
+                        array in `preview` of every frame. Keys are `width` (default 640) and `height` (default 360).
+                        The preview is empty for a frame whose capture has no preview frame.
+                    metadata: bool, optional
+                        Read the capture metadata of every frame, returned as the `metadata` record of frames and
+                        by next_metadata, (default is False)
+                    warmup: bool, optional
+                        Start capturing in the constructor and process one frame which is not returned, so the
+                        first frame returned by next is as fast as the following ones, (default is False)
                 )pbdoc")
-        .def("next",&NumpyStream::next, py::arg("skip") = false,
+        .def("next",&NumpyStream::next, py::arg("skip") = false, py::call_guard<py::gil_scoped_release>(),
                 R"pbdoc(
                     Captures the next frame
 
@@ -133,8 +775,331 @@ PYBIND11_MODULE(jepture, m) {
                     Parameters
                     ----------
                     skip: bool, optional
-                        Skips processing the next frame, returned arrays will be empty
+                        Skips processing the next frame, returned arrays will be empty. A frame prepared by
+                        prefetch is discarded. Frames which are awaited or passed to a frame callback are always
+                        processed, skip has no effect for them.
+                )pbdoc");
+    numpy_stream
+        .def("next_many",[](NumpyStream & stream, size_t n){
+                std::vector<FrameRecord> records;
+                ImageBuffer stacked{};
+                size_t cameras = 0;
+                {
+                    py::gil_scoped_release release;
+                    auto groups = stream.next_stacked(n,records,stacked);
+                    cameras = groups.empty() ? 0 : groups[0].size();
+                }
+                if(!stacked.data){
+                    return py::make_tuple(records_to_array(records),py::array_t<uint8_t>());
+                }
+                auto owner = new std::shared_ptr<uint8_t[]>(stacked.data);
+                py::capsule clean_up(owner,[](void *owner){
+                        delete reinterpret_cast<std::shared_ptr<uint8_t[]> *>(owner);
+                });
+                long int frame = (long int)stacked.width * stacked.height * stacked.channels;
+                auto array = py::array_t<uint8_t>(
+                        std::array<long int,5>({ (long int)n, (long int)cameras, (long int)stacked.height, (long int)stacked.width, (long int)stacked.channels }),
+                        std::array<long int,5>({ frame * (long int)cameras, frame, (long int)stacked.width * stacked.channels, (long int)stacked.channels, 1 }),
+                        stacked.data.get(),
+                        clean_up );
+                return py::make_tuple(records_to_array(records),array);
+            }, py::arg("n"),
+                R"pbdoc(
+                    Captures the next `n` frame groups in one call.
+
+                    Returns a tuple of a structured numpy array with a record for every frame and one array
+                    of shape (n, cameras, height, width, 4) with all images. All cameras must have the same
+                    resolution, a repeated frame (see `camera_config`) holds the image of the frame it repeats. The fields of the records are
+                    `camera`, `number`, `time_stamp`, `drops` (frames missed since the previous frame of the
+                    camera returned by next_many), `offset`, `size` and `age_ns`.
                 )pbdoc");
+    def_lifecycle(numpy_stream);
+    def_async(numpy_stream);
+    def_latency(numpy_stream);
+    def_metrics(numpy_stream);
+    def_metadata(numpy_stream);
+
+    py::class_<SyntheticFeed>(m,"_SyntheticFeed", R"pbdoc(
+        A feed of consecutive numbers produced on a native thread, used to test awaiting frames without cameras.
+    )pbdoc")
+        .def(py::init<uint64_t,double,std::string>(), py::arg("count"), py::arg("interval_ms") = 0.0,
+                py::arg("error") = "producer failed")
+        .def("next",&SyntheticFeed::next, py::arg("skip") = false, py::call_guard<py::gil_scoped_release>())
+        .def("close",&SyntheticFeed::close, py::call_guard<py::gil_scoped_release>())
+        .def("anext",&async_next<SyntheticFeed>)
+        .def("__aiter__",[](py::object self){ return self; })
+        .def("__anext__",&async_next<SyntheticFeed>);
+
+    m.def("motion_score",[](py::array_t<uint8_t, py::array::c_style | py::array::forcecast> a, py::array_t<uint8_t, py::array::c_style | py::array::forcecast> b){
+                if(a.size() != b.size()){
+                    throw std::runtime_error("luma planes must have the same size");
+                }
+                if(a.size() == 0){
+                    return 0.0;
+                }
+                uint64_t sad;
+                {
+                    py::gil_scoped_release release;
+                    sad = luma_sad(a.data(),b.data(),a.size());
+                }
+                return (double)sad / (double)a.size();
+            }, py::arg("a"), py::arg("b"),
+            R"pbdoc(
+                Computes the motion score used by the motion gate of JpegStream.
+
+                Returns the mean absolute difference between two luma planes, which makes
+                it possible to tune thresholds and benchmark the kernel on synthetic frames.
+
+                Parameters
+                ----------
+                a: numpy.ndarray
+                    A uint8 luma plane.
+                b: numpy.ndarray
+                    A uint8 luma plane of the same size.
+            )pbdoc");
+
+    m.def("sharpness_score",[](py::array_t<uint8_t, py::array::c_style | py::array::forcecast> luma){
+                if(luma.ndim() != 2){
+                    throw std::runtime_error("luma plane must be a two dimensional array");
+                }
+                py::gil_scoped_release release;
+                return luma_laplacian_variance(luma.data(),luma.shape(1),luma.shape(0),luma.strides(0));
+            }, py::arg("luma"),
+            R"pbdoc(
+                Computes the sharpness score used by the streams on a luma plane.
+
+                Returns the variance of the laplacian of a two dimensional uint8 array.
+            )pbdoc");
+
+    m.def("enable_profiling",[](bool enabled, size_t ring_size){
+                RapidProfile::api<RAPID_PROFILE_STR_SIZE>::set_ring_size(ring_size);
+                RapidProfile::api<RAPID_PROFILE_STR_SIZE>::enable(enabled);
+            }, py::arg("enabled") = true, py::arg("ring_size") = RAPID_PROFILE_RING_SIZE,
+            R"pbdoc(
+                Starts or stops timing the stages of the capture pipeline.
+
+                Profiling is disabled by default, it can be enabled and disabled while streams are running.
+                Every thread records its timings into its own buffer without locking, a background thread
+                collects them.
+
+                Parameters
+                ----------
+                enabled: bool, optional
+                    Whether to record timings, (default is True)
+                ring_size: int, optional
+                    The number of timings kept, older timings are overwritten. 0 keeps all timings.
+            )pbdoc");
+
+    m.def("profile_stats",[](bool reset){
+                std::vector<RapidProfile::stat> stats;
+                {
+                    py::gil_scoped_release release;
+                    stats = RapidProfile::api<RAPID_PROFILE_STR_SIZE>::stats();
+                    if(reset){
+                        RapidProfile::api<RAPID_PROFILE_STR_SIZE>::reset();
+                    }
+                }
+                py::dict res;
+                for(auto & stat: stats){
+                    py::dict entry;
+                    entry["count"] = stat.count;
+                    entry["mean"] = stat.mean;
+                    entry["p50"] = stat.p50;
+                    entry["p90"] = stat.p90;
+                    entry["p99"] = stat.p99;
+                    entry["max"] = stat.max;
+                    res[py::str(stat.name)] = entry;
+                }
+                return res;
+            }, py::arg("reset") = false,
+            R"pbdoc(
+                Returns the durations of the pipeline stages timed since profiling was enabled or last reset.
+
+                The result maps every stage (acquire, copy_to_nvbuffer, sharpness, motion, encode, transform,
+                map_copy and file_write) to a dict with `count` and the `mean`, `p50`, `p90`, `p99` and `max`
+                durations in seconds.
+
+                Parameters
+                ----------
+                reset: bool, optional
+                    Start a new window after reading the stats, (default is False)
+            )pbdoc");
+
+    m.def("start_trace",[](std::string path, size_t max_file_size, size_t max_files){
+                RapidProfile::api<RAPID_PROFILE_STR_SIZE>::start_trace(path,max_file_size,max_files);
+            }, py::arg("path"), py::arg("max_file_size") = 0, py::arg("max_files") = 0,
+            py::call_guard<py::gil_scoped_release>(),
+            R"pbdoc(
+                Starts streaming the timings of the pipeline stages to a chrome trace file.
+
+                Enables profiling. The trace can be opened in Perfetto or chrome://tracing, every thread
+                of the pipeline has its own track and the stages of a frame are linked by flow arrows from
+                acquiring the frame to encoding and writing it. A running trace is replaced.
+
+                Parameters
+                ----------
+                path: str
+                    The file to write the trace to.
+                max_file_size: int, optional
+                    Start a new file once a file reaches this size in bytes, the files are numbered
+                    before the extension: `trace.0.json`, `trace.1.json`, .... 0 writes a single file,
+                    (default is 0)
+                max_files: int, optional
+                    The number of files kept when rolling, older files are removed. 0 keeps all files,
+                    (default is 0)
+            )pbdoc");
+
+    m.def("stop_trace",[](){
+                RapidProfile::api<RAPID_PROFILE_STR_SIZE>::stop_trace();
+            }, py::call_guard<py::gil_scoped_release>(),
+            R"pbdoc(
+                Stops the running trace and finishes its file, profiling stays enabled.
+            )pbdoc");
+
+    m.def("write_trace",[](std::string path){
+                RapidProfile::api<RAPID_PROFILE_STR_SIZE>::write_trace(path);
+            }, py::arg("path"), py::call_guard<py::gil_scoped_release>(),
+            R"pbdoc(
+                Writes all timings kept since profiling was enabled to a chrome trace file.
+
+                Parameters
+                ----------
+                path: str
+                    The file to write the trace to.
+            )pbdoc");
+
+    m.def("metrics_text",&metrics_text, py::call_guard<py::gil_scoped_release>(),
+            R"pbdoc(
+                Returns the metrics of all open streams in the prometheus text format.
+
+                Every stream is distinguished by a `stream` label, numbered in the order the streams were opened.
+            )pbdoc");
+
+    m.def("serve_metrics",&serve_metrics, py::arg("port"), py::arg("address") = "127.0.0.1",
+            py::call_guard<py::gil_scoped_release>(),
+            R"pbdoc(
+                Serves the metrics of all open streams over http from a background thread.
+
+                Every request is answered with the prometheus text, so the address can be scraped directly.
+                A running export is replaced.
+
+                Parameters
+                ----------
+                port: int
+                    The port to listen on.
+                address: str, optional
+                    The IPv4 address to listen on, (default is "127.0.0.1")
+            )pbdoc");
+
+    m.def("write_metrics",&write_metrics, py::arg("path"), py::arg("period") = 10.0,
+            py::call_guard<py::gil_scoped_release>(),
+            R"pbdoc(
+                Writes the metrics of all open streams to a file periodically from a background thread.
+
+                The file is replaced atomically, for example for the textfile collector of the node exporter.
+                A running export is replaced.
+
+                Parameters
+                ----------
+                path: str
+                    The file to write the prometheus text to.
+                period: float, optional
+                    Seconds between writes, (default is 10.0)
+            )pbdoc");
+
+    m.def("stop_metrics",&stop_metrics, py::call_guard<py::gil_scoped_release>(),
+            R"pbdoc(
+                Stops serving or writing metrics.
+            )pbdoc");
+
+    py::class_<SensorModeInfo>(m,"SensorModeInfo", R"pbdoc(
+                The properties of a sensor mode, durations and exposure times are in nanoseconds.
+            )pbdoc")
+        .def(py::init([](uint32_t width, uint32_t height, uint64_t min_frame_duration, uint64_t max_frame_duration,
+                        uint64_t min_exposure_time, uint64_t max_exposure_time, float min_analog_gain, float max_analog_gain,
+                        uint32_t bit_depth){
+                    return SensorModeInfo{width,height,min_frame_duration,max_frame_duration,
+                        min_exposure_time,max_exposure_time,min_analog_gain,max_analog_gain,bit_depth};
+                }),
+                py::arg("width"), py::arg("height"), py::arg("min_frame_duration"), py::arg("max_frame_duration"),
+                py::arg("min_exposure_time") = 0, py::arg("max_exposure_time") = 0,
+                py::arg("min_analog_gain") = 0.0, py::arg("max_analog_gain") = 0.0, py::arg("bit_depth") = 0)
+        .def_readwrite("width",&SensorModeInfo::width)
+        .def_readwrite("height",&SensorModeInfo::height)
+        .def_readwrite("min_frame_duration",&SensorModeInfo::min_frame_duration)
+        .def_readwrite("max_frame_duration",&SensorModeInfo::max_frame_duration)
+        .def_readwrite("min_exposure_time",&SensorModeInfo::min_exposure_time)
+        .def_readwrite("max_exposure_time",&SensorModeInfo::max_exposure_time)
+        .def_readwrite("min_analog_gain",&SensorModeInfo::min_analog_gain)
+        .def_readwrite("max_analog_gain",&SensorModeInfo::max_analog_gain)
+        .def_readwrite("bit_depth",&SensorModeInfo::bit_depth);
+
+    py::class_<ModeCandidate>(m,"ModeCandidate")
+        .def_readonly("mode",&ModeCandidate::mode)
+        .def_readonly("width",&ModeCandidate::width)
+        .def_readonly("height",&ModeCandidate::height)
+        .def_readonly("supports_fps",&ModeCandidate::supports_fps)
+        .def_readonly("covers_resolution",&ModeCandidate::covers_resolution)
+        .def_readonly("pixel_rate",&ModeCandidate::pixel_rate)
+        .def_readonly("aspect_error",&ModeCandidate::aspect_error)
+        .def_readonly("fps_headroom",&ModeCandidate::fps_headroom);
+
+    py::class_<ModePlan>(m,"ModePlan")
+        .def_readonly("mode",&ModePlan::mode)
+        .def_readonly("candidates",&ModePlan::candidates);
+
+    m.def("plan_sensor_mode",&plan_sensor_mode, py::arg("cameras"), py::arg("resolution"), py::arg("fps"),
+            R"pbdoc(
+                Selects the sensor mode streams use when no mode is given.
+
+                Modes which all cameras can capture at `fps` and which cover the resolution are preferred, and
+                among those the mode with the lowest pixel rate, then the closest aspect ratio and then the most
+                frame rate headroom. If no mode covers the resolution the largest mode is used.
+
+                Parameters
+                ----------
+                cameras: list[list[SensorModeInfo]]
+                    The sensor modes of every camera, see `sensor_modes`.
+                resolution: tuple
+                    The requested capture width and height in pixels.
+                fps: float
+                    The requested frame rate.
+
+                Returns
+                -------
+                ModePlan
+                    The selected `mode` and all `candidates` ordered by preference.
+            )pbdoc");
+
+    m.def("sensor_modes",[](uint32_t camera){
+                return shared_camera_provider()->sensor_mode_info(camera);
+            }, py::arg("camera"), py::call_guard<py::gil_scoped_release>(),
+            R"pbdoc(
+                Returns the sensor modes of a camera as a list of SensorModeInfo.
+            )pbdoc");
+
+    m.def("release_camera_provider",&release_camera_provider, py::call_guard<py::gil_scoped_release>(),
+            R"pbdoc(
+                Stops keeping the camera provider alive between streams.
+
+                The camera provider and its sensor mode tables are shared by all streams of
+                the process and kept after the last stream is closed, so opening another
+                stream does not enumerate the cameras again. After this call the provider is
+                destroyed once the streams using it are closed.
+            )pbdoc");
+
+    m.def("set_sensor_mode_cache",&set_sensor_mode_cache, py::arg("path"),
+            R"pbdoc(
+                Persists the sensor mode tables of the cameras in a file.
+
+                The tables are keyed by the identity of the camera, so streams in later
+                processes read them instead of querying every sensor mode.
+
+                Parameters
+                ----------
+                path: str
+                    File to store the tables in, an empty string disables the file.
+            )pbdoc");
 
 #ifdef VERSION_INFO
     m.attr("__version__") = MACRO_STRINGIFY(VERSION_INFO);
@@ -0,0 +1,269 @@
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+void StreamMetrics::set_cameras(std::vector<std::string> names){
+    this->cameras.reset(new CameraCounters[names.size()]);
+    this->camera_names = std::move(names);
+}
+
+void StreamMetrics::acquired(size_t camera, uint64_t number, bool counted){
+    auto & counters = this->cameras[camera];
+    if(counters.numbered && number > counters.last_number + 1){
+        counters.dropped.fetch_add(number - counters.last_number - 1,std::memory_order_relaxed);
+    }
+    counters.last_number = number;
+    counters.numbered = true;
+    if(counted){
+        counters.acquired.fetch_add(1,std::memory_order_relaxed);
+    }
+}
+
+void StreamMetrics::snapshot(std::vector<Metric> & out){
+    for(size_t i = 0;i < this->camera_names.size();i++){
+        auto & counters = this->cameras[i];
+        auto & name = this->camera_names[i];
+        out.push_back(counter_metric("frames_acquired_total","Frames acquired from the camera.",
+                    counters.acquired.load(std::memory_order_relaxed),name));
+        out.push_back(counter_metric("frames_returned_total","Frames returned by the stream.",
+                    counters.returned.load(std::memory_order_relaxed),name));
+        out.push_back(counter_metric("frames_dropped_total","Frames missed by the stream, from gaps in the frame numbers.",
+                    counters.dropped.load(std::memory_order_relaxed),name));
+    }
+}
+
+Metric counter_metric(std::string name, std::string help, double value, std::string camera){
+    return Metric{std::move(name),MetricType::Counter,std::move(help),std::move(camera),value};
+}
+
+Metric gauge_metric(std::string name, std::string help, double value, std::string camera){
+    return Metric{std::move(name),MetricType::Gauge,std::move(help),std::move(camera),value};
+}
+
+// The registry and the exporter are never freed, the export thread can still use
+// them while the process exits.
+
+// Held while a source is used, so unregistering waits for a running collection.
+static std::mutex & registry_mutex = *new std::mutex();
+static std::vector<std::pair<MetricSource *,uint64_t>> & sources = *new std::vector<std::pair<MetricSource *,uint64_t>>();
+static uint64_t next_source = 0;
+
+void register_metrics(MetricSource * source){
+    std::lock_guard<std::mutex> guard(registry_mutex);
+    sources.emplace_back(source,next_source++);
+}
+
+void unregister_metrics(MetricSource * source){
+    std::lock_guard<std::mutex> guard(registry_mutex);
+    sources.erase(std::remove_if(sources.begin(),sources.end(),[source](auto & entry){
+                return entry.first == source;
+            }),sources.end());
+}
+
+void collect_metrics(MetricSource * source, std::vector<Metric> & out){
+    std::lock_guard<std::mutex> guard(registry_mutex);
+    bool registered = std::any_of(sources.begin(),sources.end(),[source](auto & entry){
+            return entry.first == source;
+        });
+    source->metrics(out,registered);
+}
+
+// Escapes a label value or help text of the text exposition format, quotes are only
+// escaped in label values.
+static std::string escape_text(const std::string & text, bool quotes){
+    std::string out;
+    out.reserve(text.size());
+    for(char c: text){
+        if(c == '\\'){
+            out += "\\\\";
+        }else if(c == '\n'){
+            out += "\\n";
+        }else if(c == '"' && quotes){
+            out += "\\\"";
+        }else{
+            out += c;
+        }
+    }
+    return out;
+}
+
+std::string metrics_text(){
+    struct Family{
+        MetricType type;
+        std::string help;
+        std::ostringstream samples;
+    };
+    // Samples are grouped by metric name, in the order the names first appear.
+    std::vector<std::string> names;
+    std::map<std::string,Family> families;
+    {
+        std::lock_guard<std::mutex> guard(registry_mutex);
+        for(auto & [source,id]: sources){
+            std::vector<Metric> metrics;
+            source->metrics(metrics,true);
+            for(auto & metric: metrics){
+                auto name = "jepture_" + metric.name;
+                auto it = families.find(name);
+                if(it == families.end()){
+                    names.push_back(name);
+                    it = families.emplace(name,Family{metric.type,metric.help,{}}).first;
+                    // Large counters must not be written in scientific notation.
+                    it->second.samples << std::setprecision(15);
+                }
+                auto & samples = it->second.samples;
+                samples << name << "{stream=\"" << id << "\"";
+                if(!metric.camera.empty()){
+                    samples << ",camera=\"" << escape_text(metric.camera,true) << "\"";
+                }
+                samples << "} " << metric.value << "\n";
+            }
+        }
+    }
+    std::ostringstream text;
+    for(auto & name: names){
+        auto & family = families[name];
+        text << "# HELP " << name << " " << escape_text(family.help,false) << "\n";
+        text << "# TYPE " << name << " " << (family.type == MetricType::Counter ? "counter" : "gauge") << "\n";
+        text << family.samples.str();
+    }
+    return text.str();
+}
+
+// The background thread of the running export.
+static std::mutex & export_mutex = *new std::mutex();
+static std::condition_variable & export_cond = *new std::condition_variable();
+static std::thread & exporter = *new std::thread();
+static bool export_stopping = false;
+// Serializes starting and stopping the export, the exporter is only replaced or joined with it
+// held. Separate from the export mutex, which the export thread takes while it is joined.
+static std::mutex & control_mutex = *new std::mutex();
+
+static bool export_wait(double seconds){
+    std::unique_lock<std::mutex> lock(export_mutex);
+    return !export_cond.wait_for(lock,std::chrono::duration<double>(seconds),[]{ return export_stopping; });
+}
+
+static void serve(int fd){
+    while(export_wait(0.0)){
+        pollfd poll_fd{fd,POLLIN,0};
+        // Wake up regularly to notice a stop.
+        if(poll(&poll_fd,1,200) <= 0){
+            continue;
+        }
+        int client = accept(fd,nullptr,nullptr);
+        if(client < 0){
+            continue;
+        }
+        // Every request is answered with the metrics, the request itself is not needed.
+        timeval timeout{1,0};
+        setsockopt(client,SOL_SOCKET,SO_RCVTIMEO,&timeout,sizeof(timeout));
+        char request[4096];
+        recv(client,request,sizeof(request),0);
+
+        auto body = metrics_text();
+        std::ostringstream response;
+        response << "HTTP/1.0 200 OK\r\n"
+            << "Content-Type: text/plain; version=0.0.4\r\n"
+            << "Content-Length: " << body.size() << "\r\n"
+            << "Connection: close\r\n\r\n"
+            << body;
+        auto data = response.str();
+        size_t sent = 0;
+        while(sent < data.size()){
+            auto res = send(client,data.data() + sent,data.size() - sent,MSG_NOSIGNAL);
+            if(res <= 0){
+                break;
+            }
+            sent += res;
+        }
+        close(client);
+    }
+    close(fd);
+}
+
+// Requires the control mutex.
+static void stop_export(){
+    {
+        std::lock_guard<std::mutex> guard(export_mutex);
+        export_stopping = true;
+    }
+    export_cond.notify_all();
+    if(exporter.joinable()){
+        exporter.join();
+    }
+}
+
+// Requires the control mutex.
+static void start_export(std::function<void()> run){
+    stop_export();
+    {
+        std::lock_guard<std::mutex> guard(export_mutex);
+        export_stopping = false;
+    }
+    exporter = std::thread(std::move(run));
+}
+
+void serve_metrics(const std::string & address, uint16_t port){
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if(inet_pton(AF_INET,address.c_str(),&addr.sin_addr) != 1){
+        throw std::runtime_error("invalid metrics address `" + address + "`");
+    }
+    std::lock_guard<std::mutex> guard(control_mutex);
+    // The running export is stopped first, so a server on the same port releases it.
+    stop_export();
+    int fd = socket(AF_INET,SOCK_STREAM | SOCK_CLOEXEC,0);
+    if(fd < 0){
+        throw std::runtime_error("failed to create metrics socket");
+    }
+    int reuse = 1;
+    setsockopt(fd,SOL_SOCKET,SO_REUSEADDR,&reuse,sizeof(reuse));
+    if(bind(fd,(sockaddr *)&addr,sizeof(addr)) != 0 || listen(fd,8) != 0){
+        auto stream = std::stringstream();
+        stream << "failed to listen on " << address << ":" << port << ": " << strerror(errno);
+        close(fd);
+        throw std::runtime_error(stream.str());
+    }
+    start_export([fd]{ serve(fd); });
+}
+
+void write_metrics(const std::string & path, double period){
+    if(!(period > 0.0)){
+        throw std::runtime_error("metrics period must be positive");
+    }
+    std::lock_guard<std::mutex> guard(control_mutex);
+    start_export([path,period]{
+        auto temporary = path + ".tmp";
+        do{
+            {
+                std::ofstream file(temporary,std::ios::trunc);
+                file << metrics_text();
+            }
+            std::rename(temporary.c_str(),path.c_str());
+        }while(export_wait(period));
+    });
+}
+
+void stop_metrics(){
+    std::lock_guard<std::mutex> guard(control_mutex);
+    stop_export();
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum class MetricType{
+    Counter,
+    Gauge,
+};
+
+// A value of a metric, named without the `jepture_` prefix. Per camera values carry
+// the name of their camera.
+struct Metric{
+    std::string name;
+    MetricType type;
+    std::string help;
+    std::string camera;
+    double value;
+};
+
+struct CameraCounters{
+    std::atomic<uint64_t> acquired{0};
+    std::atomic<uint64_t> returned{0};
+    std::atomic<uint64_t> dropped{0};
+    // Number of the last acquired frame, only used by the capturing thread.
+    uint64_t last_number = 0;
+    bool numbered = false;
+};
+
+/*
+ * Counters of a stream, updated with relaxed atomics from the capture path.
+ */
+class StreamMetrics{
+    std::vector<std::string> camera_names;
+    std::unique_ptr<CameraCounters[]> cameras;
+
+public:
+    std::atomic<uint64_t> encoded_frames{0};
+    std::atomic<uint64_t> encoded_bytes{0};
+    std::atomic<uint64_t> written_files{0};
+    std::atomic<uint64_t> written_bytes{0};
+    std::atomic<uint64_t> converted_frames{0};
+    std::atomic<uint64_t> conversion_ns{0};
+
+    void set_cameras(std::vector<std::string> names);
+
+    CameraCounters & camera(size_t index){
+        return this->cameras[index];
+    }
+
+    // Counts an acquired frame and the frames missed since the previous frame of the camera.
+    // A frame which is not `counted` only continues the frame numbers.
+    void acquired(size_t camera, uint64_t number, bool counted = true);
+
+    // Appends the counters to `out`.
+    void snapshot(std::vector<Metric> & out);
+};
+
+Metric counter_metric(std::string name, std::string help, double value, std::string camera = "");
+Metric gauge_metric(std::string name, std::string help, double value, std::string camera = "");
+
+// A stream which reports metrics, registered streams are included in the exported metrics.
+class MetricSource{
+public:
+    virtual ~MetricSource() = default;
+    // Appends the counters of the source to `out`, and the gauges if `gauges` is set.
+    // Gauges read the state of the running source and are only requested while it is registered.
+    virtual void metrics(std::vector<Metric> & out, bool gauges) = 0;
+};
+
+// Sources are identified by the `stream` label, numbered in the order they are registered.
+void register_metrics(MetricSource * source);
+// Waits for a running collection, the source is not used anymore once this returns.
+void unregister_metrics(MetricSource * source);
+
+// Collects the metrics of a source, with gauges only if it is registered.
+void collect_metrics(MetricSource * source, std::vector<Metric> & out);
+
+// Formats the metrics of all registered sources in the prometheus text format.
+std::string metrics_text();
+
+// Serves the prometheus text on `address`:`port` from a background thread, replacing a running export.
+// The running export is stopped before the socket is bound, also if binding fails.
+void serve_metrics(const std::string & address, uint16_t port);
+// Writes the prometheus text to `path` every `period` seconds from a background thread,
+// replacing a running export. The file is replaced atomically.
+void write_metrics(const std::string & path, double period);
+// The export functions can be called from any thread, concurrent calls are applied one after another.
+void stop_metrics();
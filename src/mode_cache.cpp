@@ -0,0 +1,98 @@
+#include "mode_cache.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+static std::mutex cache_mutex;
+static std::string cache_path;
+
+void set_sensor_mode_cache(std::string path){
+    std::lock_guard<std::mutex> guard(cache_mutex);
+    cache_path = std::move(path);
+}
+
+// Reads the sensor modes of a device from the cache file, the file has one line per
+// device: the identity, the number of modes and the fields of every mode.
+static std::optional<std::vector<SensorModeInfo>> read_cached_modes(const std::string & identity, size_t count){
+    std::lock_guard<std::mutex> guard(cache_mutex);
+    if(cache_path.empty()){
+        return std::nullopt;
+    }
+    std::ifstream file(cache_path);
+    std::string line;
+    while(std::getline(file,line)){
+        std::istringstream fields(line);
+        std::string key;
+        size_t size;
+        if(!(fields >> key >> size) || key != identity || size != count){
+            continue;
+        }
+        std::vector<SensorModeInfo> modes(size);
+        for(auto & mode: modes){
+            fields >> mode.width >> mode.height
+                >> mode.min_frame_duration >> mode.max_frame_duration
+                >> mode.min_exposure_time >> mode.max_exposure_time
+                >> mode.min_analog_gain >> mode.max_analog_gain
+                >> mode.bit_depth;
+        }
+        if(fields){
+            return modes;
+        }
+    }
+    return std::nullopt;
+}
+
+static void write_cached_modes(const std::string & identity, const std::vector<SensorModeInfo> & modes){
+    std::lock_guard<std::mutex> guard(cache_mutex);
+    if(cache_path.empty()){
+        return;
+    }
+    // Keep the entries of other devices.
+    std::ostringstream content;
+    {
+        std::ifstream file(cache_path);
+        std::string line;
+        while(std::getline(file,line)){
+            if(line.compare(0,identity.size() + 1,identity + " ") != 0){
+                content << line << "\n";
+            }
+        }
+    }
+    content << identity << " " << modes.size();
+    for(auto & mode: modes){
+        content << " " << mode.width << " " << mode.height
+            << " " << mode.min_frame_duration << " " << mode.max_frame_duration
+            << " " << mode.min_exposure_time << " " << mode.max_exposure_time
+            << " " << mode.min_analog_gain << " " << mode.max_analog_gain
+            << " " << mode.bit_depth;
+    }
+    content << "\n";
+
+    auto temporary = cache_path + ".tmp";
+    {
+        std::ofstream file(temporary,std::ios::trunc);
+        file << content.str();
+    }
+    std::rename(temporary.c_str(),cache_path.c_str());
+}
+
+SensorModeCache::SensorModeCache(SensorModeSource & source, size_t devices)
+    : source(source), tables(devices)
+{
+}
+
+const std::vector<SensorModeInfo> & SensorModeCache::sensor_mode_info(size_t device){
+    std::lock_guard<std::mutex> guard(this->mutex);
+    auto & table = this->tables.at(device);
+    if(table){
+        return *table;
+    }
+    auto identity = this->source.identity(device);
+    table = read_cached_modes(identity,this->source.sensor_mode_count(device));
+    if(!table){
+        table = this->source.query_sensor_modes(device);
+        write_cached_modes(identity,*table);
+    }
+    return *table;
+}
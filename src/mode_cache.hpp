@@ -0,0 +1,51 @@
+#pragma once
+
+#include "mode_planner.hpp"
+
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+/*
+ * The sensor mode queries of a camera provider.
+ *
+ * Implemented by the argus camera provider, and by a simulated provider in the
+ * benchmarks so the caching is measured without cameras.
+ */
+class SensorModeSource{
+public:
+    virtual ~SensorModeSource() = default;
+
+    // Identifies a camera device across processes.
+    virtual std::string identity(size_t device) = 0;
+
+    // The number of sensor modes of a device, cheap compared to querying them.
+    virtual size_t sensor_mode_count(size_t device) = 0;
+
+    // Queries every sensor mode of a device, which takes long.
+    virtual std::vector<SensorModeInfo> query_sensor_modes(size_t device) = 0;
+};
+
+/*
+ * The sensor mode tables of the devices of a source.
+ *
+ * A table is queried once per device, or read from the file set with
+ * `set_sensor_mode_cache` if an earlier process stored it.
+ */
+class SensorModeCache{
+    SensorModeSource & source;
+
+    std::mutex mutex;
+    std::vector<std::optional<std::vector<SensorModeInfo>>> tables;
+
+public:
+    SensorModeCache(SensorModeSource & source, size_t devices);
+
+    const std::vector<SensorModeInfo> & sensor_mode_info(size_t device);
+};
+
+// Persists the sensor mode tables in `path`, keyed by the identity of the device, so
+// other processes read the tables instead of querying every sensor mode. An empty
+// path disables the file.
+void set_sensor_mode_cache(std::string path);
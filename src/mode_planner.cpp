@@ -0,0 +1,82 @@
+#include "mode_planner.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+// Whether `a` is preferred over `b`.
+static bool preferred(const ModeCandidate & a, const ModeCandidate & b){
+    if(a.supports_fps != b.supports_fps){
+        return a.supports_fps;
+    }
+    if(a.covers_resolution != b.covers_resolution){
+        return a.covers_resolution;
+    }
+    if(a.pixel_rate != b.pixel_rate){
+        // The cheapest mode which covers the resolution, otherwise the one which upscales least.
+        return a.covers_resolution ? a.pixel_rate < b.pixel_rate : a.pixel_rate > b.pixel_rate;
+    }
+    if(a.aspect_error != b.aspect_error){
+        return a.aspect_error < b.aspect_error;
+    }
+    if(a.fps_headroom != b.fps_headroom){
+        return a.fps_headroom > b.fps_headroom;
+    }
+    return a.mode < b.mode;
+}
+
+ModePlan plan_sensor_mode(const std::vector<std::vector<SensorModeInfo>> & cameras,
+        std::pair<uint32_t,uint32_t> resolution,
+        float fps){
+    if(cameras.empty()){
+        throw std::runtime_error("No cameras to select a sensor mode for");
+    }
+    if(fps <= 0.0){
+        throw std::runtime_error("Frame rate must be positive");
+    }
+    size_t modes = std::numeric_limits<size_t>::max();
+    for(auto & camera: cameras){
+        modes = std::min(modes,camera.size());
+    }
+    if (modes == 0){
+        throw std::runtime_error("Could not get sensor_modes for camera");
+    }
+
+    uint64_t frame_duration = 1e9 / static_cast<double>(fps) + 0.9;
+    double requested_aspect = resolution.second ? (double)resolution.first / (double)resolution.second : 1.0;
+
+    ModePlan plan;
+    for(uint32_t i = 0;i < modes;i++){
+        ModeCandidate candidate;
+        candidate.mode = i;
+        candidate.width = std::numeric_limits<uint32_t>::max();
+        candidate.height = std::numeric_limits<uint32_t>::max();
+        candidate.supports_fps = true;
+        candidate.fps_headroom = std::numeric_limits<double>::max();
+        for(auto & camera: cameras){
+            auto & info = camera[i];
+            candidate.width = std::min(candidate.width,info.width);
+            candidate.height = std::min(candidate.height,info.height);
+            candidate.supports_fps = candidate.supports_fps
+                && info.min_frame_duration <= frame_duration && info.max_frame_duration >= frame_duration;
+            double max_fps = info.min_frame_duration ? 1e9 / (double)info.min_frame_duration : 0.0;
+            candidate.fps_headroom = std::min(candidate.fps_headroom,max_fps / fps);
+        }
+        candidate.covers_resolution = candidate.width >= resolution.first && candidate.height >= resolution.second;
+        candidate.pixel_rate = (double)candidate.width * candidate.height * fps;
+        double aspect = candidate.height ? (double)candidate.width / (double)candidate.height : 0.0;
+        candidate.aspect_error = std::abs(aspect - requested_aspect) / requested_aspect;
+        plan.candidates.push_back(candidate);
+    }
+
+    std::stable_sort(plan.candidates.begin(),plan.candidates.end(),preferred);
+    if(!plan.candidates[0].supports_fps){
+        auto stream = std::stringstream();
+        stream << "Could not find a sensor mode which supports requested fps: " << fps << ".";
+        throw std::runtime_error(stream.str());
+    }
+    plan.mode = plan.candidates[0].mode;
+    return plan;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// The properties of a sensor mode.
+struct SensorModeInfo{
+    uint32_t width;
+    uint32_t height;
+    uint64_t min_frame_duration;
+    uint64_t max_frame_duration;
+    uint64_t min_exposure_time;
+    uint64_t max_exposure_time;
+    float min_analog_gain;
+    float max_analog_gain;
+    uint32_t bit_depth;
+};
+
+// How well a sensor mode fits the requested resolution and frame rate, for every camera.
+struct ModeCandidate{
+    uint32_t mode;
+    // The smallest mode of the cameras.
+    uint32_t width;
+    uint32_t height;
+    // Whether every camera can capture at the requested frame rate in this mode.
+    bool supports_fps;
+    // Whether the mode is at least as large as the requested resolution on every camera.
+    bool covers_resolution;
+    // Pixels read from the sensors per second at the requested frame rate.
+    double pixel_rate;
+    // Relative difference between the aspect ratio of the mode and the requested resolution.
+    double aspect_error;
+    // Highest frame rate of the mode divided by the requested frame rate.
+    double fps_headroom;
+};
+
+// The selected sensor mode and every mode it was selected from, ordered by preference.
+struct ModePlan{
+    uint32_t mode;
+    std::vector<ModeCandidate> candidates;
+};
+
+/*
+ * Selects the sensor mode with the lowest cost which all cameras can capture at `fps`.
+ *
+ * `cameras` holds the sensor modes of every camera, a mode index is usable if every
+ * camera has it. Modes which cover the requested resolution are preferred, and among
+ * those the mode with the lowest pixel rate, so the ISP does not read and downscale
+ * more pixels than needed. Ties are broken by the closest aspect ratio and then by the
+ * most frame rate headroom. If no mode covers the resolution the largest mode is used.
+ * Throws if no mode supports the frame rate.
+ */
+ModePlan plan_sensor_mode(const std::vector<std::vector<SensorModeInfo>> & cameras,
+        std::pair<uint32_t,uint32_t> resolution,
+        float fps);
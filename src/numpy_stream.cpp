@@ -1,107 +1,191 @@
-#include <pybind11/pybind11.h>
-#include <pybind11/numpy.h>
 #include <cstring>
 #include "jepture.hpp"
+#include "config.hpp"
+#include "profile.hpp"
 
 #include <limits>
 
-namespace py = pybind11;
-
 NumpyStream::NumpyStream(
         std::vector<std::tuple<uint32_t,std::string> > cameras, 
         std::pair<uint32_t,uint32_t> resolution, 
         float fps, 
         std::optional<uint32_t> mode,
-        std::optional<std::unordered_map<std::string,double>> settings
+        std::optional<std::unordered_map<std::string,double>> settings,
+        std::optional<std::unordered_map<std::string,double>> sharpness,
+        std::optional<std::unordered_map<std::string,std::unordered_map<std::string,double>>> camera_config,
+        std::optional<std::unordered_map<std::string,double>> preview,
+        bool metadata,
+        bool warmup
         )
-    : ArgusStream(cameras,resolution,fps,mode,settings)
+    : FrameStream(cameras,resolution,fps,mode,settings,camera_config)
 {
-
-    this->transform_params = {};
-    this->transform_params.transform_flag = NVBUFFER_TRANSFORM_FILTER | NVBUFFER_TRANSFORM_FLIP;
-    this->transform_params.transform_flip = NvBufferTransform_None;
-    this->transform_params.transform_filter = NvBufferTransform_Filter_Nearest;
-    
-
-    NvBufferCreateParams create_params;
-    std::memset(&create_params,0,sizeof(NvBufferCreateParams));
-    create_params.width = this->resolution.width();
-    create_params.height = this->resolution.height();
-    create_params.layout = NvBufferLayout_Pitch;
-    create_params.payloadType = NvBufferPayload_SurfArray;
-    create_params.colorFormat = NvBufferColorFormat_ARGB32;
-    create_params.nvbuf_tag = NvBufferTag_VIDEO_CONVERT;
-
-    this->dma_buffer = -1;
-    auto ret = NvBufferCreateEx(&this->dma_buffer,&create_params);
-    if(ret){
-        throw std::runtime_error("failed to create conversion buffer");
+    if(sharpness){
+        this->enable_sharpness(config_value(*sharpness,"sharpness","scale",4.0,1.0,64.0));
     }
-}
 
-py::array_t<uint8_t> NumpyStream::copy_buffer(int in_dma_buffer){
-    auto ret = NvBufferTransform(in_dma_buffer,this->dma_buffer,&this->transform_params);
-    if(ret){
-        throw std::runtime_error("failed to transform buffer");
-    }
-    NvBufferParams params;
-    ret = NvBufferGetParams (this->dma_buffer, &params);
-    if (ret)
-    {
-        throw std::runtime_error("failed to retrieve buffer params");
+    for(uint32_t i = 0;i < this->cameras.size();i++){
+        auto size = this->camera_resolution(i);
+        this->converters.push_back(std::make_unique<BgraConverter>(size.width(),size.height()));
     }
-    if (params.num_planes != 1 || params.height[0] != this->resolution.height() || params.width[0] != this->resolution.width()){
-        throw std::runtime_error("got invalid buffer_params");
+    this->last_images.resize(this->cameras.size());
+    if(preview){
+        this->enable_preview(Size2D<uint32_t>(
+                config_value(*preview,"preview","width",640.0,16.0,65536.0),
+                config_value(*preview,"preview","height",360.0,16.0,65536.0)));
     }
-
-    void *data_ptr;
-    ret = NvBufferMemMap(this->dma_buffer,0,NvBufferMem_Read_Write,&data_ptr);
-    if(ret){
-        throw std::runtime_error("failed to map image buffer");
+    if(metadata){
+        this->enable_metadata();
     }
-    uint32_t *out_buffer = new uint32_t[this->resolution.width() * this->resolution.height()];
-    NvBufferMemSyncForCpu(this->dma_buffer,0,&data_ptr);
-    for(uint32_t i = 0;i < this->resolution.height();++i){
-        uint8_t * src_ptr = (uint8_t *)data_ptr + i * params.pitch[0];
-        uint8_t * dst_ptr = (uint8_t *)(out_buffer + i * this->resolution.width());
-        std::memcpy(dst_ptr, src_ptr, this->resolution.width() * sizeof(uint32_t));
+    if(warmup){
+        this->start(true);
     }
-    NvBufferMemUnMap(this->dma_buffer,0,&data_ptr);
+    register_metrics(this);
+}
+
+ImageBuffer NumpyStream::copy_buffer(int in_dma_buffer, uint32_t camera, std::shared_ptr<uint8_t[]> out){
+    auto & converter = *this->converters[camera];
+    INTERVAL(transform);
+    auto transform_start = std::chrono::steady_clock::now();
+    auto conversion_start = transform_start;
+    converter.transform(in_dma_buffer);
+    INTERVAL_END(transform);
+    this->stage_latency[Stage::Transform].record_since(transform_start);
+
+    INTERVAL(map_copy);
+    auto map_copy_start = std::chrono::steady_clock::now();
+    auto image = converter.read(std::move(out));
+    INTERVAL_END(map_copy);
+    this->stage_latency[Stage::MapCopy].record_since(map_copy_start);
+    this->counters.converted_frames.fetch_add(1,std::memory_order_relaxed);
+    this->counters.conversion_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - conversion_start).count(),std::memory_order_relaxed);
+    return image;
+}
 
-    py::capsule clean_up(out_buffer,[](void *out_buffer){
-            uint32_t * out_buf = reinterpret_cast<uint32_t *>(out_buffer);
-            delete[] out_buf;
-    });
+void NumpyStream::warm_up(){
+    auto frames = ArgusStream::next(false);
+    // Every camera has its own converter. The conversions are not counted, the frame is not returned.
+    for(uint32_t i = 0;i < this->converters.size();i++){
+        this->converters[i]->transform(frames[i].dma_buffer);
+        this->converters[i]->read();
+    }
+    this->warm_up_previews(frames);
+}
 
-    return py::array_t<uint8_t>(
-            std::array<long int,3>({ (long int)this->resolution.height(), (long int)this->resolution.width(), 4}),
-            std::array<long int,3>({ (long int)this->resolution.width() * 4, 4, 1 }),
-            (uint8_t *)out_buffer,
-            clean_up );
+std::vector<NumpyStreamOutput> NumpyStream::capture(bool skip){
+    return this->capture_into(skip,nullptr,0);
 }
 
-std::vector<NumpyStreamOutput> NumpyStream::next(bool skip){
+std::vector<NumpyStreamOutput> NumpyStream::capture_into(bool skip, const std::shared_ptr<uint8_t[]> & buffer, size_t offset){
     auto frames = ArgusStream::next(skip);
     std::vector<NumpyStreamOutput> res;
     for(uint32_t i = 0;i < this->cameras.size();i++){
-        py::array_t<uint8_t> array;
-        if(!skip){
-            array = this->copy_buffer(frames[i].dma_buffer);
-        }else{
-            array = py::array_t<uint8_t>();
+        ImageBuffer image{};
+        std::shared_ptr<uint8_t[]> out;
+        if(buffer){
+            size_t size = (size_t)this->converters[i]->width * this->converters[i]->height * 4;
+            out = std::shared_ptr<uint8_t[]>(buffer,buffer.get() + offset + i * size);
+        }
+        if(!skip && !frames[i].fresh && this->last_images[i].data && !out){
+            // The camera has no new frame, its last image is shared.
+            image = this->last_images[i];
+        }else if(!skip){
+            // A repeated frame converted into `buffer` is converted again, its buffer still holds it.
+            INTERVAL_FLOW(frame_flow(i,frames[i].number));
+            image = this->copy_buffer(frames[i].dma_buffer,i,std::move(out));
+            // An image in `buffer` is not kept, it would keep all of `buffer` alive.
+            this->last_images[i] = buffer ? ImageBuffer{} : image;
         }
         res.push_back({
             frames[i].number,
             frames[i].time_stamp,
-            array,
+            image,
+            frames[i].sharpness,
+            frames[i].settings_id,
+            frames[i].metadata,
+            frames[i].preview,
+            frames[i].fresh,
         });
     }
     return res;
 }
 
+std::vector<std::vector<NumpyStreamOutput>> NumpyStream::next_stacked(size_t n, std::vector<FrameRecord> & records, ImageBuffer & stacked){
+    Size2D<uint32_t> resolution;
+    size_t cameras;
+    {
+        std::lock_guard<std::mutex> guard(this->next_mutex);
+        if(this->closed){
+            throw std::runtime_error("stream is closed");
+        }
+        cameras = this->cameras.size();
+        resolution = this->camera_resolution(0);
+        for(uint32_t i = 1;i < cameras;i++){
+            auto other = this->camera_resolution(i);
+            if(other.width() != resolution.width() || other.height() != resolution.height()){
+                throw std::runtime_error("next_many requires all cameras to have the same resolution");
+            }
+        }
+    }
+    stacked = ImageBuffer{nullptr,resolution.width(),resolution.height(),4};
+    size_t frame = (size_t)stacked.width * stacked.height * stacked.channels;
+    stacked.data = std::shared_ptr<uint8_t[]>(new uint8_t[frame * cameras * n]);
+    std::vector<std::vector<NumpyStreamOutput>> groups;
+    groups.reserve(n);
+    uint64_t record_offset = 0;
+    for(size_t i = 0;i < n;i++){
+        size_t offset = i * cameras * frame;
+        auto group = this->next_group(false,[&]{
+            // A reconfigure from another thread can change the size between frames.
+            for(uint32_t j = 0;j < cameras;j++){
+                auto size = this->camera_resolution(j);
+                if(size.width() != stacked.width || size.height() != stacked.height){
+                    throw std::runtime_error("the resolution changed during next_many");
+                }
+            }
+            return this->capture_into(false,stacked.data,offset);
+        });
+        for(size_t j = 0;j < cameras;j++){
+            auto & image = group[j].image;
+            if(!image.data || image.width != stacked.width || image.height != stacked.height){
+                throw std::runtime_error("the resolution changed during next_many");
+            }
+            uint8_t * slot = stacked.data.get() + offset + j * frame;
+            if(image.data.get() != slot){
+                // Frames of the feed or the prefetcher were converted before.
+                std::memcpy(slot,image.data.get(),frame);
+                image.data = std::shared_ptr<uint8_t[]>(stacked.data,slot);
+            }
+        }
+        this->record_group(group,record_offset,records);
+        groups.push_back(std::move(group));
+    }
+    return groups;
+}
 
-NumpyStream::~NumpyStream(){
-    if(this->dma_buffer != -1){
-        NvBufferDestroy(this->dma_buffer);
+void NumpyStream::resized(){
+    for(uint32_t i = 0;i < this->converters.size();i++){
+        auto resolution = this->camera_resolution(i);
+        this->converters[i] = std::make_unique<BgraConverter>(resolution.width(),resolution.height());
+        this->last_images[i] = ImageBuffer{};
     }
 }
+
+void NumpyStream::metrics(std::vector<Metric> & out, bool gauges){
+    FrameStream::metrics(out,gauges);
+    out.push_back(counter_metric("converted_frames_total","Frames converted to BGRA images.",
+                this->counters.converted_frames.load(std::memory_order_relaxed)));
+    out.push_back(counter_metric("conversion_seconds_total","Time spent converting frames to BGRA images.",
+                this->counters.conversion_ns.load(std::memory_order_relaxed) * 1e-9));
+}
+
+void NumpyStream::close(){
+    FrameStream::close();
+    std::lock_guard<std::mutex> guard(this->next_mutex);
+    this->converters.clear();
+    this->last_images.clear();
+}
+
+NumpyStream::~NumpyStream(){
+    this->close();
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+
+/*
+ * Runs a producer on a background thread one result ahead of the consumer.
+ *
+ * The worker thread is only created on the first request and lives until the
+ * prefetcher is stopped or destroyed.
+ */
+template<class T>
+class Prefetch{
+    std::function<T()> produce;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::optional<T> result;
+    std::exception_ptr error;
+    bool requested;
+    bool stopping;
+    std::thread thread;
+
+    void run(){
+        std::unique_lock<std::mutex> lock(this->mutex);
+        while(true){
+            this->cond.wait(lock,[this]{ return this->requested || this->stopping; });
+            if(this->stopping){
+                return;
+            }
+            lock.unlock();
+            std::optional<T> result;
+            std::exception_ptr error;
+            try{
+                result = this->produce();
+            }catch(...){
+                error = std::current_exception();
+            }
+            lock.lock();
+            this->result = std::move(result);
+            this->error = error;
+            this->requested = false;
+            this->cond.notify_all();
+        }
+    }
+
+public:
+    Prefetch(std::function<T()> produce)
+        : produce(std::move(produce)), requested(false), stopping(false)
+    {
+    }
+
+    ~Prefetch(){
+        this->stop();
+    }
+
+    // Starts producing the next result if no result is pending.
+    void request(){
+        std::lock_guard<std::mutex> guard(this->mutex);
+        if(this->stopping || this->requested || this->result || this->error){
+            return;
+        }
+        if(!this->thread.joinable()){
+            this->thread = std::thread(&Prefetch::run,this);
+        }
+        this->requested = true;
+        this->cond.notify_all();
+    }
+
+    // Whether a result is being produced or ready to be taken.
+    bool pending(){
+        std::lock_guard<std::mutex> guard(this->mutex);
+        return this->requested || this->result || this->error;
+    }
+
+    // Waits for the pending result, rethrows the exception if producing it failed.
+    T take(){
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->cond.wait(lock,[this]{ return !this->requested; });
+        if(this->error){
+            auto error = this->error;
+            this->error = nullptr;
+            std::rethrow_exception(error);
+        }
+        if(!this->result){
+            throw std::logic_error("no prefetched result to take");
+        }
+        T res = std::move(*this->result);
+        this->result.reset();
+        return res;
+    }
+
+    // Waits for a running producer to finish and discards the pending result, the
+    // prefetcher can still be used afterwards.
+    void discard(){
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->cond.wait(lock,[this]{ return !this->requested; });
+        this->result.reset();
+        this->error = nullptr;
+    }
+
+    // Waits for a running producer to finish and stops the worker thread, pending
+    // results are discarded.
+    void stop(){
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->cond.wait(lock,[this]{ return !this->requested; });
+            this->stopping = true;
+            this->result.reset();
+            this->error = nullptr;
+        }
+        this->cond.notify_all();
+        if(this->thread.joinable()){
+            this->thread.join();
+        }
+    }
+};
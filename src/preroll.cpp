@@ -0,0 +1,230 @@
+#include "preroll.hpp"
+#include "config.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+PrerollRing::PrerollRing(size_t bytes, size_t max_frames, uint64_t max_age)
+    : arena(bytes), frames(max_frames)
+{
+    this->first = 0;
+    this->count = 0;
+    this->head = 0;
+    this->used = 0;
+    this->max_age = max_age;
+    this->pending_next = 0;
+    this->pending_from = 0;
+    this->pending_until = 0;
+    this->lost = 0;
+    this->deferred = false;
+    this->deferred_pre = 0;
+    this->deferred_post = 0;
+}
+
+void PrerollRing::evict(){
+    auto & frame = this->frames[this->first];
+    if(this->pending_until != 0 && frame.number >= this->pending_next && frame.time_stamp >= this->pending_from && frame.time_stamp <= this->pending_until){
+        this->lost += 1;
+    }
+    this->used -= frame.size;
+    this->first = (this->first + 1) % this->frames.size();
+    this->count -= 1;
+    if(this->count == 0){
+        this->head = 0;
+    }
+}
+
+bool PrerollRing::push(uint64_t number, uint64_t time_stamp, const unsigned char * data, size_t size){
+    if(size > this->arena.size() || this->frames.empty()){
+        return false;
+    }
+
+    while(this->count > 0 && this->frames[this->first].time_stamp + this->max_age < time_stamp){
+        this->evict();
+    }
+    if(this->count == this->frames.size()){
+        this->evict();
+    }
+
+    // Frames above the head are older than the frames below it, wrapping around
+    // means every frame above the head has to go.
+    if(this->head + size > this->arena.size()){
+        while(this->count > 0 && this->frames[this->first].offset >= this->head){
+            this->evict();
+        }
+        this->head = 0;
+    }
+    while(this->count > 0 && this->frames[this->first].offset >= this->head && this->frames[this->first].offset < this->head + size){
+        this->evict();
+    }
+
+    std::memcpy(this->arena.data() + this->head,data,size);
+    auto index = (this->first + this->count) % this->frames.size();
+    this->frames[index] = { number, time_stamp, this->head, size };
+    this->count += 1;
+    this->head += size;
+    this->used += size;
+    return true;
+}
+
+void PrerollRing::extend_window(uint64_t from, uint64_t until){
+    // Extend the window if the previous trigger is still being recorded.
+    if(this->pending_until < from || this->pending_until == 0){
+        this->pending_from = from;
+    }else{
+        this->pending_from = std::min(this->pending_from,from);
+    }
+    this->pending_until = std::max(this->pending_until,until);
+}
+
+bool PrerollRing::copy_pending(PrerollFrame & frame, std::vector<unsigned char> & out){
+    if(this->pending_until == 0){
+        return false;
+    }
+    for(size_t i = 0;i < this->count;i++){
+        auto & cur = this->frames[(this->first + i) % this->frames.size()];
+        if(cur.number < this->pending_next || cur.time_stamp < this->pending_from){
+            continue;
+        }
+        if(cur.time_stamp > this->pending_until){
+            return false;
+        }
+        frame = cur;
+        out.resize(cur.size);
+        std::memcpy(out.data(),this->arena.data() + cur.offset,cur.size);
+        return true;
+    }
+    return false;
+}
+
+bool PrerollRing::finish_window(){
+    if(this->pending_until == 0 || this->latest_time_stamp() <= this->pending_until){
+        return false;
+    }
+    for(size_t i = 0;i < this->count;i++){
+        auto & cur = this->frames[(this->first + i) % this->frames.size()];
+        if(cur.number >= this->pending_next && cur.time_stamp >= this->pending_from && cur.time_stamp <= this->pending_until){
+            return false;
+        }
+    }
+    this->pending_from = 0;
+    this->pending_until = 0;
+    return true;
+}
+
+uint64_t PrerollRing::latest_time_stamp(){
+    if(this->count == 0){
+        return 0;
+    }
+    return this->frames[(this->first + this->count - 1) % this->frames.size()].time_stamp;
+}
+
+size_t PrerollRing::buffered_frames(){
+    return this->count;
+}
+
+size_t PrerollRing::buffered_bytes(){
+    return this->used;
+}
+
+PrerollRecorder::PrerollRecorder(size_t cameras, float fps, std::unordered_map<std::string,double> config, Sink sink)
+    : sink(std::move(sink))
+{
+    double seconds = config_value(config,"preroll","seconds",5.0,0.0,3600.0);
+    double bytes = config_value(config,"preroll","bytes",64.0 * 1024 * 1024,1.0,1e12);
+    double frames = config_value(config,"preroll","frames",std::ceil(seconds * fps) + 2,1.0,1e7);
+
+    for(size_t i = 0;i < cameras;i++){
+        this->rings.push_back(std::make_unique<PrerollRing>(bytes,frames,seconds * 1e9));
+    }
+    this->written = 0;
+    this->dropped = 0;
+    this->stopping = false;
+    this->flusher = std::thread(&PrerollRecorder::flush,this);
+}
+
+PrerollRecorder::~PrerollRecorder(){
+    {
+        std::lock_guard<std::mutex> guard(this->mutex);
+        this->stopping = true;
+    }
+    this->cond.notify_all();
+    this->flusher.join();
+}
+
+void PrerollRecorder::push(size_t camera, uint64_t number, uint64_t time_stamp, const unsigned char * data, size_t size){
+    std::lock_guard<std::mutex> guard(this->mutex);
+    auto & ring = this->rings[camera];
+    if(!ring->push(number,time_stamp,data,size)){
+        this->dropped += 1;
+        return;
+    }
+    if(ring->deferred){
+        ring->deferred = false;
+        ring->extend_window(time_stamp > ring->deferred_pre ? time_stamp - ring->deferred_pre : 0,time_stamp + ring->deferred_post);
+    }
+    // A frame past the window wakes the flusher too, which then clears the window.
+    if(ring->pending_until != 0 && time_stamp >= ring->pending_from){
+        this->cond.notify_all();
+    }
+}
+
+void PrerollRecorder::trigger(double pre_seconds, double post_seconds){
+    std::lock_guard<std::mutex> guard(this->mutex);
+    uint64_t pre = pre_seconds * 1e9;
+    uint64_t post = post_seconds * 1e9;
+    for(auto & ring: this->rings){
+        // Without a frame there is no sensor time to place the window at yet.
+        if(ring->buffered_frames() == 0){
+            ring->deferred_pre = ring->deferred ? std::max(ring->deferred_pre,pre) : pre;
+            ring->deferred_post = ring->deferred ? std::max(ring->deferred_post,post) : post;
+            ring->deferred = true;
+            continue;
+        }
+        uint64_t now = ring->latest_time_stamp();
+        ring->extend_window(now > pre ? now - pre : 0,now + post);
+    }
+    this->cond.notify_all();
+}
+
+void PrerollRecorder::flush(){
+    std::vector<unsigned char> buffer;
+    PrerollFrame frame;
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while(true){
+        bool found = false;
+        for(size_t i = 0;i < this->rings.size();i++){
+            if(!this->rings[i]->copy_pending(frame,buffer)){
+                this->rings[i]->finish_window();
+                continue;
+            }
+            found = true;
+            this->rings[i]->pending_next = frame.number + 1;
+            lock.unlock();
+            this->sink(i,frame.number,buffer.data(),frame.size);
+            lock.lock();
+            this->written += 1;
+        }
+        if(!found){
+            if(this->stopping){
+                return;
+            }
+            this->cond.wait(lock);
+        }
+    }
+}
+
+PrerollStats PrerollRecorder::stats(){
+    std::lock_guard<std::mutex> guard(this->mutex);
+    PrerollStats res{};
+    res.written_frames = this->written;
+    res.dropped_frames = this->dropped;
+    for(auto & ring: this->rings){
+        res.buffered_frames += ring->buffered_frames();
+        res.buffered_bytes += ring->buffered_bytes();
+        res.lost_frames += ring->lost;
+        res.recording = res.recording || ring->deferred || ring->pending_until != 0;
+    }
+    return res;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct PrerollFrame{
+    uint64_t number;
+    uint64_t time_stamp;
+    size_t offset;
+    size_t size;
+};
+
+/*
+ * A ring of encoded frames stored in a preallocated arena.
+ *
+ * Frames are stored contiguously in the arena in the order they are pushed, the
+ * oldest frames are evicted when either the arena or the frame table is full or
+ * when they are older than the maximum age. Pushing a frame never allocates.
+ */
+class PrerollRing{
+    std::vector<unsigned char> arena;
+    std::vector<PrerollFrame> frames;
+    size_t first;
+    size_t count;
+    size_t head;
+    size_t used;
+    uint64_t max_age;
+
+    void evict();
+
+public:
+    // Frames in this window starting from number `pending_next` still need to be
+    // written, evicting them counts them as lost.
+    uint64_t pending_next;
+    uint64_t pending_from;
+    uint64_t pending_until;
+    uint64_t lost;
+    // A window triggered while the ring had no frame to take the sensor time from,
+    // it is placed around the next pushed frame.
+    bool deferred;
+    uint64_t deferred_pre;
+    uint64_t deferred_post;
+
+    PrerollRing(size_t bytes, size_t max_frames, uint64_t max_age);
+
+    // Returns false if the frame is larger than the arena.
+    bool push(uint64_t number, uint64_t time_stamp, const unsigned char * data, size_t size);
+
+    // Adds the sensor time window [from, until] to the pending window.
+    void extend_window(uint64_t from, uint64_t until);
+
+    // Copies the oldest pending frame into `out`, returns false if there is none.
+    bool copy_pending(PrerollFrame & frame, std::vector<unsigned char> & out);
+
+    // Clears the pending window once a frame past it was pushed and none of its
+    // frames are left to write, returns whether it was cleared.
+    bool finish_window();
+
+    uint64_t latest_time_stamp();
+    size_t buffered_frames();
+    size_t buffered_bytes();
+};
+
+struct PrerollStats{
+    uint64_t buffered_frames;
+    uint64_t buffered_bytes;
+    uint64_t written_frames;
+    uint64_t lost_frames;
+    // Frames which were not buffered because they are larger than the arena.
+    uint64_t dropped_frames;
+    bool recording;
+};
+
+/*
+ * Keeps a pre-roll ring per camera and writes the frames of triggered windows
+ * from a background thread so that capture never waits on storage.
+ *
+ * Supported config values:
+ *  - seconds: length of the pre-roll.
+ *  - bytes: size of the arena per camera in bytes.
+ *  - frames: maximum number of frames kept per camera.
+ */
+class PrerollRecorder{
+public:
+    typedef std::function<void(size_t camera, uint64_t number, const unsigned char * data, size_t size)> Sink;
+
+private:
+    std::vector<std::unique_ptr<PrerollRing>> rings;
+    Sink sink;
+    uint64_t written;
+    uint64_t dropped;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool stopping;
+    std::thread flusher;
+
+    void flush();
+
+public:
+    PrerollRecorder(size_t cameras, float fps, std::unordered_map<std::string,double> config, Sink sink);
+    ~PrerollRecorder();
+
+    void push(size_t camera, uint64_t number, uint64_t time_stamp, const unsigned char * data, size_t size);
+
+    // Writes the frames of the last `pre_seconds` and keeps writing new frames for `post_seconds`.
+    void trigger(double pre_seconds, double post_seconds);
+
+    PrerollStats stats();
+};
@@ -5,16 +5,30 @@
 // INCLUDES
 //----------------------------------------------------------------------------//
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <chrono>
 #include <csignal>
+#include <cstdio>
 #include <cstring>
+#include <deque>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
-#include <list>
+#include <map>
 #include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
 #include <vector>
 
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
 //----------------------------------------------------------------------------//
 // SETTINGS
 //----------------------------------------------------------------------------//
@@ -28,8 +42,30 @@
 // Maximum number of interval timers (including internal)
 #define RAPID_PROFILE_MAX_TIMERS 1024
 
-// Number of interval allocated per chunk
-#define RAPID_PROFILE_CHUNK_SIZE 1048576
+// Number of intervals buffered per thread until they are collected, must be a power of two
+#ifndef RAPID_PROFILE_THREAD_BUFFER_SIZE
+#define RAPID_PROFILE_THREAD_BUFFER_SIZE 16384
+#endif
+
+// Default number of collected intervals kept, older intervals are overwritten, 0 keeps all
+#define RAPID_PROFILE_RING_SIZE 1048576
+
+// Milliseconds between collections by the background collector
+#ifndef RAPID_PROFILE_COLLECT_PERIOD
+#define RAPID_PROFILE_COLLECT_PERIOD 20
+#endif
+
+// Timestamp intervals with the cpu counter (the TSC or cntvct_el0) instead of the
+// steady clock, the counter is converted to the steady clock when the intervals
+// are collected. Assumes the counter runs at a constant rate and is synchronized
+// between cores.
+#ifndef RAPID_PROFILE_COUNTER
+#if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)
+#define RAPID_PROFILE_COUNTER 1
+#else
+#define RAPID_PROFILE_COUNTER 0
+#endif
+#endif
 
 // Thread safety
 #define RAPID_PROFILE_THREAD_SAFE 1
@@ -47,6 +83,12 @@
 #define RAPID_PROFILE_NOW() RapidProfile::type::clock::now()
 #endif
 
+#ifdef RAPID_PROFILE_DISABLE
+#define RAPID_PROFILE_TICKS()
+#else
+#define RAPID_PROFILE_TICKS() RapidProfile::ticks()
+#endif
+
 //----------------------------------------------------------------------------//
 // INIT
 //----------------------------------------------------------------------------//
@@ -63,10 +105,10 @@
 
 #ifdef RAPID_PROFILE_DISABLE
 #define RAPID_PROFILE_INTERVAL_ID(NAME)
-#define RAPID_PROFILE_INTERVAL_INST(NAME)
+#define RAPID_PROFILE_INTERVAL_GUARD(NAME)
 #else
 #define RAPID_PROFILE_INTERVAL_ID(NAME) _rapid_profile_interval_##NAME##_id
-#define RAPID_PROFILE_INTERVAL_INST(NAME) _rapid_profile_interval_##NAME
+#define RAPID_PROFILE_INTERVAL_GUARD(NAME) _rapid_profile_interval_##NAME##_guard
 #endif
 
 //----------------------------------------------------------------------------//
@@ -74,13 +116,13 @@
 #ifdef RAPID_PROFILE_DISABLE
 #define INTERVAL(NAME)
 #else
+// The interval is abandoned if its scope is left before INTERVAL_END, by an
+// exception or an early return. While recording is disabled the clock is not read.
 #define INTERVAL(NAME)                                                                \
     static RapidProfile::type::id RAPID_PROFILE_INTERVAL_ID(NAME) =                   \
         RapidProfile::api<RAPID_PROFILE_STR_SIZE>::get_id(#NAME, __FILE__, __LINE__); \
-    RapidProfile::interval & RAPID_PROFILE_INTERVAL_INST(NAME) =                      \
-        RapidProfile::api<RAPID_PROFILE_STR_SIZE>::get_interval();                    \
-    RAPID_PROFILE_INTERVAL_INST(NAME).id    = RAPID_PROFILE_INTERVAL_ID(NAME);        \
-    RAPID_PROFILE_INTERVAL_INST(NAME).start = RAPID_PROFILE_NOW();
+    RapidProfile::interval_guard<RAPID_PROFILE_STR_SIZE> RAPID_PROFILE_INTERVAL_GUARD( \
+        NAME)(RAPID_PROFILE_INTERVAL_ID(NAME));
 #endif
 
 //----------------------------------------------------------------------------//
@@ -88,7 +130,7 @@
 #ifdef RAPID_PROFILE_DISABLE
 #define INTERVAL_END(NAME)
 #else
-#define INTERVAL_END(NAME) RAPID_PROFILE_INTERVAL_INST(NAME).stop = RAPID_PROFILE_NOW();
+#define INTERVAL_END(NAME) RAPID_PROFILE_INTERVAL_GUARD(NAME).end();
 #endif
 
 //----------------------------------------------------------------------------//
@@ -96,7 +138,17 @@
 #ifdef RAPID_PROFILE_DISABLE
 #define INTERVAL_START(NAME)
 #else
-#define INTERVAL_START(NAME) RAPID_PROFILE_INTERVAL_INST(NAME).start = RAPID_PROFILE_NOW();
+#define INTERVAL_START(NAME) RAPID_PROFILE_INTERVAL_GUARD(NAME).start();
+#endif
+
+//----------------------------------------------------------------------------//
+
+// Sets the flow of the intervals ended on this thread, intervals with the same
+// flow are linked in traces. 0 ends the flow.
+#ifdef RAPID_PROFILE_DISABLE
+#define INTERVAL_FLOW(ID)
+#else
+#define INTERVAL_FLOW(ID) RapidProfile::api<RAPID_PROFILE_STR_SIZE>::set_flow(ID);
 #endif
 
 //----------------------------------------------------------------------------//
@@ -126,7 +178,6 @@
 //----------------------------------------------------------------------------//
 
 #define RAPID_PROFILE_INIT_ID 0
-#define RAPID_PROFILE_RECHUNK_ID 1
 
 //----------------------------------------------------------------------------//
 
@@ -143,28 +194,131 @@ typedef float                       time;
 typedef std::chrono::steady_clock   clock;
 typedef std::chrono::duration<time> duration;
 typedef clock::time_point           time_point;
+typedef uint64_t                    ticks;
 
 }  // namespace type
 
+//----------------------------------------------------------------------------//
+// Ticks
+//----------------------------------------------------------------------------//
+
+// Reads the timestamp of an interval, much cheaper than the steady clock when
+// the cpu counter is used.
+inline type::ticks ticks()
+{
+#if RAPID_PROFILE_COUNTER == 1 && (defined(__x86_64__) || defined(__i386__))
+    return __rdtsc();
+#elif RAPID_PROFILE_COUNTER == 1 && defined(__aarch64__)
+    type::ticks value;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(value));
+    return value;
+#else
+    return type::clock::now().time_since_epoch().count();
+#endif
+}
+
+//----------------------------------------------------------------------------//
+// Timebase
+//----------------------------------------------------------------------------//
+
+// Converts ticks to steady clock time points. The rate of the counter is measured
+// against the steady clock from the moment the timebase is created, and refined
+// with every calibration as the measured span grows.
+class timebase
+{
+  public:
+    //------------------------------------------------------------------------//
+
+    timebase() : ticks_(ticks()), time_(type::clock::now()), period_(0)
+    {
+#if RAPID_PROFILE_COUNTER == 1
+        // A first measurement, so intervals collected right away convert too.
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        calibrate();
+#else
+        period_ = static_cast<double>(type::clock::period::num) * 1e9 / type::clock::period::den;
+#endif
+    }
+
+    //------------------------------------------------------------------------//
+
+    // Measures the rate of the counter over the span since the timebase was created.
+    void calibrate()
+    {
+#if RAPID_PROFILE_COUNTER == 1
+        type::ticks      now_ticks = ticks();
+        type::time_point now       = type::clock::now();
+        if (now_ticks <= ticks_) return;
+        period_ = std::chrono::duration<double, std::nano>(now - time_).count() / (now_ticks - ticks_);
+#endif
+    }
+
+    //------------------------------------------------------------------------//
+
+    type::time_point time(type::ticks value) const
+    {
+        double elapsed = static_cast<double>(static_cast<int64_t>(value - ticks_)) * period_;
+        return time_ + std::chrono::duration_cast<type::clock::duration>(std::chrono::duration<double, std::nano>(elapsed));
+    }
+
+    //------------------------------------------------------------------------//
+
+    type::ticks start_ticks() const
+    {
+        return ticks_;
+    }
+
+    //------------------------------------------------------------------------//
+
+    type::time_point const & start_time() const
+    {
+        return time_;
+    }
+
+    //------------------------------------------------------------------------//
+
+  private:
+    type::ticks      ticks_;
+    type::time_point time_;
+    // Nanoseconds per tick.
+    double period_;
+};
+
 //----------------------------------------------------------------------------//
 // Interval
 //----------------------------------------------------------------------------//
 
 struct interval
 {
-    interval()
+    interval() : flow(0), sequence(0), completed(0), abandoned(false)
     {
     }
-    interval(const type::id id) : id(id), start(RAPID_PROFILE_NOW())
+    interval(const type::id id)
+        : id(id), start(RAPID_PROFILE_TICKS()), flow(0), sequence(0), completed(0), abandoned(false)
     {
     }
-    type::time duration() const
+    interval(const interval & other)
+        : id(other.id),
+          start(other.start),
+          stop(other.stop),
+          flow(other.flow),
+          sequence(other.sequence),
+          completed(other.completed.load(std::memory_order_relaxed)),
+          abandoned(other.abandoned)
     {
-        return type::duration(stop - start).count();
     }
-    type::id         id;
-    type::time_point start;
-    type::time_point stop;
+    type::id    id;
+    type::ticks start;
+    type::ticks stop;
+    uint64_t    flow;
+
+    // Position of the interval in the buffer of its thread, the interval is
+    // complete once `completed` is one past the sequence.
+    uint64_t              sequence;
+    std::atomic<uint64_t> completed;
+    // Set with `completed` for an interval which was left without ending it, the
+    // collector skips it.
+    bool abandoned;
 
     template <size_t N>
     struct tag
@@ -176,80 +330,161 @@ struct interval
 };
 
 //----------------------------------------------------------------------------//
-// Chunker
+// Record
 //----------------------------------------------------------------------------//
 
-template <class T>
-class chunker
+// A completed interval taken from the buffer of a thread by the collector.
+struct record
 {
-  public:
-    //------------------------------------------------------------------------//
+    type::id         id;
+    unsigned int     thread;
+    type::time_point start;
+    type::time_point stop;
+    uint64_t         flow;
 
-    chunker(size_t chunk_size) : chunk_size_(chunk_size), chunk_(NULL)
+    type::time duration() const
     {
-        chunk_ = new std::vector<T>();
-        chunk_->reserve(chunk_size_);
-        chunks_.push_back(chunk_);
-
-        rechunk();
+        return type::duration(stop - start).count();
     }
+};
+
+//----------------------------------------------------------------------------//
+// Stat
+//----------------------------------------------------------------------------//
+
+// Aggregated durations of the completed intervals of one timer, in seconds.
+struct stat
+{
+    std::string name;
+    size_t      count;
+    type::time  mean;
+    type::time  p50;
+    type::time  p90;
+    type::time  p99;
+    type::time  max;
+};
 
+//----------------------------------------------------------------------------//
+// Thread buffer
+//----------------------------------------------------------------------------//
+
+// Ring of intervals written by one thread and drained by the collector.
+//
+// The owning thread only advances `head`, it never waits for the collector. When
+// the collector falls behind the oldest intervals are overwritten, the collector
+// detects this by checking `head` again after copying an interval.
+class thread_buffer
+{
+  public:
     //------------------------------------------------------------------------//
 
-    ~chunker()
+    thread_buffer(unsigned int thread, size_t size)
+        : thread_(thread), mask_(size - 1), entries_(new interval[size]), head_(0), tail_(0), retired_(false)
     {
-        for (typename std::list<std::vector<T> *>::iterator it = chunks_.begin(); it != chunks_.end(); it++) delete *it;
-        chunks_.clear();
+        assert((size & (size - 1)) == 0);
     }
 
     //------------------------------------------------------------------------//
 
-    T & push_back(T const & item = T())
+    ~thread_buffer()
     {
-        if (chunk_->size() + 1 == chunk_size_) rechunk();
-
-        chunk_->push_back(item);
-        return chunk_->back();
+        delete[] entries_;
     }
 
     //------------------------------------------------------------------------//
 
-    std::list<std::vector<T> *> & chunks()
+    // Called by the owning thread only.
+    interval & next()
     {
-        return chunks_;
+        uint64_t   sequence = head_.load(std::memory_order_relaxed);
+        interval & item     = entries_[sequence & mask_];
+
+        // Invalidate the slot before it is rewritten, so a collector copying the
+        // old interval notices the overwrite.
+        item.completed.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        item.sequence  = sequence;
+        item.abandoned = false;
+
+        head_.store(sequence + 1, std::memory_order_release);
+        return item;
     }
 
     //------------------------------------------------------------------------//
 
-  protected:
-    //------------------------------------------------------------------------//
-
-    void rechunk()
+    // Moves the completed intervals to `out` and returns the number of intervals
+    // lost to overwrites. Draining stops at the first interval which is still
+    // running. Called by the collector only.
+    template <class Out>
+    uint64_t drain(Out & out, timebase const & base)
     {
-#if RAPID_PROFILE_INTERNAL == 1
-        interval rechunk_interval(RAPID_PROFILE_RECHUNK_ID);
-#endif
+        uint64_t lost = 0;
+        size_t   size = mask_ + 1;
+        uint64_t head = head_.load(std::memory_order_acquire);
+        if (head - tail_ > size)
+        {
+            lost += head - size - tail_;
+            tail_ = head - size;
+        }
+        while (tail_ < head)
+        {
+            interval & item = entries_[tail_ & mask_];
+            if (item.completed.load(std::memory_order_acquire) != tail_ + 1)
+            {
+                if (head_.load(std::memory_order_acquire) - tail_ > size)
+                {
+                    lost++;
+                    tail_++;
+                    continue;
+                }
+                break;
+            }
 
-        std::vector<T> * prev_chunk = chunk_;
+            record copy;
+            copy.id     = item.id;
+            copy.thread = thread_;
+            copy.start  = base.time(item.start);
+            copy.stop   = base.time(item.stop);
+            copy.flow   = item.flow;
+            bool abandoned = item.abandoned;
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (item.completed.load(std::memory_order_relaxed) != tail_ + 1 ||
+                head_.load(std::memory_order_relaxed) - tail_ > size)
+            {
+                lost++;
+                tail_++;
+                continue;
+            }
+            if (!abandoned) out.push_back(copy);
+            tail_++;
+        }
+        return lost;
+    }
 
-        chunk_ = chunks_.back();
+    //------------------------------------------------------------------------//
 
-        std::vector<T> * next = new std::vector<T>();
-        next->reserve(chunk_size_);
-        chunks_.push_back(next);
+    void retire()
+    {
+        retired_.store(true, std::memory_order_release);
+    }
 
-#if RAPID_PROFILE_INTERNAL == 1
-        rechunk_interval.stop = RAPID_PROFILE_NOW();
-        prev_chunk->push_back(rechunk_interval);
-#endif
+    //------------------------------------------------------------------------//
+
+    bool retired() const
+    {
+        return retired_.load(std::memory_order_acquire);
     }
 
     //------------------------------------------------------------------------//
 
   private:
-    size_t                      chunk_size_;
-    std::vector<T> *            chunk_;
-    std::list<std::vector<T> *> chunks_;
+    unsigned int          thread_;
+    size_t                mask_;
+    interval *            entries_;
+    std::atomic<uint64_t> head_;
+    uint64_t              tail_;
+    std::atomic<bool>     retired_;
 };
 
 //----------------------------------------------------------------------------//
@@ -262,62 +497,277 @@ class api
   public:
     //------------------------------------------------------------------------//
 
+    // Enables recording and logs the intervals to csv files at exit, for
+    // standalone programs.
     static void init()
     {
-#if RAPID_PROFILE_INTERNAL == 1
-        RapidProfile::type::time_point const & start = start_time();
-#else
-        start_time();
-#endif
+        timebase const & base = api::base();
 
-        tags().reserve(RAPID_PROFILE_MAX_TIMERS);
+        enable(true);
 
 #if RAPID_PROFILE_INTERNAL == 1
-        assert(RAPID_PROFILE_INIT_ID == get_id("RAPID_PROFILE_INIT", __FILE__, __LINE__));
-        assert(RAPID_PROFILE_RECHUNK_ID == get_id("RAPID_PROFILE_RECHUNK", __FILE__, __LINE__));
-
         interval & startup_interval = get_interval();
         startup_interval.id         = RAPID_PROFILE_INIT_ID;
-        startup_interval.start      = start;
+        startup_interval.start      = base.start_ticks();
 #endif
 
         std::atexit(api::exit);
         ::signal(SIGINT, api::signal);
 
 #if RAPID_PROFILE_INTERNAL == 1
-        startup_interval.stop = RAPID_PROFILE_NOW();
+        end(startup_interval);
 #endif
     }
 
     //------------------------------------------------------------------------//
 
+    // Starts or stops recording intervals at runtime, recording is disabled until
+    // enabled or init is called. Intervals placed while disabled are discarded.
+    // Enabling starts a background thread which collects the intervals of all threads.
+    static void enable(bool enabled)
+    {
+        base();
+        if (enabled) start_collector();
+        enabled_flag().store(enabled, std::memory_order_relaxed);
+    }
+
+    //------------------------------------------------------------------------//
+
+    static bool enabled()
+    {
+        return enabled_flag().load(std::memory_order_relaxed);
+    }
+
+    //------------------------------------------------------------------------//
+
+    // Sets the number of collected intervals which are kept, once full the oldest
+    // intervals are overwritten. 0 keeps all intervals.
+    static void set_ring_size(size_t size)
+    {
+        std::lock_guard<std::mutex> guard(collect_mutex());
+        ring_size() = size;
+        trim();
+    }
+
+    //------------------------------------------------------------------------//
+
+    // Moves the completed intervals of all threads to the collected intervals.
+    static void collect()
+    {
+        std::lock_guard<std::mutex> guard(collect_mutex());
+        std::vector<thread_buffer *> & buffers = api::buffers();
+        size_t                         first   = records().size();
+        timebase &                     base    = api::base();
+        base.calibrate();
+        for (size_t i = 0; i < buffers.size();)
+        {
+            // Check before draining, a retired thread does not write anymore.
+            bool retired = buffers[i]->retired();
+            lost() += buffers[i]->drain(records(), base);
+            if (retired)
+            {
+                delete buffers[i];
+                buffers.erase(buffers.begin() + i);
+                continue;
+            }
+            i++;
+        }
+        if (trace().active) write_trace_events(records().begin() + first, records().end());
+        trim();
+    }
+
+    //------------------------------------------------------------------------//
+
+    // Number of intervals overwritten before they were collected.
+    static uint64_t lost_intervals()
+    {
+        std::lock_guard<std::mutex> guard(collect_mutex());
+        return lost();
+    }
+
+    //------------------------------------------------------------------------//
+
+    // Aggregates the intervals completed since the last reset per timer.
+    static std::vector<stat> stats()
+    {
+        collect();
+
+        std::vector<std::vector<type::time> > durations;
+        {
+            std::lock_guard<std::mutex> guard(collect_mutex());
+            std::deque<record> & records = api::records();
+            for (std::deque<record>::iterator it = records.begin(); it != records.end(); it++)
+            {
+                if (it->start < window_start()) continue;
+                if (durations.size() <= it->id) durations.resize(it->id + 1);
+                durations[it->id].push_back(it->duration());
+            }
+        }
+
+        // Timers placed at more than one site share their name.
+        std::map<std::string, std::vector<type::time> > merged;
+        {
+            RAPID_PROFILE_MUTEX_GUARD(tag_mutex);
+            for (size_t id = 0; id < durations.size(); id++)
+            {
+                if (durations[id].empty()) continue;
+                std::vector<type::time> & values = merged[tags()[id].name];
+                values.insert(values.end(), durations[id].begin(), durations[id].end());
+            }
+        }
+
+        std::vector<stat> res;
+        for (std::map<std::string, std::vector<type::time> >::iterator it = merged.begin(); it != merged.end(); it++)
+        {
+            std::vector<type::time> & values = it->second;
+            std::sort(values.begin(), values.end());
+            type::time sum = 0;
+            for (size_t i = 0; i < values.size(); i++) sum += values[i];
+            stat s;
+            s.name  = it->first;
+            s.count = values.size();
+            s.mean  = sum / values.size();
+            s.p50   = percentile(values, 0.5);
+            s.p90   = percentile(values, 0.9);
+            s.p99   = percentile(values, 0.99);
+            s.max   = values.back();
+            res.push_back(s);
+        }
+        return res;
+    }
+
+    //------------------------------------------------------------------------//
+
+    // Starts a new window for stats, earlier intervals are no longer aggregated.
+    static void reset()
+    {
+        std::lock_guard<std::mutex> guard(collect_mutex());
+        window_start() = RAPID_PROFILE_NOW();
+    }
+
+    //------------------------------------------------------------------------//
+
+    // Returns an interval in the buffer of the calling thread, which is collected
+    // once it is ended.
     static interval & get_interval()
     {
-        RAPID_PROFILE_MUTEX_GUARD(interval_mutex);
+        if (!enabled())
+        {
+            // Timers still need an interval to write to while disabled.
+            static thread_local interval discarded;
+            return discarded;
+        }
+
+        return local_buffer().next();
+    }
+
+    //------------------------------------------------------------------------//
+
+    // Starts an interval of timer `id` in the buffer of the calling thread, or
+    // returns NULL without reading the timestamp while recording is disabled.
+    static interval * begin(type::id id)
+    {
+        if (!enabled()) return NULL;
+        interval & item = local_buffer().next();
+        item.id         = id;
+        item.start      = RAPID_PROFILE_TICKS();
+        return &item;
+    }
+
+    //------------------------------------------------------------------------//
 
-        return intervals().push_back();
+    static void end(interval & item)
+    {
+        item.stop = RAPID_PROFILE_TICKS();
+        item.flow = current_flow();
+        item.completed.store(item.sequence + 1, std::memory_order_release);
     }
 
     //------------------------------------------------------------------------//
 
-    static type::id get_id(const char * name, const char * file, int line)
+    // Completes an interval without recording it.
+    static void abandon(interval & item)
     {
-        static type::id id = 0;
+        item.abandoned = true;
+        item.completed.store(item.sequence + 1, std::memory_order_release);
+    }
 
+    //------------------------------------------------------------------------//
+
+    static type::id get_id(const char * name, const char * file, int line)
+    {
         RAPID_PROFILE_MUTEX_GUARD(tag_mutex);
 
-        tags().push_back(interval::tag<N>());
-        interval::tag<N> & tag = tags().back();
+        return add_tag(tags(), name, file, line);
+    }
 
-        strncpy(tag.name, name, N);
-        tag.name[N - 1] = '\0';
+    //------------------------------------------------------------------------//
 
-        strncpy(tag.file, file, N);
-        tag.file[N - 1] = '\0';
+    static void set_flow(uint64_t flow)
+    {
+        current_flow() = flow;
+    }
 
-        tag.line = line;
+    //------------------------------------------------------------------------//
 
-        return id++;
+    // Flow of the calling thread, to hand over to the thread continuing the flow.
+    static uint64_t get_flow()
+    {
+        return current_flow();
+    }
+
+    //------------------------------------------------------------------------//
+
+    // Streams the intervals collected from now on to `path` as chrome trace events,
+    // which can be opened in chrome://tracing or Perfetto. Enables recording.
+    //
+    // With `max_bytes` set the trace rolls over to a new file once a file exceeds
+    // it, the files are numbered before the extension: trace.0.json, trace.1.json, ...
+    // With `max_files` set only the newest files are kept.
+    static void start_trace(std::string const & path, size_t max_bytes = 0, size_t max_files = 0)
+    {
+        enable(true);
+        // Intervals completed before the start belong to no trace.
+        collect();
+
+        std::lock_guard<std::mutex> guard(collect_mutex());
+        close_trace_file();
+        trace_state & trace = api::trace();
+        trace.path          = path;
+        trace.max_bytes     = max_bytes;
+        trace.max_files     = max_files;
+        trace.index         = 0;
+        trace.active        = open_trace_file();
+        if (!trace.active) throw std::runtime_error("could not open trace file `" + trace_path(0) + "`");
+    }
+
+    //------------------------------------------------------------------------//
+
+    // Writes the intervals collected so far and finishes the current trace file.
+    static void stop_trace()
+    {
+        collect();
+
+        std::lock_guard<std::mutex> guard(collect_mutex());
+        close_trace_file();
+        trace().active = false;
+    }
+
+    //------------------------------------------------------------------------//
+
+    // Writes all collected intervals to `path` as a single chrome trace.
+    static void write_trace(std::string const & path)
+    {
+        collect();
+
+        std::ofstream file(path.c_str());
+        if (!file) throw std::runtime_error("could not open trace file `" + path + "`");
+
+        std::lock_guard<std::mutex> guard(collect_mutex());
+        file << '[';
+        bool first = true;
+        write_events(file, records().begin(), records().end(), first);
+        file << "\n]\n";
     }
 
     //------------------------------------------------------------------------//
@@ -327,14 +777,133 @@ class api
 
     static void exit()
     {
+        stop_trace();
         log();
     }
 
     //------------------------------------------------------------------------//
 
+    // Only flags the interrupt, the collector thread exits the process outside of
+    // the signal handler. A second interrupt terminates immediately.
     static void signal(int signum)
     {
-        ::exit(signum);
+        interrupted() = signum;
+        ::signal(signum, SIG_DFL);
+    }
+
+    //------------------------------------------------------------------------//
+
+    static std::string trace_path(size_t index)
+    {
+        trace_state & trace = api::trace();
+        if (trace.max_bytes == 0) return trace.path;
+
+        size_t dot   = trace.path.rfind('.');
+        size_t slash = trace.path.rfind('/');
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) dot = trace.path.size();
+        return trace.path.substr(0, dot) + '.' + std::to_string(index) + trace.path.substr(dot);
+    }
+
+    //------------------------------------------------------------------------//
+
+    // Opens the trace file of the current index, requires the collect mutex.
+    static bool open_trace_file()
+    {
+        trace_state & trace = api::trace();
+        trace.file.open(trace_path(trace.index).c_str(), std::ios::out | std::ios::trunc);
+        if (!trace.file) return false;
+        trace.first = true;
+        trace.file << '[';
+        if (trace.max_files != 0 && trace.index >= trace.max_files)
+        {
+            std::remove(trace_path(trace.index - trace.max_files).c_str());
+        }
+        return true;
+    }
+
+    //------------------------------------------------------------------------//
+
+    static void close_trace_file()
+    {
+        trace_state & trace = api::trace();
+        if (!trace.file.is_open()) return;
+        trace.file << "\n]\n";
+        trace.file.close();
+    }
+
+    //------------------------------------------------------------------------//
+
+    // Appends collected intervals to the running trace, rolling over to the next
+    // file when the current one is full. Requires the collect mutex.
+    template <class It>
+    static void write_trace_events(It begin, It end)
+    {
+        trace_state & trace = api::trace();
+        if (begin == end) return;
+        if (trace.max_bytes != 0 && static_cast<size_t>(trace.file.tellp()) >= trace.max_bytes)
+        {
+            close_trace_file();
+            trace.index++;
+            trace.active = open_trace_file();
+            if (!trace.active) return;
+        }
+        write_events(trace.file, begin, end, trace.first);
+        trace.file.flush();
+    }
+
+    //------------------------------------------------------------------------//
+
+    // Writes intervals as complete events in microseconds since the start. Intervals
+    // of the same flow are bound to each other, which links them across threads.
+    template <class It>
+    static void write_events(std::ostream & out, It begin, It end, bool & first)
+    {
+        RAPID_PROFILE_MUTEX_GUARD(tag_mutex);
+        std::vector<interval::tag<N> > & tags = api::tags();
+        static const long                pid  = ::getpid();
+
+        out << std::fixed << std::setprecision(3);
+
+        for (It it = begin; it != end; it++)
+        {
+            out << (first ? "\n" : ",\n");
+            first = false;
+            out << "{\"name\":\"" << tags[it->id].name << "\",\"cat\":\"rapid_profile\",\"ph\":\"X\""
+                << ",\"pid\":" << pid << ",\"tid\":" << it->thread << ",\"ts\":" << relative(it->start) * 1e6
+                << ",\"dur\":" << relative(it->stop, it->start) * 1e6;
+            if (it->flow != 0)
+            {
+                out << ",\"bind_id\":\"0x" << std::hex << it->flow << std::dec
+                    << "\",\"flow_in\":true,\"flow_out\":true";
+            }
+            out << '}';
+        }
+    }
+
+    //------------------------------------------------------------------------//
+
+    static type::time percentile(std::vector<type::time> const & sorted, double fraction)
+    {
+        size_t index = static_cast<size_t>(fraction * (sorted.size() - 1) + 0.5);
+        return sorted[index];
+    }
+
+    //------------------------------------------------------------------------//
+
+    static type::id add_tag(std::vector<interval::tag<N> > & tags, const char * name, const char * file, int line)
+    {
+        tags.push_back(interval::tag<N>());
+        interval::tag<N> & tag = tags.back();
+
+        strncpy(tag.name, name, N);
+        tag.name[N - 1] = '\0';
+
+        strncpy(tag.file, file, N);
+        tag.file[N - 1] = '\0';
+
+        tag.line = line;
+
+        return tags.size() - 1;
     }
 
     //------------------------------------------------------------------------//
@@ -349,10 +918,11 @@ class api
 
     static void log()
     {
+        collect();
+
         std::ofstream file;
 
-        std::vector<interval::tag<N> > &     tags   = api::tags();
-        std::list<std::vector<interval> *> & chunks = intervals().chunks();
+        std::vector<interval::tag<N> > & tags = api::tags();
 
         file.open("tags.rp.csv");
         file << "id,name,file,line" << std::endl;
@@ -362,50 +932,265 @@ class api
         }
         file.close();
 
+        std::lock_guard<std::mutex> guard(collect_mutex());
+        std::deque<record> &        records = api::records();
+
         file.open("intervals.rp.csv");
         file << "id,start,stop,duration" << std::endl;
-        for (std::list<std::vector<interval> *>::iterator it = chunks.begin(); it != chunks.end(); it++)
+        for (std::deque<record>::iterator it = records.begin(); it != records.end(); it++)
         {
-            for (std::vector<interval>::iterator vit = (*it)->begin(); vit != (*it)->end(); vit++)
-            {
-                file << vit->id << ',' << relative(vit->start) * 1e6 << ',' << relative(vit->stop) * 1e6 << ','
-                     << relative(vit->stop, vit->start) * 1e6 << std::endl;
-            }
+            file << it->id << ',' << relative(it->start) * 1e6 << ',' << relative(it->stop) * 1e6 << ','
+                 << relative(it->stop, it->start) * 1e6 << std::endl;
         }
         file.close();
     }
 
+    //------------------------------------------------------------------------//
+
+    // Drops the oldest collected intervals beyond the ring size, requires the collect mutex.
+    static void trim()
+    {
+        std::deque<record> & records = api::records();
+        if (ring_size() != 0 && records.size() > ring_size())
+        {
+            records.erase(records.begin(), records.begin() + (records.size() - ring_size()));
+        }
+    }
+
+    //------------------------------------------------------------------------//
+
+    static void start_collector()
+    {
+        static std::once_flag started;
+        std::call_once(started, []() {
+            std::thread([]() {
+                while (true)
+                {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(RAPID_PROFILE_COLLECT_PERIOD));
+                    if (interrupted() != 0) ::exit(interrupted());
+                    collect();
+                }
+            }).detach();
+        });
+    }
+
+    //------------------------------------------------------------------------//
+
+    // Marks the buffer of a thread as retired when the thread exits, the
+    // collector frees it after collecting its last intervals.
+    struct thread_handle
+    {
+        thread_handle()
+        {
+            std::lock_guard<std::mutex> guard(collect_mutex());
+            buffer = new thread_buffer(next_thread()++, RAPID_PROFILE_THREAD_BUFFER_SIZE);
+            buffers().push_back(buffer);
+        }
+        ~thread_handle()
+        {
+            buffer->retire();
+        }
+        thread_buffer * buffer;
+    };
+
+    //------------------------------------------------------------------------//
+
+    // The pointer is constant initialized, which keeps the thread local init
+    // check of the handle off the path of every interval.
+    static thread_buffer & local_buffer()
+    {
+        static thread_local thread_buffer * buffer = NULL;
+        if (buffer == NULL)
+        {
+            static thread_local thread_handle handle;
+            buffer = handle.buffer;
+        }
+        return *buffer;
+    }
+
+    //------------------------------------------------------------------------//
+
   private:
     //------------------------------------------------------------------------//
 
-    RAPID_PROFILE_MUTEX(interval_mutex);
     RAPID_PROFILE_MUTEX(tag_mutex);
 
     //------------------------------------------------------------------------//
 
+    // The collector state is never freed, the detached collector thread can still
+    // use it while the process exits.
+    static std::mutex & collect_mutex()
+    {
+        static std::mutex * mutex = new std::mutex();
+        return *mutex;
+    }
+
+    //------------------------------------------------------------------------//
+
+    static std::vector<thread_buffer *> & buffers()
+    {
+        static std::vector<thread_buffer *> * buffers = new std::vector<thread_buffer *>();
+        return *buffers;
+    }
+
+    //------------------------------------------------------------------------//
+
+    static std::deque<record> & records()
+    {
+        static std::deque<record> * records = new std::deque<record>();
+        return *records;
+    }
+
+    //------------------------------------------------------------------------//
+
+    static size_t & ring_size()
+    {
+        static size_t * size = new size_t(RAPID_PROFILE_RING_SIZE);
+        return *size;
+    }
+
+    //------------------------------------------------------------------------//
+
+    static uint64_t & lost()
+    {
+        static uint64_t * lost = new uint64_t(0);
+        return *lost;
+    }
+
+    //------------------------------------------------------------------------//
+
+    static unsigned int & next_thread()
+    {
+        static unsigned int * next = new unsigned int(0);
+        return *next;
+    }
+
+    //------------------------------------------------------------------------//
+
     static type::time_point const & start_time()
     {
-        static type::time_point start_time = RAPID_PROFILE_NOW();
-        return start_time;
+        return base().start_time();
     }
 
     //------------------------------------------------------------------------//
 
-    static std::vector<interval::tag<N> > & tags()
+    // Calibrated by the collector, requires the collect mutex once created.
+    static timebase & base()
+    {
+        static timebase * base = new timebase();
+        return *base;
+    }
+
+    //------------------------------------------------------------------------//
+
+    static std::atomic<bool> & enabled_flag()
     {
-        static std::vector<interval::tag<N> > tags;
-        return tags;
+        static std::atomic<bool> enabled(false);
+        return enabled;
     }
 
     //------------------------------------------------------------------------//
 
-    static chunker<interval> & intervals()
+    static type::time_point & window_start()
     {
-        static chunker<interval> * intervals = new chunker<interval>(RAPID_PROFILE_CHUNK_SIZE);
-        return *intervals;
+        static type::time_point * window_start = new type::time_point();
+        return *window_start;
     }
 
     //------------------------------------------------------------------------//
+
+    struct trace_state
+    {
+        trace_state() : active(false), first(true), max_bytes(0), max_files(0), index(0)
+        {
+        }
+        bool          active;
+        bool          first;
+        std::string   path;
+        size_t        max_bytes;
+        size_t        max_files;
+        size_t        index;
+        std::ofstream file;
+    };
+
+    static trace_state & trace()
+    {
+        static trace_state * trace = new trace_state();
+        return *trace;
+    }
+
+    //------------------------------------------------------------------------//
+
+    static uint64_t & current_flow()
+    {
+        static thread_local uint64_t flow = 0;
+        return flow;
+    }
+
+    //------------------------------------------------------------------------//
+
+    static volatile std::sig_atomic_t & interrupted()
+    {
+        static volatile std::sig_atomic_t interrupted = 0;
+        return interrupted;
+    }
+
+    //------------------------------------------------------------------------//
+
+    // The internal timers always take the first ids, whichever timer is placed first.
+    // Never freed, the tags are still needed when logging at exit.
+    static std::vector<interval::tag<N> > & tags()
+    {
+        static std::vector<interval::tag<N> > * tags = []() {
+            std::vector<interval::tag<N> > * tags = new std::vector<interval::tag<N> >();
+            tags->reserve(RAPID_PROFILE_MAX_TIMERS);
+            add_tag(*tags, "RAPID_PROFILE_INIT", __FILE__, __LINE__);
+            return tags;
+        }();
+        return *tags;
+    }
+
+    //------------------------------------------------------------------------//
+};
+
+//----------------------------------------------------------------------------//
+// Interval guard
+//----------------------------------------------------------------------------//
+
+// Ends the interval of INTERVAL at INTERVAL_END. When the scope is left before,
+// the interval is abandoned, so the collector does not stop draining at it.
+//
+// The guard only takes an interval when recording is enabled as it starts, so a
+// disabled timer costs a relaxed load and never reads the clock.
+template <size_t N>
+class interval_guard
+{
+  public:
+    explicit interval_guard(type::id id) : item_(api<N>::begin(id)), ended_(false)
+    {
+    }
+    interval_guard(const interval_guard &) = delete;
+    interval_guard & operator=(const interval_guard &) = delete;
+
+    ~interval_guard()
+    {
+        if (item_ != NULL && !ended_) api<N>::abandon(*item_);
+    }
+
+    void start()
+    {
+        if (item_ != NULL) item_->start = RAPID_PROFILE_TICKS();
+    }
+
+    void end()
+    {
+        if (item_ != NULL && !ended_) api<N>::end(*item_);
+        ended_ = true;
+    }
+
+  private:
+    interval * item_;
+    bool       ended_;
 };
 
 //----------------------------------------------------------------------------//
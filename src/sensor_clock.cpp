@@ -0,0 +1,89 @@
+#include "sensor_clock.hpp"
+
+#include <algorithm>
+
+#include <time.h>
+
+static uint64_t clock_ns(clockid_t clock){
+    timespec time;
+    clock_gettime(clock,&time);
+    return (uint64_t)time.tv_sec * 1000000000ull + time.tv_nsec;
+}
+
+uint64_t monotonic_ns(){
+    return clock_ns(CLOCK_MONOTONIC);
+}
+
+uint64_t realtime_ns(){
+    return clock_ns(CLOCK_REALTIME);
+}
+
+static const size_t window_seconds = 32;
+static const int64_t same_clock_limit = 1000000000;
+
+SensorClock::SensorClock()
+    : same_clock(true), reference(0), offset(0.0), drift(0.0)
+{
+}
+
+void SensorClock::observe(uint64_t sensor_ns, uint64_t acquired_ns){
+    std::lock_guard<std::mutex> guard(this->mutex);
+    int64_t offset = (int64_t)(acquired_ns - sensor_ns);
+    uint64_t second = sensor_ns / 1000000000ull;
+    if(!this->minima.empty() && this->minima.back().second == second){
+        auto & minimum = this->minima.back();
+        if(offset >= minimum.offset){
+            return;
+        }
+        minimum.sensor_ns = sensor_ns;
+        minimum.offset = offset;
+    }else{
+        // A sensor time stamp going backwards means the sensor clock was reset.
+        if(!this->minima.empty() && this->minima.back().second > second){
+            this->minima.clear();
+        }
+        this->minima.push_back({second,sensor_ns,offset});
+        if(this->minima.size() > window_seconds){
+            this->minima.pop_front();
+        }
+    }
+    this->fit();
+}
+
+void SensorClock::fit(){
+    int64_t smallest = this->minima.front().offset;
+    for(auto & minimum: this->minima){
+        smallest = std::min(smallest,minimum.offset);
+    }
+    this->same_clock = smallest >= 0 && smallest < same_clock_limit;
+    this->reference = this->minima.back().sensor_ns;
+    if(this->same_clock || this->minima.size() < 2){
+        this->offset = this->minima.back().offset;
+        this->drift = 0.0;
+        return;
+    }
+
+    // Least squares fit relative to the newest minimum to keep the values small.
+    double n = this->minima.size();
+    double sum_x = 0.0, sum_y = 0.0, sum_xx = 0.0, sum_xy = 0.0;
+    for(auto & minimum: this->minima){
+        double x = (double)(int64_t)(minimum.sensor_ns - this->reference);
+        double y = (double)(minimum.offset - smallest);
+        sum_x += x;
+        sum_y += y;
+        sum_xx += x * x;
+        sum_xy += x * y;
+    }
+    double denominator = n * sum_xx - sum_x * sum_x;
+    this->drift = denominator != 0.0 ? (n * sum_xy - sum_x * sum_y) / denominator : 0.0;
+    this->offset = (sum_y - this->drift * sum_x) / n + smallest;
+}
+
+uint64_t SensorClock::to_monotonic(uint64_t sensor_ns){
+    std::lock_guard<std::mutex> guard(this->mutex);
+    if(this->same_clock){
+        return sensor_ns;
+    }
+    double x = (double)(int64_t)(sensor_ns - this->reference);
+    return sensor_ns + (int64_t)(this->offset + this->drift * x);
+}
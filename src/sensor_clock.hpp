@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+// Current time of CLOCK_MONOTONIC and CLOCK_REALTIME in nanoseconds.
+uint64_t monotonic_ns();
+uint64_t realtime_ns();
+
+/*
+ * Maps sensor time stamps of a camera to CLOCK_MONOTONIC.
+ *
+ * Every acquired frame gives a pair of its sensor time stamp and the monotonic time
+ * it was acquired at. The difference is the clock offset plus the delay of the
+ * frame, so the smallest difference per second of sensor time is kept and a line is
+ * fitted through the minima of the last 32 seconds, which corrects for drift between
+ * the clocks.
+ *
+ * Argus usually reports sensor time stamps on CLOCK_MONOTONIC already. If the sensor
+ * time stamps are less than a second behind the acquisition times they are taken as
+ * monotonic time as they are, so the age of a frame includes its readout.
+ */
+class SensorClock{
+    struct Minimum{
+        uint64_t second;
+        uint64_t sensor_ns;
+        int64_t offset;
+    };
+
+    std::mutex mutex;
+    std::deque<Minimum> minima;
+    bool same_clock;
+    // Fitted offset at `reference`, and its change per nanosecond of sensor time.
+    uint64_t reference;
+    double offset;
+    double drift;
+
+    void fit();
+
+public:
+    SensorClock();
+
+    // Adds a frame with sensor time stamp `sensor_ns` acquired at the monotonic time `acquired_ns`.
+    void observe(uint64_t sensor_ns, uint64_t acquired_ns);
+
+    // Returns the monotonic time of a sensor time stamp, the sensor time stamp itself
+    // until a frame was observed.
+    uint64_t to_monotonic(uint64_t sensor_ns);
+};
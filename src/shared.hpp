@@ -0,0 +1,49 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+
+/*
+ * A process wide instance shared by reference count.
+ *
+ * The instance is created on the first acquire. A reference is kept between users
+ * so the next user does not pay for creating it again, until it is released.
+ */
+template<class T>
+class SharedInstance{
+    std::function<std::shared_ptr<T>()> create;
+
+    std::mutex mutex;
+    std::weak_ptr<T> instance;
+    std::shared_ptr<T> kept;
+
+public:
+    SharedInstance(std::function<std::shared_ptr<T>()> create): create(std::move(create)) {}
+
+    std::shared_ptr<T> acquire(){
+        std::lock_guard<std::mutex> guard(this->mutex);
+        auto res = this->instance.lock();
+        if(!res){
+            res = this->create();
+            this->instance = res;
+        }
+        this->kept = res;
+        return res;
+    }
+
+    // Drops the kept reference, the instance is destroyed once its last user releases it.
+    void release(){
+        std::shared_ptr<T> kept;
+        {
+            std::lock_guard<std::mutex> guard(this->mutex);
+            kept = std::move(this->kept);
+        }
+    }
+
+    // Whether an instance is alive.
+    bool alive(){
+        std::lock_guard<std::mutex> guard(this->mutex);
+        return !this->instance.expired();
+    }
+};
@@ -0,0 +1,163 @@
+#include "staging.hpp"
+#include "config.hpp"
+#include "profile.hpp"
+
+#include <fstream>
+
+using namespace std::chrono;
+
+bool write_file(const fs::path & path, const unsigned char * data, size_t size){
+    INTERVAL(file_write);
+    std::fstream s(path, s.binary | s.trunc | s.out);
+    s.write((const char *)data,size);
+    s.flush();
+    bool good = s.good();
+    s.close();
+    INTERVAL_END(file_write);
+    return good;
+}
+
+StagingWriter::StagingWriter(std::unordered_map<std::string,double> config, LatencyHistogram * write_latency,
+        StreamMetrics * metrics)
+    : write_latency(write_latency),
+    metrics(metrics)
+{
+    double budget = config_value(config,"staging","budget",256.0 * 1024 * 1024,1.0,1e15);
+    double high = config_value(config,"staging","high_watermark",0.9,0.0,1.0);
+    double low = config_value(config,"staging","low_watermark",0.7,0.0,high);
+    this->rate = config_value(config,"staging","rate",0.0,0.0,1e15);
+    double policy = config_value(config,"staging","drop",0.0,0.0,1.0);
+
+    this->budget = budget;
+    this->high_watermark = budget * high;
+    this->low_watermark = budget * low;
+    this->policy = policy == 0.0 ? DropPolicy::Newest : DropPolicy::Oldest;
+    this->counters = {};
+    this->stopping = false;
+
+    this->migrator = std::thread(&StagingWriter::migrate,this);
+}
+
+StagingWriter::~StagingWriter(){
+    {
+        std::lock_guard<std::mutex> guard(this->mutex);
+        this->stopping = true;
+    }
+    this->cond.notify_all();
+    this->migrator.join();
+}
+
+bool StagingWriter::push(fs::path path, const unsigned char * data, size_t size){
+    Entry entry{
+        std::move(path),
+        std::vector<unsigned char>(data,data + size),
+        steady_clock::now(),
+        RapidProfile::api<RAPID_PROFILE_STR_SIZE>::get_flow(),
+    };
+
+    std::lock_guard<std::mutex> guard(this->mutex);
+    if(this->counters.staged_bytes + size > this->high_watermark || size > this->budget){
+        this->counters.dropping = true;
+    }
+    if(this->counters.dropping){
+        if(this->policy == DropPolicy::Newest || size > this->low_watermark){
+            this->counters.dropped_files += 1;
+            this->counters.dropped_bytes += size;
+            return false;
+        }
+        // Make room by dropping the oldest frames which have not yet been migrated.
+        while(!this->queue.empty() && this->counters.staged_bytes + size > this->low_watermark){
+            auto dropped = this->queue.front().data.size();
+            this->queue.pop_front();
+            this->counters.staged_bytes -= dropped;
+            this->counters.staged_files -= 1;
+            this->counters.dropped_files += 1;
+            this->counters.dropped_bytes += dropped;
+        }
+        this->counters.dropping = false;
+    }
+    this->counters.staged_bytes += size;
+    this->counters.staged_files += 1;
+    this->queue.push_back(std::move(entry));
+    this->cond.notify_all();
+    return true;
+}
+
+void StagingWriter::migrate(){
+    auto next_write = steady_clock::now();
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while(true){
+        this->cond.wait(lock,[this]{ return this->stopping || !this->queue.empty(); });
+        if(this->queue.empty()){
+            return;
+        }
+        if(!this->stopping && this->rate > 0.0){
+            this->cond.wait_until(lock,next_write,[this]{ return this->stopping; });
+            if(this->queue.empty()){
+                continue;
+            }
+        }
+
+        // Keep the entry accounted as staged until it is written so the budget
+        // reflects the memory actually in use.
+        Entry entry = std::move(this->queue.front());
+        this->queue.pop_front();
+        this->in_flight = entry.staged_at;
+        lock.unlock();
+
+        INTERVAL_FLOW(entry.flow);
+        auto write_start = steady_clock::now();
+        bool written = write_file(entry.path,entry.data.data(),entry.data.size());
+        if(this->write_latency){
+            this->write_latency->record_since(write_start);
+        }
+
+        lock.lock();
+        this->in_flight.reset();
+        if(!written){
+            this->counters.failed_writes += 1;
+            if(!this->stopping){
+                // Storage is unavailable or full, keep the data staged and retry later.
+                this->queue.push_front(std::move(entry));
+                this->cond.wait_for(lock,milliseconds(100),[this]{ return this->stopping; });
+                continue;
+            }
+            this->counters.dropped_files += 1;
+            this->counters.dropped_bytes += entry.data.size();
+        }else{
+            this->counters.migrated_files += 1;
+            this->counters.migrated_bytes += entry.data.size();
+            if(this->metrics){
+                this->metrics->written_files.fetch_add(1,std::memory_order_relaxed);
+                this->metrics->written_bytes.fetch_add(entry.data.size(),std::memory_order_relaxed);
+            }
+        }
+        this->counters.staged_bytes -= entry.data.size();
+        this->counters.staged_files -= 1;
+        if(this->counters.dropping && this->counters.staged_bytes <= this->low_watermark){
+            this->counters.dropping = false;
+        }
+        if(this->rate > 0.0){
+            auto now = steady_clock::now();
+            if(next_write < now){
+                next_write = now;
+            }
+            next_write += duration_cast<steady_clock::duration>(duration<double>(entry.data.size() / this->rate));
+        }
+        this->cond.notify_all();
+    }
+}
+
+StagingStats StagingWriter::stats(){
+    std::lock_guard<std::mutex> guard(this->mutex);
+    StagingStats res = this->counters;
+    res.migration_lag_ns = 0;
+    std::optional<steady_clock::time_point> oldest = this->in_flight;
+    if(!oldest && !this->queue.empty()){
+        oldest = this->queue.front().staged_at;
+    }
+    if(oldest){
+        res.migration_lag_ns = duration_cast<nanoseconds>(steady_clock::now() - *oldest).count();
+    }
+    return res;
+}
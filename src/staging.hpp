@@ -0,0 +1,93 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "filesystem.hpp"
+#include "histogram.hpp"
+#include "metrics.hpp"
+
+namespace fs = ghc::filesystem;
+
+// Writes a complete file to disk, returns false if the file could not be written.
+bool write_file(const fs::path & path, const unsigned char * data, size_t size);
+
+struct StagingStats{
+    uint64_t staged_bytes;
+    uint64_t staged_files;
+    uint64_t migrated_bytes;
+    uint64_t migrated_files;
+    uint64_t dropped_bytes;
+    uint64_t dropped_files;
+    uint64_t failed_writes;
+    // Time the oldest staged file has been waiting for migration.
+    uint64_t migration_lag_ns;
+    bool dropping;
+};
+
+enum class DropPolicy{
+    Newest = 0,
+    Oldest = 1,
+};
+
+/*
+ * A memory staging tier in front of slow storage.
+ *
+ * Files pushed into the writer are copied into memory and moved to their final
+ * path by a background migrator thread at a limited rate. Once the staged bytes reach
+ * the high watermark the drop policy is applied until the staged bytes fall below
+ * the low watermark again.
+ *
+ * Supported config values:
+ *  - budget: size of the memory tier in bytes.
+ *  - rate: maximum migration rate in bytes per second, 0 for unlimited.
+ *  - high_watermark: fraction of the budget at which frames are dropped.
+ *  - low_watermark: fraction of the budget at which dropping stops.
+ *  - drop: 0 drops the newest frames, 1 drops the oldest staged frames.
+ */
+class StagingWriter{
+    struct Entry{
+        fs::path path;
+        std::vector<unsigned char> data;
+        std::chrono::steady_clock::time_point staged_at;
+        // Profile flow of the frame, continued by the migrator.
+        uint64_t flow;
+    };
+
+    uint64_t budget;
+    uint64_t high_watermark;
+    uint64_t low_watermark;
+    double rate;
+    DropPolicy policy;
+    LatencyHistogram * write_latency;
+    StreamMetrics * metrics;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<Entry> queue;
+    StagingStats counters;
+    std::optional<std::chrono::steady_clock::time_point> in_flight;
+    bool stopping;
+
+    std::thread migrator;
+
+    void migrate();
+
+public:
+    // Records the duration of every file write into `write_latency` and counts the written
+    // files in `metrics` if given.
+    StagingWriter(std::unordered_map<std::string,double> config, LatencyHistogram * write_latency = nullptr,
+            StreamMetrics * metrics = nullptr);
+    ~StagingWriter();
+
+    // Stage a file for writing, returns false if the file was dropped.
+    bool push(fs::path path, const unsigned char * data, size_t size);
+
+    StagingStats stats();
+};
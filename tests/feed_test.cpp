@@ -0,0 +1,195 @@
+// Tests FrameFeed with a synthetic producer, without cameras.
+//
+// usage: feed_test
+
+#include "../src/feed.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <poll.h>
+
+static int failures = 0;
+
+#define CHECK(cond) do{ \
+    if(!(cond)){ \
+        std::fprintf(stderr,"%s:%d: check failed: %s\n",__FILE__,__LINE__,#cond); \
+        failures++; \
+    } \
+}while(0)
+
+// Returns whether `fd` becomes readable within `timeout_ms`.
+static bool readable(int fd, int timeout_ms){
+    pollfd entry{fd,POLLIN,0};
+    return ::poll(&entry,1,timeout_ms) == 1 && (entry.revents & POLLIN);
+}
+
+// Releases the producers of a test, which wait until released.
+struct Gate{
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool open = false;
+
+    void wait(){
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->cond.wait(lock,[this]{ return this->open; });
+    }
+
+    void release(){
+        {
+            std::lock_guard<std::mutex> guard(this->mutex);
+            this->open = true;
+        }
+        this->cond.notify_all();
+    }
+};
+
+static void test_eventfd_signals_results(){
+    Gate gate;
+    int next = 0;
+    FrameFeed<int> feed([&]{
+        gate.wait();
+        return next++;
+    },2);
+    int fd = feed.start();
+    CHECK(fd >= 0);
+    // Nothing is queued before the producer runs.
+    CHECK(!readable(fd,20));
+    int out = -1;
+    CHECK(!feed.try_pop(out));
+
+    gate.release();
+    CHECK(readable(fd,1000));
+    CHECK(feed.try_pop(out));
+    CHECK(out == 0);
+    // Taking a result clears the eventfd, it is signaled again by the next result.
+    CHECK(readable(fd,1000));
+    feed.stop();
+}
+
+static void test_results_are_ordered(){
+    int next = 0;
+    FrameFeed<int> feed([&]{ return next++; },3);
+    int fd = feed.start();
+    int expected = 0;
+    while(expected < 100){
+        int out;
+        if(!feed.try_pop(out)){
+            CHECK(readable(fd,1000));
+            continue;
+        }
+        CHECK(out == expected);
+        expected++;
+    }
+    // The producer waits while the queue is full.
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    CHECK(feed.size() == 3);
+    CHECK(feed.pop() == 100);
+    feed.stop();
+}
+
+static void test_producer_error_is_rethrown(){
+    int next = 0;
+    FrameFeed<int> feed([&]{
+        if(next == 3){
+            throw std::runtime_error("producer failed");
+        }
+        return next++;
+    },8);
+    int fd = feed.start();
+    // The results queued before the error are delivered first.
+    for(int i = 0;i < 3;++i){
+        CHECK(feed.pop() == i);
+    }
+    CHECK(readable(fd,1000));
+    try{
+        int out;
+        feed.try_pop(out);
+        CHECK(!"try_pop did not rethrow the producer error");
+    }catch(const std::runtime_error & e){
+        CHECK(std::strcmp(e.what(),"producer failed") == 0);
+    }
+    try{
+        feed.pop();
+        CHECK(!"pop did not rethrow the producer error");
+    }catch(const std::runtime_error & e){
+        CHECK(std::strcmp(e.what(),"producer failed") == 0);
+    }
+    CHECK(!feed.running() || feed.size() == 0);
+}
+
+static void test_stop_wakes_waiting_consumer(){
+    Gate gate;
+    FrameFeed<int> feed([&]{
+        gate.wait();
+        return 0;
+    },2);
+    int fd = feed.start();
+
+    std::atomic<bool> closed(false);
+    std::thread consumer([&]{
+        try{
+            feed.pop();
+        }catch(const std::runtime_error & e){
+            closed = std::string(e.what()) == "stream is closed";
+        }
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    // Stop waits for the running capture, which is released once the consumer has woken.
+    std::thread stopper([&]{ feed.stop(); });
+    consumer.join();
+    CHECK(closed);
+    CHECK(readable(fd,0));
+    gate.release();
+    stopper.join();
+
+    CHECK(!feed.running());
+    int out;
+    try{
+        feed.try_pop(out);
+        CHECK(!"try_pop did not report the stopped feed");
+    }catch(const std::runtime_error & e){
+        CHECK(std::string(e.what()) == "stream is closed");
+    }
+    try{
+        feed.start();
+        CHECK(!"a stopped feed was restarted");
+    }catch(const std::runtime_error &){
+    }
+}
+
+static void test_pause_keeps_results(){
+    int next = 0;
+    FrameFeed<int> feed([&]{ return next++; },2);
+    feed.start();
+    CHECK(feed.pop() == 0);
+    CHECK(feed.pause());
+    CHECK(!feed.running());
+    size_t queued = feed.size();
+    for(size_t i = 0;i < queued;++i){
+        CHECK(feed.pop() == (int)i + 1);
+    }
+    // A resumed feed continues where it stopped.
+    feed.start();
+    CHECK(feed.pop() == (int)queued + 1);
+    feed.stop();
+}
+
+int main(){
+    test_eventfd_signals_results();
+    test_results_are_ordered();
+    test_producer_error_is_rethrown();
+    test_stop_wakes_waiting_consumer();
+    test_pause_keeps_results();
+    if(failures){
+        std::fprintf(stderr,"feed_test: %d checks failed\n",failures);
+        return 1;
+    }
+    std::printf("feed_test: passed\n");
+    return 0;
+}
@@ -0,0 +1,165 @@
+// Tests the vectorized luma kernels against scalar references.
+//
+// usage: luma_test
+
+#include "../src/luma.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(cond) do{ \
+    if(!(cond)){ \
+        std::fprintf(stderr,"%s:%d: check failed: %s\n",__FILE__,__LINE__,#cond); \
+        failures++; \
+    } \
+}while(0)
+
+// Deterministic pseudo random bytes.
+static std::vector<uint8_t> random_bytes(size_t size, uint32_t seed){
+    std::vector<uint8_t> res(size);
+    for(auto & value: res){
+        seed = seed * 1664525 + 1013904223;
+        value = seed >> 24;
+    }
+    return res;
+}
+
+static uint64_t reference_sad(const uint8_t * a, const uint8_t * b, size_t size){
+    uint64_t sum = 0;
+    for(size_t i = 0;i < size;i++){
+        sum += std::abs((int)a[i] - (int)b[i]);
+    }
+    return sum;
+}
+
+static double reference_laplacian_variance(const uint8_t * data, uint32_t width, uint32_t height, size_t pitch){
+    if(width < 3 || height < 3){
+        return 0.0;
+    }
+    int64_t sum = 0;
+    int64_t sum_sq = 0;
+    for(uint32_t y = 1;y + 1 < height;y++){
+        for(uint32_t x = 1;x + 1 < width;x++){
+            const uint8_t * center = data + y * pitch + x;
+            int64_t lap = (int64_t)center[-(int64_t)pitch] + center[pitch] + center[-1] + center[1] - 4 * (int64_t)center[0];
+            sum += lap;
+            sum_sq += lap * lap;
+        }
+    }
+    double count = (double)(width - 2) * (double)(height - 2);
+    double mean = (double)sum / count;
+    return (double)sum_sq / count - mean * mean;
+}
+
+static bool close_to(double value, double expected){
+    return std::fabs(value - expected) <= 1e-9 * std::max(1.0,std::fabs(expected));
+}
+
+// Sizes around the vector width and the accumulation blocks of the kernels.
+static const size_t sad_sizes[] = {0,1,15,16,17,31,33,255,2047,2048,2049,4096 + 7,16 * 128 * 3 + 5};
+
+static void test_sad_matches_reference(){
+    for(size_t size: sad_sizes){
+        // Unaligned starts as well, the planes of python arrays have any alignment.
+        for(size_t offset = 0;offset < 4;offset++){
+            auto a = random_bytes(size + offset,size * 7 + offset);
+            auto b = random_bytes(size + offset,size * 13 + offset + 1);
+            uint64_t res = luma_sad(a.data() + offset,b.data() + offset,size);
+            uint64_t expected = reference_sad(a.data() + offset,b.data() + offset,size);
+            if(res != expected){
+                std::fprintf(stderr,"luma_sad size %zu offset %zu: %llu, expected %llu\n",size,offset,
+                        (unsigned long long)res,(unsigned long long)expected);
+                failures++;
+            }
+        }
+    }
+}
+
+static void test_sad_saturated(){
+    // Every byte differs by 255, the most the narrow accumulators of a block can hold.
+    for(size_t size: sad_sizes){
+        std::vector<uint8_t> black(size,0);
+        std::vector<uint8_t> white(size,255);
+        CHECK(luma_sad(black.data(),white.data(),size) == 255 * (uint64_t)size);
+        CHECK(luma_sad(white.data(),black.data(),size) == 255 * (uint64_t)size);
+        CHECK(luma_sad(white.data(),white.data(),size) == 0);
+    }
+}
+
+// Widths around the vector width and the 1024 pixel blocks, odd widths leave a scalar tail.
+static const uint32_t widths[] = {3,4,8,9,10,11,17,31,64,1031,1033,1040,2061};
+static const uint32_t heights[] = {3,4,7};
+
+// Runs the kernel with the plane at `pitch`, the padding after every row is filled with `pad`
+// so reading past the width changes the result.
+static void check_laplacian(const std::vector<uint8_t> & packed, uint32_t width, uint32_t height, size_t pitch, uint8_t pad, const char * pattern){
+    std::vector<uint8_t> plane(pitch * height,pad);
+    for(uint32_t y = 0;y < height;y++){
+        std::copy(packed.begin() + y * width,packed.begin() + (y + 1) * width,plane.begin() + y * pitch);
+    }
+    double res = luma_laplacian_variance(plane.data(),width,height,pitch);
+    double expected = reference_laplacian_variance(packed.data(),width,height,width);
+    if(!close_to(res,expected)){
+        std::fprintf(stderr,"luma_laplacian_variance %s %ux%u pitch %zu: %f, expected %f\n",pattern,width,height,pitch,res,expected);
+        failures++;
+    }
+}
+
+static void test_laplacian_matches_reference(){
+    for(uint32_t width: widths){
+        for(uint32_t height: heights){
+            auto packed = random_bytes((size_t)width * height,width * 31 + height);
+            check_laplacian(packed,width,height,width,0,"random");
+            check_laplacian(packed,width,height,width + 13,255,"random");
+            check_laplacian(packed,width,height,(width + 63) / 64 * 64 + 64,0,"random");
+        }
+    }
+}
+
+static void test_laplacian_saturated(){
+    for(uint32_t width: widths){
+        for(uint32_t height: heights){
+            // A checkerboard of black and white gives the largest laplacian of either sign at
+            // every pixel, which stresses the 16 bit lanes and the 32 bit sums of squares.
+            std::vector<uint8_t> checker((size_t)width * height);
+            // White pixels surrounded by black on every other row.
+            std::vector<uint8_t> lines((size_t)width * height);
+            for(uint32_t y = 0;y < height;y++){
+                for(uint32_t x = 0;x < width;x++){
+                    checker[y * width + x] = (x + y) % 2 ? 255 : 0;
+                    lines[y * width + x] = y % 2 ? 255 : 0;
+                }
+            }
+            check_laplacian(checker,width,height,width,0,"checker");
+            check_laplacian(checker,width,height,width + 5,255,"checker");
+            check_laplacian(lines,width,height,width,0,"lines");
+            check_laplacian(lines,width,height,width + 5,128,"lines");
+        }
+    }
+}
+
+static void test_laplacian_small_planes(){
+    std::vector<uint8_t> plane(16,200);
+    CHECK(luma_laplacian_variance(plane.data(),2,8,2) == 0.0);
+    CHECK(luma_laplacian_variance(plane.data(),8,2,8) == 0.0);
+    // A flat plane has no variance.
+    CHECK(luma_laplacian_variance(plane.data(),4,4,4) == 0.0);
+}
+
+int main(){
+    test_sad_matches_reference();
+    test_sad_saturated();
+    test_laplacian_matches_reference();
+    test_laplacian_saturated();
+    test_laplacian_small_planes();
+    if(failures){
+        std::fprintf(stderr,"luma_test: %d checks failed\n",failures);
+        return 1;
+    }
+    std::printf("luma_test: passed\n");
+    return 0;
+}
@@ -0,0 +1,137 @@
+// Tests the sensor mode selection of plan_sensor_mode against tables of sensor modes.
+//
+// usage: mode_planner_test
+
+#include "../src/mode_planner.hpp"
+
+#include <cstdio>
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+// A sensor mode which captures at up to `max_fps` and down to 2 frames per second.
+static SensorModeInfo mode(uint32_t width, uint32_t height, double max_fps){
+    return SensorModeInfo{
+        width,
+        height,
+        (uint64_t)(1e9 / max_fps),
+        (uint64_t)(1e9 / 2.0),
+        13000,
+        683709000,
+        1.0,
+        22.25,
+        10,
+    };
+}
+
+// Modes of a sensor with 4K, 1080p and 720p modes.
+static const std::vector<SensorModeInfo> uhd_sensor = {
+    mode(3840,2160,30.0),
+    mode(1920,1080,60.0),
+    mode(1280,720,120.0),
+};
+
+// The same sensor with slower modes.
+static const std::vector<SensorModeInfo> slow_sensor = {
+    mode(3840,2160,30.0),
+    mode(1920,1080,30.0),
+    mode(1280,720,60.0),
+};
+
+// A sensor whose second mode is 720p instead of 1080p.
+static const std::vector<SensorModeInfo> hd_sensor = {
+    mode(3840,2160,30.0),
+    mode(1280,720,60.0),
+    mode(640,480,120.0),
+};
+
+struct Case{
+    const char * name;
+    std::vector<std::vector<SensorModeInfo>> cameras;
+    std::pair<uint32_t,uint32_t> resolution;
+    float fps;
+    // The selected mode, none if planning throws.
+    std::optional<uint32_t> mode;
+    // Whether the selected mode covers the resolution.
+    bool covers;
+};
+
+static const std::vector<Case> cases = {
+    {"4K selects the 4K mode",
+        {uhd_sensor},{3840,2160},30.0,0,true},
+    {"720p selects the 720p mode",
+        {uhd_sensor},{1280,720},30.0,2,true},
+    {"a resolution between modes selects the smallest covering mode",
+        {uhd_sensor},{1600,900},30.0,1,true},
+    {"modes which can not reach the frame rate are passed over",
+        {slow_sensor},{1280,720},50.0,2,true},
+    {"modes which can not reach the frame rate are passed over when the rest do not cover",
+        {slow_sensor},{1600,900},50.0,2,false},
+    {"no mode covering the resolution selects the largest mode",
+        {uhd_sensor},{7680,4320},30.0,0,false},
+    {"no covering mode at the frame rate selects the largest mode with it",
+        {uhd_sensor},{3840,2160},60.0,1,false},
+    {"an unsupported frame rate throws",
+        {uhd_sensor},{1280,720},240.0,std::nullopt,false},
+    {"a zero frame rate throws",
+        {uhd_sensor},{1280,720},0.0,std::nullopt,false},
+    {"no cameras throws",
+        {},{1280,720},30.0,std::nullopt,false},
+    {"a camera without modes throws",
+        {uhd_sensor,{}},{1280,720},30.0,std::nullopt,false},
+    {"the modes are intersected over the cameras by size",
+        {uhd_sensor,hd_sensor},{1600,900},30.0,0,true},
+    {"the modes are intersected over the cameras by frame rate",
+        {uhd_sensor,slow_sensor},{1280,720},90.0,std::nullopt,false},
+    {"the frame rate of the slowest camera decides",
+        {uhd_sensor,slow_sensor},{1920,1080},60.0,2,false},
+    {"only the modes every camera has are used",
+        {uhd_sensor,{mode(3840,2160,30.0),mode(1920,1080,60.0)}},{1280,720},30.0,1,true},
+    {"equal pixel rates select the closest aspect ratio",
+        {{mode(1920,1080,60.0),mode(1440,1440,60.0)}},{1000,1000},30.0,1,true},
+    {"equal aspect ratios select the most frame rate headroom",
+        {{mode(1920,1080,30.0),mode(1920,1080,60.0)}},{1920,1080},30.0,1,true},
+    {"equal modes select the first",
+        {{mode(1920,1080,60.0),mode(1920,1080,60.0)}},{1920,1080},30.0,0,true},
+};
+
+int main(){
+    int failures = 0;
+    for(auto & test: cases){
+        std::optional<ModePlan> plan;
+        std::string error;
+        try{
+            plan = plan_sensor_mode(test.cameras,test.resolution,test.fps);
+        }catch(const std::runtime_error & e){
+            error = e.what();
+        }
+        if(!test.mode){
+            if(plan){
+                std::fprintf(stderr,"%s: expected an error, selected mode %u\n",test.name,plan->mode);
+                failures++;
+            }
+            continue;
+        }
+        if(!plan){
+            std::fprintf(stderr,"%s: expected mode %u, got error: %s\n",test.name,*test.mode,error.c_str());
+            failures++;
+            continue;
+        }
+        if(plan->mode != *test.mode || plan->candidates.empty() || plan->candidates[0].mode != plan->mode){
+            std::fprintf(stderr,"%s: expected mode %u, selected mode %u\n",test.name,*test.mode,plan->mode);
+            failures++;
+            continue;
+        }
+        if(plan->candidates[0].covers_resolution != test.covers){
+            std::fprintf(stderr,"%s: expected the mode %s the resolution\n",test.name,
+                    test.covers ? "to cover" : "not to cover");
+            failures++;
+        }
+    }
+    if(failures){
+        std::fprintf(stderr,"mode_planner_test: %d of %zu cases failed\n",failures,cases.size());
+        return 1;
+    }
+    std::printf("mode_planner_test: passed %zu cases\n",cases.size());
+    return 0;
+}
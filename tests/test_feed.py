@@ -0,0 +1,80 @@
+# Tests awaiting frames against a synthetic feed, which needs no cameras.
+import asyncio
+
+import pytest
+
+jepture = pytest.importorskip("jepture")
+
+
+def run(coroutine):
+    return asyncio.run(asyncio.wait_for(coroutine, 10.0))
+
+
+def test_anext_delivers_in_order():
+    async def collect():
+        feed = jepture._SyntheticFeed(20, interval_ms=1.0)
+        try:
+            return [await feed.anext() for _ in range(20)]
+        finally:
+            feed.close()
+
+    assert run(collect()) == list(range(20))
+
+
+def test_anext_does_not_block_the_loop():
+    async def wait():
+        feed = jepture._SyntheticFeed(1, interval_ms=200.0)
+        ticks = 0
+
+        async def tick():
+            nonlocal ticks
+            while True:
+                await asyncio.sleep(0.01)
+                ticks += 1
+
+        ticker = asyncio.ensure_future(tick())
+        try:
+            number = await feed.anext()
+        finally:
+            ticker.cancel()
+            feed.close()
+        return number, ticks
+
+    number, ticks = run(wait())
+    assert number == 0
+    # The loop kept running while the frame was awaited, and was woken by the eventfd.
+    assert ticks >= 5
+
+
+def test_producer_error_is_raised():
+    async def collect():
+        feed = jepture._SyntheticFeed(3, error="sensor lost")
+        numbers = []
+        try:
+            with pytest.raises(RuntimeError, match="sensor lost"):
+                while True:
+                    numbers.append(await feed.anext())
+        finally:
+            feed.close()
+        return numbers
+
+    # The frames produced before the error are delivered first.
+    assert run(collect()) == [0, 1, 2]
+
+
+def test_close_ends_waiting_iteration():
+    async def iterate():
+        feed = jepture._SyntheticFeed(1000, interval_ms=100.0)
+        numbers = []
+
+        async def consume():
+            async for number in feed:
+                numbers.append(number)
+
+        consumer = asyncio.ensure_future(consume())
+        await asyncio.sleep(0.02)
+        feed.close()
+        await consumer
+        return numbers
+
+    assert run(iterate()) == []
@@ -0,0 +1,27 @@
+# Tests against the camera of a jetson, skipped where jepture or a camera is not available.
+import pytest
+
+jepture = pytest.importorskip("jepture")
+
+
+@pytest.fixture
+def one_camera():
+    try:
+        jepture.sensor_modes(0)
+    except Exception:
+        pytest.skip("requires a camera")
+    return [(0, "camera")]
+
+
+def test_skip_returns_prefetched_written_frame(one_camera, tmp_path):
+    with jepture.JpegStream(one_camera, resolution=(640, 480), fps=30.0, image_dir=str(tmp_path)) as stream:
+        # Iterating prefetches the frame after the returned one, which is written right away.
+        first = next(stream)
+        frames = stream.next(skip=True)
+        assert frames[0].number > first[0].number
+        assert frames[0].written
+        assert (tmp_path / "camera" / "{}.jpg".format(frames[0].number)).exists()
+        # Without a prefetched frame the frame is skipped.
+        skipped = stream.next(skip=True)
+        assert not skipped[0].written
+        assert not (tmp_path / "camera" / "{}.jpg".format(skipped[0].number)).exists()
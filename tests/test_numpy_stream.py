@@ -0,0 +1,65 @@
+# Tests against the cameras of a jetson, skipped where jepture or two cameras are not available.
+import pytest
+
+jepture = pytest.importorskip("jepture")
+
+
+@pytest.fixture
+def two_cameras():
+    try:
+        jepture.sensor_modes(1)
+    except Exception:
+        pytest.skip("requires two cameras")
+    return [(0, "left"), (1, "right")]
+
+
+def test_next_many_fills_repeated_frames(two_cameras):
+    # The right camera runs at a lower rate, so some of its frames are repeated.
+    with jepture.NumpyStream(two_cameras, resolution=(640, 480), fps=30.0,
+            camera_config={"right": {"fps": 10.0}}) as stream:
+        records, images = stream.next_many(12)
+
+    frame = 640 * 480 * 4
+    assert images.shape == (12, 2, 480, 640, 4)
+    assert images.nbytes == 12 * 2 * frame
+    for index, record in enumerate(records):
+        assert record["offset"] == index * frame
+        assert record["size"] == frame
+
+    numbers = [record["number"] for record in records if record["camera"] == 1]
+    assert len(set(numbers)) < len(numbers)
+    for i in range(1, 12):
+        if numbers[i] == numbers[i - 1]:
+            assert (images[i, 1] == images[i - 1, 1]).all()
+
+
+def test_next_many_rejects_mixed_resolutions(two_cameras):
+    with jepture.NumpyStream(two_cameras, resolution=(640, 480), fps=30.0,
+            camera_config={"right": {"width": 320, "height": 240}}) as stream:
+        with pytest.raises(RuntimeError):
+            stream.next_many(2)
+        # The stream is still usable with next.
+        frames = stream.next()
+        assert frames[0].array.shape == (480, 640, 4)
+        assert frames[1].array.shape == (240, 320, 4)
+
+
+@pytest.fixture
+def one_camera():
+    try:
+        jepture.sensor_modes(0)
+    except Exception:
+        pytest.skip("requires a camera")
+    return [(0, "camera")]
+
+
+def test_skip_discards_prefetched_frame(one_camera):
+    with jepture.NumpyStream(one_camera, resolution=(640, 480), fps=30.0) as stream:
+        # Iterating prefetches the frame after the returned one.
+        first = next(stream)
+        skipped = stream.next(skip=True)
+        assert skipped[0].array.size == 0
+        assert skipped[0].number > first[0].number
+        frames = stream.next()
+        assert frames[0].array.shape == (480, 640, 4)
+        assert frames[0].number > skipped[0].number